@@ -0,0 +1,763 @@
+/*
+ * Minimal MQTT 3.1.1 broker for the relay ESP32, so the scanner can reach
+ * the relay over the LAN without going through the central Mosquitto.
+ *
+ * Everything is sized up front; a message never allocates:
+ *   - a static topic table registered at setup (addTopic); publishes to
+ *     other topics are acknowledged and dropped
+ *   - EDGE_MAX_CLIENTS client slots, each with a fixed receive buffer
+ *   - one retained message per topic, up to EDGE_RETAINED_LEN bytes
+ *   - a fixed ring of messages waiting to be bridged to the central broker
+ *
+ * Clients authenticate with the shared token set by setToken() as the CONNECT
+ * password (any username). Without a token every CONNECT is refused.
+ *
+ * Supported: CONNECT (clean sessions, no will), PUBLISH at QoS 0/1 in,
+ * QoS 0 out, SUBSCRIBE/UNSUBSCRIBE with + and # filters matched against the
+ * topic table, PINGREQ, DISCONNECT and keep-alive timeouts. QoS 2 and
+ * persistent sessions are rejected by closing the connection.
+ *
+ * Topics flagged EDGE_TOPIC_LOCAL are handed to the firmware's callback.
+ * Topics flagged EDGE_TOPIC_BRIDGE are queued for the firmware to forward
+ * upstream from loop(), off the actuation path.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <cstring>
+
+constexpr size_t EDGE_MAX_CLIENTS = 4;
+constexpr size_t EDGE_MAX_TOPICS = 10; // online flag + command and status topic per relay channel
+constexpr size_t EDGE_TOPIC_LEN = 32;
+constexpr size_t EDGE_RETAINED_LEN = 128;
+constexpr size_t EDGE_PACKET_LEN = 512;
+constexpr size_t EDGE_CLIENT_ID_LEN = 24;
+constexpr size_t EDGE_BRIDGE_QUEUE_LEN = 8;
+constexpr unsigned long EDGE_CONNECT_TIMEOUT_MS = 5000;
+
+enum EdgeTopicFlags : uint8_t
+{
+  EDGE_TOPIC_LOCAL = 0x01,  // deliver to the firmware's local handler
+  EDGE_TOPIC_BRIDGE = 0x02, // queue client publishes for the central broker
+};
+
+struct EdgeBridgeMessage
+{
+  const char *topic;
+  const uint8_t *payload;
+  size_t length;
+  bool retain;
+};
+
+struct EdgeBrokerStats
+{
+  uint32_t connects;
+  uint32_t rejected;       // slots full or bad CONNECT
+  uint32_t auth_failed;    // CONNECT without the shared token
+  uint32_t publishes_in;
+  uint32_t deliveries;     // messages written to subscribers
+  uint32_t unknown_topic;  // publishes outside the topic table
+  uint32_t oversize;       // packets larger than EDGE_PACKET_LEN, skipped
+  uint32_t retained_cleared; // retained publishes above EDGE_RETAINED_LEN; the old value is dropped too
+  uint32_t bridge_dropped; // oldest queued message overwritten
+};
+
+class EdgeBroker
+{
+public:
+  using LocalHandler = void (*)(const char *topic, const uint8_t *payload, size_t length, void *ctx);
+
+  // Register topics before begin(); returns false when the table is full
+  bool addTopic(const char *name, uint8_t flags)
+  {
+    if (topic_count_ >= EDGE_MAX_TOPICS || strlen(name) >= EDGE_TOPIC_LEN)
+    {
+      return false;
+    }
+    Topic &topic = topics_[topic_count_++];
+    strncpy(topic.name, name, sizeof(topic.name) - 1);
+    topic.flags = flags;
+    topic.retained_len = 0;
+    return true;
+  }
+
+  void setLocalHandler(LocalHandler handler, void *ctx)
+  {
+    handler_ = handler;
+    handler_ctx_ = ctx;
+  }
+
+  // The string must outlive the broker; nullptr or "" refuses every client
+  void setToken(const char *token) { token_ = token; }
+
+  void begin(uint16_t port)
+  {
+    server_.begin(port);
+    server_.setNoDelay(true);
+    running_ = true;
+  }
+
+  void end()
+  {
+    for (Slot &slot : slots_)
+    {
+      if (slot.active)
+      {
+        closeSlot(slot);
+      }
+    }
+    server_.end();
+    running_ = false;
+  }
+
+  bool running() const { return running_; }
+
+  void loop()
+  {
+    if (!running_)
+    {
+      return;
+    }
+
+    const unsigned long now = millis();
+    acceptClients(now);
+    for (Slot &slot : slots_)
+    {
+      if (slot.active)
+      {
+        serviceClient(slot, now);
+      }
+    }
+  }
+
+  // Publish from the firmware itself: retained and sent to LAN subscribers,
+  // but neither looped back to the local handler nor bridged
+  bool publish(const char *topic_name, const uint8_t *payload, size_t length, bool retain)
+  {
+    const int index = findTopic(topic_name, strlen(topic_name));
+    if (index < 0)
+    {
+      return false;
+    }
+    if (retain)
+    {
+      storeRetained(topics_[index], payload, length);
+    }
+    deliver(static_cast<uint8_t>(index), payload, length, false);
+    return true;
+  }
+
+  // Oldest message waiting for the central broker; valid until popBridge()
+  bool peekBridge(EdgeBridgeMessage &message) const
+  {
+    if (bridge_count_ == 0)
+    {
+      return false;
+    }
+    const BridgeEntry &entry = bridge_[bridge_head_];
+    message.topic = topics_[entry.topic].name;
+    message.payload = entry.payload;
+    message.length = entry.length;
+    message.retain = entry.retain;
+    return true;
+  }
+
+  void popBridge()
+  {
+    if (bridge_count_ > 0)
+    {
+      bridge_head_ = (bridge_head_ + 1) % EDGE_BRIDGE_QUEUE_LEN;
+      bridge_count_--;
+    }
+  }
+
+  uint8_t clientCount() const
+  {
+    uint8_t count = 0;
+    for (const Slot &slot : slots_)
+    {
+      count += slot.active && slot.session ? 1 : 0;
+    }
+    return count;
+  }
+
+  size_t bridgeBacklog() const { return bridge_count_; }
+  const EdgeBrokerStats &stats() const { return stats_; }
+
+private:
+  struct Topic
+  {
+    char name[EDGE_TOPIC_LEN];
+    uint8_t flags;
+    uint16_t retained_len;
+    uint8_t retained[EDGE_RETAINED_LEN];
+  };
+
+  struct Slot
+  {
+    WiFiClient client;
+    bool active = false;
+    bool session = false; // CONNECT accepted
+    uint32_t subscriptions = 0;
+    uint16_t keepalive_s = 0;
+    unsigned long accepted_ms = 0;
+    unsigned long last_rx_ms = 0;
+    size_t skip = 0; // bytes left of an oversize packet
+    size_t rx_len = 0;
+    char id[EDGE_CLIENT_ID_LEN] = {0};
+    uint8_t rx[EDGE_PACKET_LEN];
+  };
+
+  struct BridgeEntry
+  {
+    uint8_t topic;
+    bool retain;
+    uint16_t length;
+    uint8_t payload[EDGE_RETAINED_LEN];
+  };
+
+  static uint16_t readU16(const uint8_t *p) { return static_cast<uint16_t>((p[0] << 8) | p[1]); }
+
+  // + matches one level, a trailing # matches the rest
+  static bool topicMatches(const char *filter, size_t filter_len, const char *topic)
+  {
+    size_t f = 0;
+    size_t t = 0;
+    const size_t topic_len = strlen(topic);
+    while (f < filter_len)
+    {
+      if (filter[f] == '#')
+      {
+        return f + 1 == filter_len;
+      }
+      if (filter[f] == '+')
+      {
+        while (t < topic_len && topic[t] != '/')
+        {
+          t++;
+        }
+        f++;
+        continue;
+      }
+      if (t >= topic_len || filter[f] != topic[t])
+      {
+        // "a/#" also matches "a"
+        return t == topic_len && f + 2 == filter_len && filter[f] == '/' && filter[f + 1] == '#';
+      }
+      f++;
+      t++;
+    }
+    return t == topic_len;
+  }
+
+  int findTopic(const char *name, size_t length) const
+  {
+    for (size_t i = 0; i < topic_count_; i++)
+    {
+      if (strlen(topics_[i].name) == length && memcmp(topics_[i].name, name, length) == 0)
+      {
+        return static_cast<int>(i);
+      }
+    }
+    return -1;
+  }
+
+  void storeRetained(Topic &topic, const uint8_t *payload, size_t length)
+  {
+    // An empty retained publish clears the topic, as in MQTT. One that does
+    // not fit clears it too: a new subscriber must not get the stale value.
+    if (length > EDGE_RETAINED_LEN)
+    {
+      topic.retained_len = 0;
+      stats_.retained_cleared++;
+      Serial.print("Edge broker: retained message on ");
+      Serial.print(topic.name);
+      Serial.println(" too large to keep; cleared");
+      return;
+    }
+    memcpy(topic.retained, payload, length);
+    topic.retained_len = static_cast<uint16_t>(length);
+  }
+
+  // Compares every byte so the reply time does not reveal the matching prefix
+  bool tokenMatches(const uint8_t *password, size_t length) const
+  {
+    const size_t token_len = token_ ? strlen(token_) : 0;
+    if (token_len == 0 || length != token_len)
+    {
+      return false;
+    }
+    uint8_t diff = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+      diff |= static_cast<uint8_t>(password[i] ^ static_cast<uint8_t>(token_[i]));
+    }
+    return diff == 0;
+  }
+
+  void acceptClients(unsigned long now)
+  {
+    WiFiClient incoming = server_.accept();
+    while (incoming)
+    {
+      Slot *free_slot = nullptr;
+      for (Slot &slot : slots_)
+      {
+        if (!slot.active)
+        {
+          free_slot = &slot;
+          break;
+        }
+      }
+      if (!free_slot)
+      {
+        stats_.rejected++;
+        incoming.stop();
+      }
+      else
+      {
+        free_slot->client = incoming;
+        free_slot->client.setNoDelay(true);
+        free_slot->active = true;
+        free_slot->session = false;
+        free_slot->subscriptions = 0;
+        free_slot->keepalive_s = 0;
+        free_slot->accepted_ms = now;
+        free_slot->last_rx_ms = now;
+        free_slot->skip = 0;
+        free_slot->rx_len = 0;
+        free_slot->id[0] = '\0';
+      }
+      incoming = server_.accept();
+    }
+  }
+
+  void closeSlot(Slot &slot)
+  {
+    slot.client.stop();
+    slot.active = false;
+    slot.session = false;
+    slot.subscriptions = 0;
+  }
+
+  void serviceClient(Slot &slot, unsigned long now)
+  {
+    if (!slot.client.connected())
+    {
+      closeSlot(slot);
+      return;
+    }
+
+    while (slot.active && slot.client.available() > 0)
+    {
+      if (slot.skip > 0)
+      {
+        uint8_t scratch[64];
+        const size_t want = slot.skip < sizeof(scratch) ? slot.skip : sizeof(scratch);
+        const int got = slot.client.read(scratch, want);
+        if (got <= 0)
+        {
+          break;
+        }
+        slot.skip -= static_cast<size_t>(got);
+        continue;
+      }
+
+      const int got = slot.client.read(&slot.rx[slot.rx_len], EDGE_PACKET_LEN - slot.rx_len);
+      if (got <= 0)
+      {
+        break;
+      }
+      slot.rx_len += static_cast<size_t>(got);
+      slot.last_rx_ms = now;
+      if (!processBuffer(slot))
+      {
+        closeSlot(slot);
+        return;
+      }
+    }
+
+    // CONNECT must come promptly; afterwards 1.5x the keep-alive is allowed
+    const unsigned long idle_limit =
+      slot.session ? static_cast<unsigned long>(slot.keepalive_s) * 1500UL : EDGE_CONNECT_TIMEOUT_MS;
+    if (slot.active && idle_limit > 0 && now - slot.last_rx_ms > idle_limit)
+    {
+      closeSlot(slot);
+    }
+  }
+
+  // Returns false when the connection has to be dropped
+  bool processBuffer(Slot &slot)
+  {
+    while (slot.rx_len >= 2)
+    {
+      uint32_t remaining = 0;
+      size_t header_len = 1;
+      uint32_t multiplier = 1;
+      bool complete = false;
+      while (header_len < slot.rx_len && header_len <= 4)
+      {
+        const uint8_t digit = slot.rx[header_len++];
+        remaining += (digit & 0x7F) * multiplier;
+        multiplier *= 128;
+        if ((digit & 0x80) == 0)
+        {
+          complete = true;
+          break;
+        }
+      }
+      if (!complete)
+      {
+        return header_len <= 4; // malformed after four length bytes
+      }
+
+      const size_t total = header_len + remaining;
+      if (total > EDGE_PACKET_LEN)
+      {
+        stats_.oversize++;
+        if (!slot.session)
+        {
+          return false;
+        }
+        slot.skip = total - slot.rx_len;
+        slot.rx_len = 0;
+        return true;
+      }
+      if (slot.rx_len < total)
+      {
+        return true;
+      }
+
+      if (!handlePacket(slot, slot.rx[0], &slot.rx[header_len], remaining))
+      {
+        return false;
+      }
+      memmove(slot.rx, &slot.rx[total], slot.rx_len - total);
+      slot.rx_len -= total;
+    }
+    return true;
+  }
+
+  bool handlePacket(Slot &slot, uint8_t header, const uint8_t *body, size_t length)
+  {
+    const uint8_t type = header >> 4;
+    if (!slot.session && type != 1)
+    {
+      return false;
+    }
+
+    switch (type)
+    {
+    case 1:
+      return handleConnect(slot, body, length);
+    case 3:
+      return handlePublish(slot, header, body, length);
+    case 8:
+      return handleSubscribe(slot, body, length, true);
+    case 10:
+      return handleSubscribe(slot, body, length, false);
+    case 12:
+    {
+      const uint8_t pingresp[2] = {0xD0, 0x00};
+      return slot.client.write(pingresp, sizeof(pingresp)) == sizeof(pingresp);
+    }
+    case 14:
+      return false; // DISCONNECT
+    default:
+      return false; // QoS 2 flow or server-only packets
+    }
+  }
+
+  bool handleConnect(Slot &slot, const uint8_t *body, size_t length)
+  {
+    if (slot.session || length < 10)
+    {
+      return false;
+    }
+
+    const uint16_t name_len = readU16(body);
+    size_t offset = 2 + name_len;
+    if (offset + 4 > length)
+    {
+      return false;
+    }
+    const bool mqtt311 = name_len == 4 && memcmp(&body[2], "MQTT", 4) == 0 && body[offset] == 4;
+    const bool mqtt31 = name_len == 6 && memcmp(&body[2], "MQIsdp", 6) == 0 && body[offset] == 3;
+    const uint8_t flags = body[offset + 1];
+    slot.keepalive_s = readU16(&body[offset + 2]);
+    offset += 4;
+
+    uint8_t return_code = 0x00;
+    if (!mqtt311 && !mqtt31)
+    {
+      return_code = 0x01; // unacceptable protocol version
+    }
+    else if ((flags & 0x02) == 0 || (flags & 0x04) != 0)
+    {
+      return_code = 0x02; // persistent sessions and wills are not supported
+    }
+
+    if (return_code == 0x00)
+    {
+      if (offset + 2 > length || offset + 2 + readU16(&body[offset]) > length)
+      {
+        return false;
+      }
+      const uint16_t id_len = readU16(&body[offset]);
+      const size_t copy = id_len < EDGE_CLIENT_ID_LEN - 1 ? id_len : EDGE_CLIENT_ID_LEN - 1;
+      memcpy(slot.id, &body[offset + 2], copy);
+      slot.id[copy] = '\0';
+      offset += 2 + id_len;
+
+      // Username (ignored), then the password carrying the shared token
+      if ((flags & 0x80) != 0)
+      {
+        if (offset + 2 > length || offset + 2 + readU16(&body[offset]) > length)
+        {
+          return false;
+        }
+        offset += 2 + readU16(&body[offset]);
+      }
+      bool authorized = false;
+      if ((flags & 0x40) != 0)
+      {
+        if (offset + 2 > length || offset + 2 + readU16(&body[offset]) > length)
+        {
+          return false;
+        }
+        authorized = tokenMatches(&body[offset + 2], readU16(&body[offset]));
+      }
+      if (!authorized)
+      {
+        return_code = 0x04; // bad user name or password
+        stats_.auth_failed++;
+      }
+    }
+
+    if (return_code == 0x00)
+    {
+      // A reconnecting client replaces its stale session
+      for (Slot &other : slots_)
+      {
+        if (&other != &slot && other.active && other.session && strcmp(other.id, slot.id) == 0 && slot.id[0])
+        {
+          closeSlot(other);
+        }
+      }
+    }
+
+    const uint8_t connack[4] = {0x20, 0x02, 0x00, return_code};
+    if (slot.client.write(connack, sizeof(connack)) != sizeof(connack) || return_code != 0x00)
+    {
+      stats_.rejected++;
+      return false;
+    }
+    slot.session = true;
+    stats_.connects++;
+    return true;
+  }
+
+  bool handlePublish(Slot &slot, uint8_t header, const uint8_t *body, size_t length)
+  {
+    const uint8_t qos = (header >> 1) & 0x03;
+    const bool retain = (header & 0x01) != 0;
+    if (qos > 1 || length < 2)
+    {
+      return false;
+    }
+
+    const uint16_t topic_len = readU16(body);
+    size_t offset = 2 + topic_len;
+    if (offset + (qos ? 2 : 0) > length)
+    {
+      return false;
+    }
+    const char *topic_name = reinterpret_cast<const char *>(&body[2]);
+    uint16_t packet_id = 0;
+    if (qos)
+    {
+      packet_id = readU16(&body[offset]);
+      offset += 2;
+    }
+    const uint8_t *payload = &body[offset];
+    const size_t payload_len = length - offset;
+    stats_.publishes_in++;
+
+    const int index = findTopic(topic_name, topic_len);
+    if (index < 0)
+    {
+      stats_.unknown_topic++;
+    }
+    else
+    {
+      Topic &topic = topics_[index];
+      if (retain)
+      {
+        storeRetained(topic, payload, payload_len);
+      }
+      deliver(static_cast<uint8_t>(index), payload, payload_len, false);
+      if (topic.flags & EDGE_TOPIC_BRIDGE)
+      {
+        queueBridge(static_cast<uint8_t>(index), payload, payload_len, retain);
+      }
+      if ((topic.flags & EDGE_TOPIC_LOCAL) && handler_)
+      {
+        handler_(topic.name, payload, payload_len, handler_ctx_);
+      }
+    }
+
+    if (qos == 1)
+    {
+      const uint8_t puback[4] = {0x40, 0x02, static_cast<uint8_t>(packet_id >> 8), static_cast<uint8_t>(packet_id)};
+      return slot.client.write(puback, sizeof(puback)) == sizeof(puback);
+    }
+    return true;
+  }
+
+  bool handleSubscribe(Slot &slot, const uint8_t *body, size_t length, bool subscribe)
+  {
+    if (length < 2)
+    {
+      return false;
+    }
+
+    uint8_t reply[4 + EDGE_MAX_TOPICS] = {static_cast<uint8_t>(subscribe ? 0x90 : 0xB0), 0x02, body[0], body[1]};
+    size_t reply_len = 4;
+    uint32_t matched_now = 0;
+    size_t offset = 2;
+    while (offset + 2 <= length)
+    {
+      const uint16_t filter_len = readU16(&body[offset]);
+      const char *filter = reinterpret_cast<const char *>(&body[offset + 2]);
+      offset += 2 + filter_len + (subscribe ? 1 : 0);
+      if (offset > length)
+      {
+        return false;
+      }
+
+      uint32_t matched = 0;
+      for (size_t i = 0; i < topic_count_; i++)
+      {
+        if (topicMatches(filter, filter_len, topics_[i].name))
+        {
+          matched |= 1u << i;
+        }
+      }
+
+      if (subscribe)
+      {
+        slot.subscriptions |= matched;
+        matched_now |= matched;
+        // Granted QoS 0, or failure when the filter matches nothing we carry
+        if (reply_len < sizeof(reply))
+        {
+          reply[reply_len++] = matched ? 0x00 : 0x80;
+        }
+      }
+      else
+      {
+        slot.subscriptions &= ~matched;
+      }
+    }
+
+    reply[1] = static_cast<uint8_t>(reply_len - 2);
+    if (slot.client.write(reply, reply_len) != reply_len)
+    {
+      return false;
+    }
+
+    for (size_t i = 0; i < topic_count_; i++)
+    {
+      if ((matched_now & (1u << i)) && topics_[i].retained_len > 0)
+      {
+        writePublish(slot, static_cast<uint8_t>(i), topics_[i].retained, topics_[i].retained_len, true);
+      }
+    }
+    return true;
+  }
+
+  void deliver(uint8_t index, const uint8_t *payload, size_t length, bool retain)
+  {
+    for (Slot &slot : slots_)
+    {
+      if (slot.active && slot.session && (slot.subscriptions & (1u << index)))
+      {
+        writePublish(slot, index, payload, length, retain);
+      }
+    }
+  }
+
+  // Header and payload go out in one write so each message is one segment
+  void writePublish(Slot &slot, uint8_t index, const uint8_t *payload, size_t length, bool retain)
+  {
+    const Topic &topic = topics_[index];
+    const size_t topic_len = strlen(topic.name);
+    const size_t remaining = 2 + topic_len + length;
+    if (remaining + 5 > sizeof(tx_))
+    {
+      stats_.oversize++;
+      return;
+    }
+
+    size_t pos = 0;
+    tx_[pos++] = static_cast<uint8_t>(0x30 | (retain ? 0x01 : 0x00));
+    size_t value = remaining;
+    do
+    {
+      uint8_t digit = value % 128;
+      value /= 128;
+      tx_[pos++] = static_cast<uint8_t>(digit | (value ? 0x80 : 0x00));
+    } while (value > 0);
+    tx_[pos++] = static_cast<uint8_t>(topic_len >> 8);
+    tx_[pos++] = static_cast<uint8_t>(topic_len);
+    memcpy(&tx_[pos], topic.name, topic_len);
+    pos += topic_len;
+    memcpy(&tx_[pos], payload, length);
+    pos += length;
+
+    if (slot.client.write(tx_, pos) != pos)
+    {
+      // A subscriber that cannot keep up is dropped rather than buffered
+      closeSlot(slot);
+      return;
+    }
+    stats_.deliveries++;
+  }
+
+  void queueBridge(uint8_t index, const uint8_t *payload, size_t length, bool retain)
+  {
+    if (length > EDGE_RETAINED_LEN)
+    {
+      stats_.oversize++;
+      return;
+    }
+    if (bridge_count_ == EDGE_BRIDGE_QUEUE_LEN)
+    {
+      // Keep the newest state; the oldest message is the least useful upstream
+      popBridge();
+      stats_.bridge_dropped++;
+    }
+    BridgeEntry &entry = bridge_[(bridge_head_ + bridge_count_) % EDGE_BRIDGE_QUEUE_LEN];
+    entry.topic = index;
+    entry.retain = retain;
+    entry.length = static_cast<uint16_t>(length);
+    memcpy(entry.payload, payload, length);
+    bridge_count_++;
+  }
+
+  WiFiServer server_{0};
+  bool running_ = false;
+  Topic topics_[EDGE_MAX_TOPICS] = {};
+  size_t topic_count_ = 0;
+  Slot slots_[EDGE_MAX_CLIENTS];
+  BridgeEntry bridge_[EDGE_BRIDGE_QUEUE_LEN] = {};
+  size_t bridge_head_ = 0;
+  size_t bridge_count_ = 0;
+  uint8_t tx_[EDGE_PACKET_LEN + 8] = {};
+  LocalHandler handler_ = nullptr;
+  void *handler_ctx_ = nullptr;
+  const char *token_ = nullptr;
+  EdgeBrokerStats stats_ = {};
+};
@@ -0,0 +1,308 @@
+/*
+ * Heap and stack instrumentation shared by the scanner and relay firmwares.
+ *
+ * Always available (cheap, read on each telemetry report):
+ *   - free heap, minimum-ever free heap and largest free block, which
+ *     together show fragmentation and slow leaks over long uptimes
+ *   - stack high-water marks of the tasks registered with watchTask()
+ *
+ * Debug builds (-D MEM_DIAG_TRACK_ALLOCS=1 plus the --wrap linker flags, see
+ * the *_debug environments in platformio.ini) also count every malloc,
+ * calloc and realloc by call site. A call site is the return address of the
+ * allocator call; decode it with xtensa-esp32-elf-addr2line -pfiaC -e
+ * firmware.elf <addr>. Allocations made through operator new or String are
+ * attributed to the library helper that calls malloc.
+ *
+ * beginNoAlloc()/endNoAlloc() mark a path that must not touch the heap. Only
+ * allocations made by the calling task are counted. Any that happen are
+ * logged and counted as violations. With -D MEM_DIAG_STRICT=1 the firmware
+ * aborts instead, so a debug run stops at the first violation.
+ *
+ * Include this header from one translation unit only; it defines the
+ * allocator wrappers.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef MEM_DIAG_TRACK_ALLOCS
+#define MEM_DIAG_TRACK_ALLOCS 0
+#endif
+
+#ifndef MEM_DIAG_STRICT
+#define MEM_DIAG_STRICT 0
+#endif
+
+constexpr size_t MEM_DIAG_MAX_TASKS = 6;
+constexpr size_t MEM_DIAG_MAX_SITES = 32;
+constexpr size_t MEM_DIAG_REPORT_SITES = 8;
+
+struct MemDiagHeap
+{
+  uint32_t free_bytes;
+  uint32_t min_free_bytes; // lowest free heap since boot
+  uint32_t largest_block;  // biggest single allocation that would succeed
+  uint32_t total_bytes;
+};
+
+inline MemDiagHeap memDiagHeap()
+{
+  MemDiagHeap heap = {};
+  heap.free_bytes = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+  heap.min_free_bytes = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+  heap.largest_block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+  heap.total_bytes = heap_caps_get_total_size(MALLOC_CAP_8BIT);
+  return heap;
+}
+
+struct MemDiagSite
+{
+  uintptr_t pc;
+  uint32_t count;
+  uint32_t bytes;
+};
+
+#if MEM_DIAG_TRACK_ALLOCS
+
+// Written from the allocator wrappers, which can run on any task or core
+static portMUX_TYPE mem_diag_mux = portMUX_INITIALIZER_UNLOCKED;
+static MemDiagSite mem_diag_sites[MEM_DIAG_MAX_SITES];
+static uint32_t mem_diag_untracked = 0; // allocations after the site table filled up
+static uint32_t mem_diag_total = 0;
+static TaskHandle_t mem_diag_scope_task = nullptr;
+static uint32_t mem_diag_scope_allocs = 0;
+
+static void memDiagRecord(const void *caller, size_t size)
+{
+  const uintptr_t pc = reinterpret_cast<uintptr_t>(caller);
+  const TaskHandle_t task = xTaskGetCurrentTaskHandle();
+
+  portENTER_CRITICAL_SAFE(&mem_diag_mux);
+  mem_diag_total++;
+  if (mem_diag_scope_task != nullptr && task == mem_diag_scope_task)
+  {
+    mem_diag_scope_allocs++;
+  }
+
+  // Open addressing on the return address; the table never shrinks
+  size_t index = (pc >> 2) % MEM_DIAG_MAX_SITES;
+  size_t probes = 0;
+  while (probes < MEM_DIAG_MAX_SITES && mem_diag_sites[index].pc != 0 && mem_diag_sites[index].pc != pc)
+  {
+    index = (index + 1) % MEM_DIAG_MAX_SITES;
+    probes++;
+  }
+  if (probes == MEM_DIAG_MAX_SITES)
+  {
+    mem_diag_untracked++;
+  }
+  else
+  {
+    MemDiagSite &site = mem_diag_sites[index];
+    site.pc = pc;
+    site.count++;
+    site.bytes += static_cast<uint32_t>(size);
+  }
+  portEXIT_CRITICAL_SAFE(&mem_diag_mux);
+}
+
+extern "C" void *__real_malloc(size_t size);
+extern "C" void *__real_calloc(size_t count, size_t size);
+extern "C" void *__real_realloc(void *ptr, size_t size);
+
+extern "C" void *__wrap_malloc(size_t size)
+{
+  memDiagRecord(__builtin_return_address(0), size);
+  return __real_malloc(size);
+}
+
+extern "C" void *__wrap_calloc(size_t count, size_t size)
+{
+  memDiagRecord(__builtin_return_address(0), count * size);
+  return __real_calloc(count, size);
+}
+
+extern "C" void *__wrap_realloc(void *ptr, size_t size)
+{
+  // realloc(ptr, 0) frees; everything else may hand out a new block
+  if (size > 0)
+  {
+    memDiagRecord(__builtin_return_address(0), size);
+  }
+  return __real_realloc(ptr, size);
+}
+
+#endif // MEM_DIAG_TRACK_ALLOCS
+
+class MemDiag
+{
+public:
+  // Watch a task's stack; nullptr watches the calling task
+  bool watchTask(const char *label, TaskHandle_t task)
+  {
+    if (task == nullptr)
+    {
+      task = xTaskGetCurrentTaskHandle();
+    }
+    if (task_count_ >= MEM_DIAG_MAX_TASKS)
+    {
+      return false;
+    }
+    tasks_[task_count_].label = label;
+    tasks_[task_count_].handle = task;
+    task_count_++;
+    return true;
+  }
+
+  // Look a system task up by its FreeRTOS name, e.g. "esp_timer" or "tiT"
+  bool watchTask(const char *name)
+  {
+    TaskHandle_t task = xTaskGetHandle(name);
+    return task != nullptr && watchTask(name, task);
+  }
+
+  void beginNoAlloc()
+  {
+#if MEM_DIAG_TRACK_ALLOCS
+    portENTER_CRITICAL(&mem_diag_mux);
+    mem_diag_scope_task = xTaskGetCurrentTaskHandle();
+    mem_diag_scope_allocs = 0;
+    portEXIT_CRITICAL(&mem_diag_mux);
+#endif
+  }
+
+  // Returns the number of heap allocations since beginNoAlloc()
+  uint32_t endNoAlloc(const char *path)
+  {
+    uint32_t allocs = 0;
+#if MEM_DIAG_TRACK_ALLOCS
+    portENTER_CRITICAL(&mem_diag_mux);
+    allocs = mem_diag_scope_allocs;
+    mem_diag_scope_task = nullptr;
+    portEXIT_CRITICAL(&mem_diag_mux);
+
+    checked_paths_++;
+    if (allocs > 0)
+    {
+      violations_++;
+      Serial.print("MEMDIAG: ");
+      Serial.print(path);
+      Serial.print(" allocated ");
+      Serial.print(allocs);
+      Serial.println(" time(s)");
+#if MEM_DIAG_STRICT
+      abort();
+#endif
+    }
+#else
+    (void)path;
+#endif
+    return allocs;
+  }
+
+  void print() const
+  {
+    const MemDiagHeap heap = memDiagHeap();
+    Serial.print("Heap: ");
+    Serial.print(heap.free_bytes);
+    Serial.print(" free of ");
+    Serial.print(heap.total_bytes);
+    Serial.print(" bytes, min ever ");
+    Serial.print(heap.min_free_bytes);
+    Serial.print(", largest block ");
+    Serial.print(heap.largest_block);
+    if (heap.free_bytes > 0)
+    {
+      // 0% when all free memory is one block
+      Serial.print(" (fragmentation ");
+      Serial.print(100 - static_cast<uint32_t>(static_cast<uint64_t>(heap.largest_block) * 100 / heap.free_bytes));
+      Serial.print("%)");
+    }
+    Serial.println();
+
+    if (task_count_ > 0)
+    {
+      Serial.print("Stack high-water:");
+      for (size_t i = 0; i < task_count_; i++)
+      {
+        // ESP-IDF reports the remaining stack in bytes
+        Serial.print(" ");
+        Serial.print(tasks_[i].label);
+        Serial.print(" ");
+        Serial.print(static_cast<uint32_t>(uxTaskGetStackHighWaterMark(tasks_[i].handle)));
+        Serial.print(" B");
+        Serial.print(i + 1 < task_count_ ? "," : "");
+      }
+      Serial.println();
+    }
+
+#if MEM_DIAG_TRACK_ALLOCS
+    printSites();
+#endif
+  }
+
+private:
+  struct WatchedTask
+  {
+    const char *label;
+    TaskHandle_t handle;
+  };
+
+#if MEM_DIAG_TRACK_ALLOCS
+  void printSites() const
+  {
+    MemDiagSite sites[MEM_DIAG_MAX_SITES];
+    portENTER_CRITICAL(&mem_diag_mux);
+    memcpy(sites, mem_diag_sites, sizeof(sites));
+    const uint32_t total = mem_diag_total;
+    const uint32_t untracked = mem_diag_untracked;
+    portEXIT_CRITICAL(&mem_diag_mux);
+
+    Serial.print("Allocations: ");
+    Serial.print(total);
+    Serial.print(" total, ");
+    Serial.print(untracked);
+    Serial.print(" untracked; no-alloc paths ");
+    Serial.print(checked_paths_);
+    Serial.print(" checked, ");
+    Serial.print(violations_);
+    Serial.println(" allocated");
+
+    // Busiest sites first; selection sort on a copy keeps the lock short
+    for (size_t rank = 0; rank < MEM_DIAG_REPORT_SITES; rank++)
+    {
+      size_t best = rank;
+      for (size_t i = rank + 1; i < MEM_DIAG_MAX_SITES; i++)
+      {
+        if (sites[i].count > sites[best].count)
+        {
+          best = i;
+        }
+      }
+      if (sites[best].count == 0)
+      {
+        break;
+      }
+      const MemDiagSite site = sites[best];
+      sites[best] = sites[rank];
+      sites[rank] = site;
+
+      char line[48];
+      snprintf(line, sizeof(line), "  0x%08lx %8lu allocs %10lu B", static_cast<unsigned long>(site.pc),
+               static_cast<unsigned long>(site.count), static_cast<unsigned long>(site.bytes));
+      Serial.println(line);
+    }
+  }
+#endif
+
+  WatchedTask tasks_[MEM_DIAG_MAX_TASKS] = {};
+  size_t task_count_ = 0;
+  uint32_t checked_paths_ = 0;
+  uint32_t violations_ = 0;
+};
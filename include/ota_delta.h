@@ -0,0 +1,278 @@
+/*
+ * Streaming firmware patcher used by the OTA updater (ota_update.h) and by the
+ * host publisher (tools/ota_publish.cpp) to self-check the deltas it builds.
+ *
+ * A payload is either the raw target image or a delta against the running
+ * image (little endian):
+ *
+ *   header: 'R' 'D' 'L' 'T' | version u8 | reserved u8[3] | base_size u32 | target_size u32
+ *   ops:    0x01 COPY   src_offset u32 | length u32    copy from the running image
+ *           0x02 INSERT length u32 | length bytes      literal bytes
+ *
+ * The patcher consumes the payload in arbitrarily sized pieces (MQTT chunks
+ * or HTTP reads) and emits the target image strictly in order, so it can be
+ * written straight into the inactive OTA partition without buffering.
+ *
+ * A COPY op can produce most of the image from nine payload bytes. feed()
+ * runs it to completion; the device uses consume() instead, which stops at a
+ * pending COPY, and runs the copy in slices with pump() from its loop().
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+constexpr uint8_t OTA_DELTA_VERSION = 1;
+constexpr size_t OTA_DELTA_HEADER_LEN = 16;
+constexpr uint8_t OTA_DELTA_OP_COPY = 0x01;
+constexpr uint8_t OTA_DELTA_OP_INSERT = 0x02;
+constexpr size_t OTA_COPY_BUFFER_LEN = 512;
+
+// Source reads and target writes are provided by the caller
+struct OtaPatchIo
+{
+  bool (*read_source)(void *ctx, uint32_t offset, uint8_t *buffer, size_t length);
+  bool (*write_target)(void *ctx, const uint8_t *data, size_t length);
+  void *ctx;
+};
+
+class OtaDeltaPatcher
+{
+public:
+  // delta = false streams the payload through unchanged (full image)
+  void begin(const OtaPatchIo &io, bool delta, uint32_t target_size)
+  {
+    io_ = io;
+    target_size_ = target_size;
+    written_ = 0;
+    base_size_ = 0;
+    pending_ = 0;
+    copy_source_ = 0;
+    field_len_ = 0;
+    state_ = delta ? State::Header : State::Raw;
+    error_ = nullptr;
+  }
+
+  // Runs every op to completion, however much of the image it produces
+  bool feed(const uint8_t *data, size_t length)
+  {
+    size_t offset = 0;
+    while (state_ != State::Failed)
+    {
+      offset += consume(&data[offset], length - offset);
+      if (!copying())
+      {
+        break;
+      }
+      pump(SIZE_MAX);
+    }
+    return state_ != State::Failed;
+  }
+
+  // Takes payload bytes until a COPY op is pending or the patcher fails;
+  // returns how many were taken. The rest is passed again after pump().
+  size_t consume(const uint8_t *data, size_t length)
+  {
+    size_t offset = 0;
+    while (offset < length && state_ != State::Failed && state_ != State::CopyData)
+    {
+      switch (state_)
+      {
+      case State::Raw:
+      {
+        const size_t take = length - offset;
+        if (!emit(&data[offset], take))
+        {
+          return false;
+        }
+        offset += take;
+        break;
+      }
+      case State::Header:
+      case State::OpArgs:
+        offset += collect(&data[offset], length - offset);
+        if (field_len_ == field_target_)
+        {
+          if (state_ == State::Header ? !parseHeader() : !runOp())
+          {
+            return false;
+          }
+        }
+        break;
+      case State::OpCode:
+        op_ = data[offset++];
+        if (op_ != OTA_DELTA_OP_COPY && op_ != OTA_DELTA_OP_INSERT)
+        {
+          return fail("unknown delta op");
+        }
+        field_len_ = 0;
+        field_target_ = op_ == OTA_DELTA_OP_COPY ? 8 : 4;
+        state_ = State::OpArgs;
+        break;
+      case State::InsertData:
+      {
+        const size_t available = length - offset;
+        const size_t take = available < pending_ ? available : pending_;
+        if (!emit(&data[offset], take))
+        {
+          return false;
+        }
+        offset += take;
+        pending_ -= take;
+        if (pending_ == 0)
+        {
+          state_ = State::OpCode;
+        }
+        break;
+      }
+      case State::CopyData:
+      case State::Failed:
+        break;
+      }
+    }
+    return offset;
+  }
+
+  // Copies up to budget bytes of the pending COPY op from the running image
+  bool pump(size_t budget)
+  {
+    while (state_ == State::CopyData && budget > 0)
+    {
+      size_t take = pending_ < OTA_COPY_BUFFER_LEN ? pending_ : OTA_COPY_BUFFER_LEN;
+      take = take < budget ? take : budget;
+      if (!io_.read_source(io_.ctx, copy_source_, copy_buffer_, take))
+      {
+        return fail("reading running image failed");
+      }
+      if (!emit(copy_buffer_, take))
+      {
+        return false;
+      }
+      copy_source_ += take;
+      pending_ -= take;
+      budget -= take;
+      if (pending_ == 0)
+      {
+        state_ = State::OpCode;
+      }
+    }
+    return state_ != State::Failed;
+  }
+
+  // True once the whole target has been produced and no op is half-read
+  bool complete() const
+  {
+    return state_ != State::Failed && written_ == target_size_ &&
+           (state_ == State::Raw || state_ == State::OpCode);
+  }
+
+  bool copying() const { return state_ == State::CopyData; }
+  bool failed() const { return state_ == State::Failed; }
+  uint32_t written() const { return written_; }
+  uint32_t baseSize() const { return base_size_; }
+  const char *error() const { return error_; }
+
+private:
+  enum class State : uint8_t
+  {
+    Raw,
+    Header,
+    OpCode,
+    OpArgs,
+    InsertData,
+    CopyData,
+    Failed,
+  };
+
+  static uint32_t readU32(const uint8_t *p)
+  {
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+           (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+  }
+
+  size_t collect(const uint8_t *data, size_t length)
+  {
+    if (state_ == State::Header)
+    {
+      field_target_ = OTA_DELTA_HEADER_LEN;
+    }
+    const size_t missing = field_target_ - field_len_;
+    const size_t take = length < missing ? length : missing;
+    memcpy(&field_[field_len_], data, take);
+    field_len_ += take;
+    return take;
+  }
+
+  bool parseHeader()
+  {
+    if (memcmp(field_, "RDLT", 4) != 0 || field_[4] != OTA_DELTA_VERSION)
+    {
+      return fail("bad delta header");
+    }
+    base_size_ = readU32(&field_[8]);
+    if (readU32(&field_[12]) != target_size_)
+    {
+      return fail("delta target size does not match manifest");
+    }
+    state_ = State::OpCode;
+    return true;
+  }
+
+  bool runOp()
+  {
+    if (op_ == OTA_DELTA_OP_INSERT)
+    {
+      pending_ = readU32(field_);
+      state_ = pending_ ? State::InsertData : State::OpCode;
+      return true;
+    }
+
+    const uint32_t source = readU32(field_);
+    const uint32_t length = readU32(&field_[4]);
+    if (source > base_size_ || length > base_size_ - source)
+    {
+      return fail("delta copy outside base image");
+    }
+    copy_source_ = source;
+    pending_ = length;
+    state_ = pending_ ? State::CopyData : State::OpCode;
+    return true;
+  }
+
+  bool emit(const uint8_t *data, size_t length)
+  {
+    if (length > target_size_ - written_)
+    {
+      return fail("payload produces more than target_size bytes");
+    }
+    if (length > 0 && !io_.write_target(io_.ctx, data, length))
+    {
+      return fail("writing target image failed");
+    }
+    written_ += length;
+    return true;
+  }
+
+  bool fail(const char *reason)
+  {
+    error_ = reason;
+    state_ = State::Failed;
+    return false;
+  }
+
+  OtaPatchIo io_ = {};
+  State state_ = State::Failed;
+  uint8_t op_ = 0;
+  uint8_t field_[OTA_DELTA_HEADER_LEN] = {};
+  size_t field_len_ = 0;
+  size_t field_target_ = 0;
+  uint32_t pending_ = 0; // bytes left in the current INSERT or COPY op
+  uint32_t copy_source_ = 0;
+  uint32_t base_size_ = 0;
+  uint32_t target_size_ = 0;
+  uint32_t written_ = 0;
+  const char *error_ = nullptr;
+  uint8_t copy_buffer_[OTA_COPY_BUFFER_LEN] = {};
+};
@@ -0,0 +1,145 @@
+/*
+ * Chunk sequencing for OTA transfers, shared by the OTA updater
+ * (ota_update.h), the publisher (tools/ota_publish.cpp) and the host check
+ * (tools/ota_transfer_check.cpp).
+ *
+ * A chunk message is a little-endian header followed by payload bytes:
+ *
+ *   id u32 | seq u32 | payload bytes
+ *
+ * The publisher sends the payload in passes, each starting again at seq 0.
+ * A device joins a pass at seq 0, takes every following seq exactly once and
+ * drops duplicates. A gap aborts the attempt, and the device rejoins at the
+ * next pass's seq 0. HTTP pulls use the same byte accounting without chunk
+ * headers.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+constexpr size_t OTA_CHUNK_HEADER_LEN = 8;
+
+enum class OtaChunkAction : uint8_t
+{
+  Ignore,   // other release, not seq 0 while waiting, or a duplicate
+  Start,    // seq 0 while waiting: open a session, then feed the data
+  Feed,     // next chunk of the open session
+  Missed,   // gap in the sequence: abort and wait for the next pass
+  Overflow, // more bytes than the manifest's payload_size
+};
+
+struct OtaChunk
+{
+  OtaChunkAction action;
+  const uint8_t *data;
+  size_t length;
+};
+
+inline void otaWriteChunkHeader(uint8_t *out, uint32_t id, uint32_t seq)
+{
+  for (int i = 0; i < 4; i++)
+  {
+    out[i] = static_cast<uint8_t>(id >> (8 * i));
+    out[4 + i] = static_cast<uint8_t>(seq >> (8 * i));
+  }
+}
+
+class OtaTransfer
+{
+public:
+  // A manifest was accepted; wait for seq 0 of this release
+  void expect(uint32_t id, uint32_t payload_size)
+  {
+    id_ = id;
+    payload_size_ = payload_size;
+    open_ = false;
+  }
+
+  void clear()
+  {
+    id_ = 0;
+    open_ = false;
+  }
+
+  // A session was opened (chunk 0 or an HTTP response)
+  void open(unsigned long now)
+  {
+    open_ = true;
+    next_seq_ = 0;
+    received_ = 0;
+    last_data_ms_ = now;
+  }
+
+  // Back to waiting for seq 0 of the same release
+  void close() { open_ = false; }
+
+  OtaChunk classify(const uint8_t *payload, size_t length) const
+  {
+    OtaChunk chunk = {OtaChunkAction::Ignore, nullptr, 0};
+    if (id_ == 0 || length < OTA_CHUNK_HEADER_LEN || readU32(payload) != id_)
+    {
+      return chunk;
+    }
+
+    const uint32_t seq = readU32(&payload[4]);
+    chunk.data = &payload[OTA_CHUNK_HEADER_LEN];
+    chunk.length = length - OTA_CHUNK_HEADER_LEN;
+    if (!open_)
+    {
+      chunk.action = seq == 0 ? OtaChunkAction::Start : OtaChunkAction::Ignore;
+    }
+    else if (seq < next_seq_)
+    {
+      chunk.action = OtaChunkAction::Ignore;
+    }
+    else if (seq > next_seq_)
+    {
+      chunk.action = OtaChunkAction::Missed;
+      return chunk;
+    }
+    else
+    {
+      chunk.action = OtaChunkAction::Feed;
+    }
+
+    if (chunk.action != OtaChunkAction::Ignore && chunk.length > payload_size_ - (open_ ? received_ : 0))
+    {
+      chunk.action = OtaChunkAction::Overflow;
+    }
+    return chunk;
+  }
+
+  // Accounts for bytes handed to the patcher; chunked = true also moves to the next seq
+  void advance(size_t length, unsigned long now, bool chunked)
+  {
+    received_ += static_cast<uint32_t>(length);
+    last_data_ms_ = now;
+    if (chunked)
+    {
+      next_seq_++;
+    }
+  }
+
+  bool isOpen() const { return open_; }
+  bool complete() const { return open_ && received_ == payload_size_; }
+  bool stalled(unsigned long now, unsigned long timeout_ms) const { return open_ && now - last_data_ms_ > timeout_ms; }
+  uint32_t received() const { return received_; }
+  uint32_t remaining() const { return payload_size_ - received_; }
+  uint32_t nextSeq() const { return next_seq_; }
+
+private:
+  static uint32_t readU32(const uint8_t *p)
+  {
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+           (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+  }
+
+  uint32_t id_ = 0;
+  uint32_t payload_size_ = 0;
+  bool open_ = false;
+  uint32_t next_seq_ = 0;
+  uint32_t received_ = 0;
+  unsigned long last_data_ms_ = 0;
+};
@@ -0,0 +1,861 @@
+/*
+ * Over-the-air firmware updates delivered over MQTT (or pulled over HTTP).
+ *
+ * Topics, relative to the firmware's prefix (e.g. "RFID_OTA/scanner"):
+ *   <prefix>/manifest           retained JSON describing the release
+ *   <prefix>/chunk              binary chunks: id u32 | seq u32 | payload bytes
+ *   <prefix>/status/<client_id> retained JSON progress report from the device
+ *
+ * Manifest fields: id, version, size, sha256, payload_size, optional
+ * delta/base_size/base_sha256 for a delta against the running image, optional
+ * url to pull the payload over HTTP instead of waiting for chunks, and
+ * rollout (0-100). A device only takes part when its MAC-derived bucket is
+ * below rollout, so a release is staged by republishing the same manifest
+ * with a higher percentage.
+ *
+ * The manifest ends with "sig": an ECDSA P-256 signature (DER, hex) over the
+ * manifest text before ',"sig":'. It is checked against the public key passed
+ * to begin(); without a key every manifest is rejected. The manifest carries
+ * the image SHA-256, so the signature covers the image as well.
+ *
+ * The payload is patched (ota_delta.h) and written straight into the inactive
+ * OTA partition as it arrives. The SHA-256 of the written image is checked
+ * before the boot partition is switched. Chunk sequencing lives in
+ * ota_transfer.h: a missed chunk aborts the attempt and the device rejoins on
+ * the publisher's next pass. Other failures (HTTP, flash, a malformed
+ * payload) retry the same release with a doubling backoff; only a release
+ * whose image or delta base fails its SHA-256 check is skipped for good.
+ *
+ * Long work is sliced across loop() passes, so scanning and MQTT keep
+ * running: HTTP pulls read OTA_HTTP_SLICE_LEN bytes per pass, COPY ops write
+ * at most OTA_PATCH_SLICE_LEN image bytes per pass (chunk bytes behind a
+ * pending copy wait in a small backlog), and the running image is hashed
+ * against a delta's base_sha256 OTA_HASH_SLICE_LEN bytes per pass before
+ * the device joins a chunk pass.
+ *
+ * tools/ota_publish.cpp signs manifests, builds deltas and feeds manifests
+ * and chunks through a broker.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <HTTPClient.h>
+#include <Preferences.h>
+#include <PubSubClient.h>
+#include <WiFi.h>
+#include <esp_ota_ops.h>
+#include <esp_partition.h>
+#include <mbedtls/pk.h>
+#include <mbedtls/sha256.h>
+
+#include "ota_delta.h"
+#include "ota_transfer.h"
+
+#ifndef OTA_WITH_SEQUENTIAL_WRITES
+#define OTA_WITH_SEQUENTIAL_WRITES OTA_SIZE_UNKNOWN
+#endif
+
+constexpr size_t OTA_TOPIC_LEN = 80;
+constexpr size_t OTA_URL_LEN = 160;
+constexpr size_t OTA_VERSION_LEN = 24;
+constexpr size_t OTA_IO_BUFFER_LEN = 1024;
+constexpr size_t OTA_HTTP_SLICE_LEN = 4096; // Payload bytes pulled per loop() pass
+constexpr size_t OTA_PATCH_SLICE_LEN = 4096; // Image bytes written per loop() pass while a copy is pending
+constexpr size_t OTA_HASH_SLICE_LEN = 16384; // Running-image bytes hashed per loop() pass
+constexpr size_t OTA_BACKLOG_LEN = 4096;     // Chunk bytes held behind a pending copy
+constexpr size_t OTA_MANIFEST_JSON_CAPACITY = 1024;
+constexpr size_t OTA_SIGNATURE_MAX_LEN = 72; // DER-encoded ECDSA P-256
+constexpr uint8_t OTA_ROLLOUT_MAX = 100;
+constexpr unsigned long OTA_CHUNK_TIMEOUT_MS = 30000;
+constexpr unsigned long OTA_HTTP_TIMEOUT_MS = 10000;
+constexpr unsigned long OTA_RESTART_DELAY_MS = 1000;
+constexpr unsigned long OTA_RETRY_MIN_MS = 30000;    // First retry after a transient failure
+constexpr unsigned long OTA_RETRY_MAX_MS = 1800000;  // Backoff doubles up to 30 min
+constexpr uint8_t OTA_PROGRESS_STEP = 10;
+constexpr const char *OTA_NVS_NAMESPACE = "rfid_ota";
+constexpr const char OTA_SIGNATURE_MARKER[] = ",\"sig\":\"";
+
+// New images stay on probation until they reach the broker once; the
+// verifyRollbackLater() override for that is in src/ota_rollback.cpp
+
+struct OtaManifest
+{
+  uint32_t id;
+  char version[OTA_VERSION_LEN];
+  uint32_t size;
+  uint8_t sha256[32];
+  uint32_t payload_size;
+  bool delta;
+  uint32_t base_size;
+  uint8_t base_sha256[32];
+  uint8_t rollout;
+  char url[OTA_URL_LEN];
+};
+
+class OtaUpdater
+{
+public:
+  // signing_key is the PEM public key that release manifests must be signed with
+  void begin(PubSubClient &mqtt, const char *topic_prefix, const char *client_id, const char *signing_key)
+  {
+    mqtt_ = &mqtt;
+    signing_key_ = signing_key;
+    if (!signing_key_)
+    {
+      Serial.println("OTA: no signing key configured; releases will be rejected");
+    }
+    snprintf(manifest_topic_, sizeof(manifest_topic_), "%s/manifest", topic_prefix);
+    snprintf(chunk_topic_, sizeof(chunk_topic_), "%s/chunk", topic_prefix);
+    snprintf(status_topic_, sizeof(status_topic_), "%s/status/%s", topic_prefix, client_id);
+
+    Preferences prefs;
+    if (prefs.begin(OTA_NVS_NAMESPACE, true))
+    {
+      done_id_ = prefs.getUInt("done_id", 0);
+      prefs.end();
+    }
+
+    uint8_t mac[6] = {0};
+    WiFi.macAddress(mac);
+    uint32_t hash = 2166136261u;
+    for (uint8_t byte_value : mac)
+    {
+      hash = (hash ^ byte_value) * 16777619u;
+    }
+    rollout_bucket_ = static_cast<uint8_t>(hash % 100);
+  }
+
+  void subscribe()
+  {
+    mqtt_->subscribe(manifest_topic_);
+    mqtt_->subscribe(chunk_topic_);
+  }
+
+  // Confirms a freshly installed image once it has proven it can connect
+  void markRunningAppValid()
+  {
+    if (!app_confirmed_)
+    {
+      esp_ota_mark_app_valid_cancel_rollback();
+      app_confirmed_ = true;
+    }
+  }
+
+  // Returns true if the message was an OTA message
+  bool handleMessage(const char *topic, const uint8_t *payload, size_t length)
+  {
+    if (strcmp(topic, manifest_topic_) == 0)
+    {
+      handleManifest(payload, length);
+      return true;
+    }
+    if (strcmp(topic, chunk_topic_) == 0)
+    {
+      handleChunk(payload, length);
+      return true;
+    }
+    return false;
+  }
+
+  void loop(WiFiClient &http_client, unsigned long now)
+  {
+    switch (state_)
+    {
+    case State::Verifying:
+      continueBaseCheck();
+      break;
+    case State::Receiving:
+      if (patchPending())
+      {
+        drainPatch();
+      }
+      else if (http_open_)
+      {
+        continueHttpDownload();
+      }
+
+      if (state_ != State::Receiving || patchPending())
+      {
+        break;
+      }
+      if (transfer_.complete())
+      {
+        closeHttp();
+        finishSession();
+      }
+      else if (http_open_ && transfer_.stalled(now, OTA_HTTP_TIMEOUT_MS))
+      {
+        abortSession("HTTP stream stalled", Retry::Backoff);
+      }
+      else if (!http_open_ && transfer_.stalled(now, OTA_CHUNK_TIMEOUT_MS))
+      {
+        abortSession("chunk timeout; waiting for next pass", Retry::NextPass);
+      }
+      break;
+    case State::Waiting:
+      if (manifest_.url[0] != '\0')
+      {
+        startHttpDownload(http_client);
+      }
+      break;
+    case State::Backoff:
+      if (now - retry_from_ms_ >= retry_delay_ms_)
+      {
+        Serial.println("OTA: retrying release");
+        acceptManifest();
+      }
+      break;
+    case State::Rebooting:
+      if (now - restart_requested_ms_ >= OTA_RESTART_DELAY_MS)
+      {
+        Serial.println("OTA: restarting into new firmware");
+        ESP.restart();
+      }
+      break;
+    case State::Idle:
+      break;
+    }
+  }
+
+  bool busy() const { return state_ == State::Verifying || state_ == State::Receiving || state_ == State::Rebooting; }
+
+private:
+  enum class State : uint8_t
+  {
+    Idle,      // no release to install
+    Verifying, // hashing the running image against a delta's base_sha256
+    Waiting,   // manifest accepted, waiting for chunk 0 or HTTP pull
+    Receiving, // session open, partition being written
+    Backoff,   // transient failure; the same release is retried after retry_delay_ms_
+    Rebooting, // image verified and boot partition switched
+  };
+
+  // What an aborted attempt does next
+  enum class Retry : uint8_t
+  {
+    NextPass, // rejoin at seq 0 of the publisher's next chunk pass
+    Backoff,  // transient failure (network, flash, malformed payload): try again later
+    Never,    // the image failed hash verification: skip this release
+  };
+
+  static bool parseHex(const char *hex, uint8_t *out, size_t out_len)
+  {
+    return hex && strlen(hex) == out_len * 2 && parseHex(hex, out_len * 2, out);
+  }
+
+  static bool parseHex(const char *hex, size_t hex_len, uint8_t *out)
+  {
+    if (hex_len % 2 != 0)
+    {
+      return false;
+    }
+    for (size_t i = 0; i < hex_len / 2; i++)
+    {
+      char pair[3] = {hex[i * 2], hex[i * 2 + 1], '\0'};
+      char *end = nullptr;
+      out[i] = static_cast<uint8_t>(strtoul(pair, &end, 16));
+      if (*end != '\0')
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // The signed text is everything before the trailing ,"sig":"<hex>"} member
+  bool verifyManifestSignature(const uint8_t *payload, size_t length)
+  {
+    const size_t marker_len = sizeof(OTA_SIGNATURE_MARKER) - 1;
+    if (!signing_key_ || length < marker_len + 2 || memcmp(&payload[length - 2], "\"}", 2) != 0)
+    {
+      return false;
+    }
+
+    size_t marker = length - marker_len - 2;
+    while (marker > 0 && memcmp(&payload[marker], OTA_SIGNATURE_MARKER, marker_len) != 0)
+    {
+      marker--;
+    }
+    const size_t hex_len = length - 2 - (marker + marker_len);
+    uint8_t signature[OTA_SIGNATURE_MAX_LEN];
+    if (marker == 0 || hex_len == 0 || hex_len > sizeof(signature) * 2 ||
+        !parseHex(reinterpret_cast<const char *>(&payload[marker + marker_len]), hex_len, signature))
+    {
+      return false;
+    }
+
+    uint8_t digest[32];
+    mbedtls_sha256_context ctx;
+    mbedtls_sha256_init(&ctx);
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+    mbedtls_sha256_starts(&ctx, 0);
+    mbedtls_sha256_update(&ctx, payload, marker);
+    mbedtls_sha256_finish(&ctx, digest);
+#pragma GCC diagnostic pop
+    mbedtls_sha256_free(&ctx);
+
+    mbedtls_pk_context key;
+    mbedtls_pk_init(&key);
+    // PEM keys are parsed including the terminating NUL
+    const bool valid =
+      mbedtls_pk_parse_public_key(&key, reinterpret_cast<const unsigned char *>(signing_key_),
+                                  strlen(signing_key_) + 1) == 0 &&
+      mbedtls_pk_can_do(&key, MBEDTLS_PK_ECKEY) &&
+      mbedtls_pk_verify(&key, MBEDTLS_MD_SHA256, digest, sizeof(digest), signature, hex_len / 2) == 0;
+    mbedtls_pk_free(&key);
+    return valid;
+  }
+
+  void handleManifest(const uint8_t *payload, size_t length)
+  {
+    if (state_ == State::Receiving || state_ == State::Rebooting)
+    {
+      return;
+    }
+
+    if (!verifyManifestSignature(payload, length))
+    {
+      Serial.println("OTA: manifest signature missing or invalid; ignored");
+      return;
+    }
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+    StaticJsonDocument<OTA_MANIFEST_JSON_CAPACITY> doc;
+#pragma GCC diagnostic pop
+    if (deserializeJson(doc, reinterpret_cast<const char *>(payload), length))
+    {
+      Serial.println("OTA: manifest is not valid JSON");
+      return;
+    }
+
+    OtaManifest manifest = {};
+    manifest.id = doc["id"] | 0u;
+    manifest.size = doc["size"] | 0u;
+    manifest.payload_size = doc["payload_size"] | 0u;
+    manifest.delta = doc["delta"] | false;
+    manifest.base_size = doc["base_size"] | 0u;
+    const uint32_t rollout = doc["rollout"] | static_cast<uint32_t>(OTA_ROLLOUT_MAX);
+    if (rollout > OTA_ROLLOUT_MAX)
+    {
+      Serial.println("OTA: manifest rollout above 100; ignored");
+      return;
+    }
+    manifest.rollout = static_cast<uint8_t>(rollout);
+    strncpy(manifest.version, doc["version"] | "", sizeof(manifest.version) - 1);
+    strncpy(manifest.url, doc["url"] | "", sizeof(manifest.url) - 1);
+
+    if (manifest.id == 0 || manifest.id <= done_id_ || manifest.id == failed_id_)
+    {
+      return;
+    }
+    if ((state_ == State::Verifying || state_ == State::Backoff) && manifest.id == manifest_.id)
+    {
+      return; // retained copy after a reconnect; keep checking or backing off
+    }
+    if (manifest.id != manifest_.id)
+    {
+      retry_delay_ms_ = 0;
+    }
+    stopBaseCheck();
+    if (manifest.size == 0 || manifest.payload_size == 0 || !parseHex(doc["sha256"] | "", manifest.sha256, 32) ||
+        (manifest.delta && !parseHex(doc["base_sha256"] | "", manifest.base_sha256, 32)))
+    {
+      Serial.println("OTA: manifest missing size, payload_size or hashes");
+      return;
+    }
+
+    if (rollout_bucket_ >= manifest.rollout)
+    {
+      // Not in this stage; a later manifest with a higher rollout will include us
+      if (manifest.id != deferred_id_)
+      {
+        deferred_id_ = manifest.id;
+        manifest_ = manifest;
+        publishStatus("deferred", 0, "outside current rollout stage");
+      }
+      transfer_.clear();
+      state_ = State::Idle;
+      return;
+    }
+
+    manifest_ = manifest;
+    if (manifest_.delta)
+    {
+      // Chunks are ignored until the base is confirmed; the device joins the next pass
+      transfer_.clear();
+      startBaseCheck();
+      return;
+    }
+    acceptManifest();
+  }
+
+  void acceptManifest()
+  {
+    transfer_.expect(manifest_.id, manifest_.payload_size);
+    state_ = State::Waiting;
+    Serial.print("OTA: release ");
+    Serial.print(manifest_.id);
+    Serial.print(" (");
+    Serial.print(manifest_.version);
+    Serial.print(manifest_.delta ? ", delta " : ", full ");
+    Serial.print(manifest_.payload_size);
+    Serial.println(" bytes) accepted");
+    publishStatus("waiting", 0, manifest_.url[0] ? "pulling over HTTP" : "waiting for chunks");
+  }
+
+  void startBaseCheck()
+  {
+    base_partition_ = esp_ota_get_running_partition();
+    if (!base_partition_ || manifest_.base_size > base_partition_->size)
+    {
+      rejectBase();
+      return;
+    }
+
+    mbedtls_sha256_init(&base_sha_);
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+    mbedtls_sha256_starts(&base_sha_, 0);
+#pragma GCC diagnostic pop
+    base_hashed_ = 0;
+    state_ = State::Verifying;
+    publishStatus("verifying", 0, "hashing the running image");
+  }
+
+  // Hashes the next OTA_HASH_SLICE_LEN bytes of the running image
+  void continueBaseCheck()
+  {
+    const uint32_t stop = manifest_.base_size - base_hashed_ < OTA_HASH_SLICE_LEN
+                            ? manifest_.base_size
+                            : base_hashed_ + OTA_HASH_SLICE_LEN;
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+    while (base_hashed_ < stop)
+    {
+      const size_t take = stop - base_hashed_ < OTA_IO_BUFFER_LEN ? stop - base_hashed_ : OTA_IO_BUFFER_LEN;
+      if (esp_partition_read(base_partition_, base_hashed_, io_buffer_, take) != ESP_OK)
+      {
+        stopBaseCheck();
+        abortSession("reading the running image failed", Retry::Backoff);
+        return;
+      }
+      mbedtls_sha256_update(&base_sha_, io_buffer_, take);
+      base_hashed_ += take;
+    }
+    if (base_hashed_ < manifest_.base_size)
+    {
+      return;
+    }
+
+    uint8_t digest[32];
+    mbedtls_sha256_finish(&base_sha_, digest);
+#pragma GCC diagnostic pop
+    stopBaseCheck();
+    if (memcmp(digest, manifest_.base_sha256, sizeof(digest)) != 0)
+    {
+      rejectBase();
+      return;
+    }
+    acceptManifest();
+  }
+
+  void stopBaseCheck()
+  {
+    if (state_ == State::Verifying)
+    {
+      mbedtls_sha256_free(&base_sha_);
+      state_ = State::Idle;
+    }
+  }
+
+  void rejectBase()
+  {
+    failed_id_ = manifest_.id;
+    state_ = State::Idle;
+    publishStatus("skipped", 0, "delta base does not match running image");
+  }
+
+  void handleChunk(const uint8_t *payload, size_t length)
+  {
+    if ((state_ != State::Waiting && state_ != State::Receiving) || manifest_.url[0] != '\0')
+    {
+      return;
+    }
+
+    const OtaChunk chunk = transfer_.classify(payload, length);
+    switch (chunk.action)
+    {
+    case OtaChunkAction::Ignore:
+      return;
+    case OtaChunkAction::Missed:
+      abortSession("missed a chunk; waiting for next pass", Retry::NextPass);
+      return;
+    case OtaChunkAction::Overflow:
+      abortSession("payload larger than manifest", Retry::Backoff);
+      return;
+    case OtaChunkAction::Start:
+      if (!startSession())
+      {
+        return;
+      }
+      break;
+    case OtaChunkAction::Feed:
+      break;
+    }
+
+    if (feed(chunk.data, chunk.length, true) && !patchPending() && transfer_.complete())
+    {
+      finishSession();
+    }
+  }
+
+  // Waits for the response headers (bounded by OTA_HTTP_TIMEOUT_MS); the
+  // body is read by continueHttpDownload() from later loop() passes
+  void startHttpDownload(WiFiClient &http_client)
+  {
+    http_.setTimeout(OTA_HTTP_TIMEOUT_MS);
+    http_.setConnectTimeout(OTA_HTTP_TIMEOUT_MS);
+
+    if (!http_.begin(http_client, manifest_.url))
+    {
+      abortSession("HTTP begin failed", Retry::Backoff);
+      return;
+    }
+
+    const int httpCode = http_.GET();
+    if (httpCode != HTTP_CODE_OK || http_.getSize() != static_cast<int>(manifest_.payload_size))
+    {
+      http_.end();
+      abortSession("HTTP download failed or size mismatch", Retry::Backoff);
+      return;
+    }
+
+    if (!startSession())
+    {
+      http_.end();
+      return;
+    }
+    http_open_ = true;
+  }
+
+  // Moves at most OTA_HTTP_SLICE_LEN bytes that have already arrived
+  void continueHttpDownload()
+  {
+    WiFiClient *stream = http_.getStreamPtr();
+    size_t budget = OTA_HTTP_SLICE_LEN;
+    while (stream && budget > 0 && state_ == State::Receiving && transfer_.remaining() > 0)
+    {
+      const int available = stream->available();
+      if (available <= 0)
+      {
+        if (!stream->connected())
+        {
+          abortSession("HTTP connection closed early", Retry::Backoff);
+        }
+        return;
+      }
+
+      size_t want = transfer_.remaining() < OTA_IO_BUFFER_LEN ? transfer_.remaining() : OTA_IO_BUFFER_LEN;
+      want = want < budget ? want : budget;
+      want = want < static_cast<size_t>(available) ? want : static_cast<size_t>(available);
+      const int got = stream->read(io_buffer_, want);
+      if (got <= 0 || !feed(io_buffer_, static_cast<size_t>(got), false) || patchPending())
+      {
+        return;
+      }
+      budget -= static_cast<size_t>(got);
+    }
+  }
+
+  void closeHttp()
+  {
+    if (http_open_)
+    {
+      http_.end();
+      http_open_ = false;
+    }
+  }
+
+  bool startSession()
+  {
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    target_partition_ = esp_ota_get_next_update_partition(nullptr);
+    if (!target_partition_ || manifest_.size > target_partition_->size)
+    {
+      abortSession("no OTA partition large enough", Retry::Backoff);
+      return false;
+    }
+
+    const esp_err_t err = esp_ota_begin(target_partition_, OTA_WITH_SEQUENTIAL_WRITES, &ota_handle_);
+    if (err != ESP_OK)
+    {
+      abortSession(esp_err_to_name(err), Retry::Backoff);
+      return false;
+    }
+
+    source_partition_ = running;
+    mbedtls_sha256_init(&sha_);
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+    mbedtls_sha256_starts(&sha_, 0);
+#pragma GCC diagnostic pop
+
+    const OtaPatchIo io = {readSource, writeTarget, this};
+    patcher_.begin(io, manifest_.delta, manifest_.size);
+    backlog_start_ = 0;
+    backlog_len_ = 0;
+    session_open_ = true;
+    transfer_.open(millis());
+    last_progress_ = 0;
+    state_ = State::Receiving;
+    publishStatus("receiving", 0, nullptr);
+    return true;
+  }
+
+  // chunked = true for MQTT chunks, false for HTTP reads. Bytes behind a
+  // pending COPY op go to the backlog, which loop() drains.
+  bool feed(const uint8_t *data, size_t length, bool chunked)
+  {
+    if (length > transfer_.remaining())
+    {
+      abortSession("payload larger than manifest", Retry::Backoff);
+      return false;
+    }
+    transfer_.advance(length, millis(), chunked);
+
+    size_t used = 0;
+    if (!patchPending())
+    {
+      used = patcher_.consume(data, length);
+      if (patcher_.failed())
+      {
+        abortSession(patcher_.error(), Retry::Backoff);
+        return false;
+      }
+    }
+    if (used < length && !holdBack(&data[used], length - used))
+    {
+      abortSession("chunks arrive faster than the image is written; waiting for next pass", Retry::NextPass);
+      return false;
+    }
+
+    const uint8_t progress =
+      static_cast<uint8_t>((static_cast<uint64_t>(transfer_.received()) * 100) / manifest_.payload_size);
+    if (progress >= last_progress_ + OTA_PROGRESS_STEP)
+    {
+      last_progress_ = progress;
+      publishStatus("receiving", progress, nullptr);
+    }
+    return true;
+  }
+
+  bool patchPending() const { return patcher_.copying() || backlog_len_ > 0; }
+
+  bool holdBack(const uint8_t *data, size_t length)
+  {
+    if (backlog_start_ > 0)
+    {
+      memmove(backlog_, &backlog_[backlog_start_], backlog_len_);
+      backlog_start_ = 0;
+    }
+    if (length > sizeof(backlog_) - backlog_len_)
+    {
+      return false;
+    }
+    memcpy(&backlog_[backlog_len_], data, length);
+    backlog_len_ += length;
+    return true;
+  }
+
+  // Writes at most OTA_PATCH_SLICE_LEN image bytes: the pending copy first,
+  // then the backlog up to the next copy
+  void drainPatch()
+  {
+    const uint32_t stop = patcher_.written() + OTA_PATCH_SLICE_LEN;
+    while (patchPending() && patcher_.written() < stop)
+    {
+      if (patcher_.copying())
+      {
+        patcher_.pump(stop - patcher_.written());
+      }
+      else
+      {
+        const size_t take = backlog_len_ < stop - patcher_.written() ? backlog_len_ : stop - patcher_.written();
+        const size_t used = patcher_.consume(&backlog_[backlog_start_], take);
+        backlog_start_ += used;
+        backlog_len_ -= used;
+      }
+      if (patcher_.failed())
+      {
+        abortSession(patcher_.error(), Retry::Backoff);
+        return;
+      }
+    }
+    // Time spent patching does not count as a stalled transfer
+    transfer_.advance(0, millis(), false);
+  }
+
+  void finishSession()
+  {
+    transfer_.clear();
+    if (!patcher_.complete())
+    {
+      abortSession("payload ended before the image was complete", Retry::Backoff);
+      return;
+    }
+
+    uint8_t digest[32];
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+    mbedtls_sha256_finish(&sha_, digest);
+#pragma GCC diagnostic pop
+    if (memcmp(digest, manifest_.sha256, sizeof(digest)) != 0)
+    {
+      abortSession("SHA-256 mismatch", Retry::Never);
+      return;
+    }
+
+    session_open_ = false;
+    mbedtls_sha256_free(&sha_);
+    esp_err_t err = esp_ota_end(ota_handle_);
+    if (err == ESP_OK)
+    {
+      err = esp_ota_set_boot_partition(target_partition_);
+    }
+    if (err != ESP_OK)
+    {
+      abortSession(esp_err_to_name(err), Retry::Backoff);
+      return;
+    }
+
+    done_id_ = manifest_.id;
+    Preferences prefs;
+    if (prefs.begin(OTA_NVS_NAMESPACE, false))
+    {
+      prefs.putUInt("done_id", done_id_);
+      prefs.end();
+    }
+
+    publishStatus("installed", 100, "verified; rebooting");
+    restart_requested_ms_ = millis();
+    state_ = State::Rebooting;
+  }
+
+  void abortSession(const char *reason, Retry retry)
+  {
+    closeHttp();
+    backlog_start_ = 0;
+    backlog_len_ = 0;
+    if (retry == Retry::NextPass)
+    {
+      transfer_.close();
+    }
+    else
+    {
+      transfer_.clear();
+    }
+    if (session_open_)
+    {
+      esp_ota_abort(ota_handle_);
+      mbedtls_sha256_free(&sha_);
+      session_open_ = false;
+    }
+
+    Serial.print("OTA: aborted: ");
+    Serial.println(reason);
+    switch (retry)
+    {
+    case Retry::NextPass:
+      state_ = State::Waiting;
+      publishStatus("waiting", 0, reason);
+      break;
+    case Retry::Backoff:
+      retry_delay_ms_ = retry_delay_ms_ == 0 ? OTA_RETRY_MIN_MS : retry_delay_ms_ * 2;
+      retry_delay_ms_ = retry_delay_ms_ < OTA_RETRY_MAX_MS ? retry_delay_ms_ : OTA_RETRY_MAX_MS;
+      retry_from_ms_ = millis();
+      state_ = State::Backoff;
+      Serial.print("OTA: retrying in ");
+      Serial.print(retry_delay_ms_ / 1000);
+      Serial.println(" s");
+      publishStatus("retrying", 0, reason);
+      break;
+    case Retry::Never:
+      failed_id_ = manifest_.id;
+      state_ = State::Idle;
+      publishStatus("failed", 0, reason);
+      break;
+    }
+  }
+
+  void publishStatus(const char *state, uint8_t progress, const char *detail)
+  {
+    char message[192];
+    snprintf(
+      message,
+      sizeof(message),
+      "{\"id\":%lu,\"version\":\"%s\",\"state\":\"%s\",\"progress\":%u,\"detail\":\"%s\"}",
+      static_cast<unsigned long>(manifest_.id),
+      manifest_.version,
+      state,
+      progress,
+      detail ? detail : "");
+    if (mqtt_ && mqtt_->connected())
+    {
+      mqtt_->publish(status_topic_, message, true);
+    }
+  }
+
+  static bool readSource(void *ctx, uint32_t offset, uint8_t *buffer, size_t length)
+  {
+    OtaUpdater *self = static_cast<OtaUpdater *>(ctx);
+    return esp_partition_read(self->source_partition_, offset, buffer, length) == ESP_OK;
+  }
+
+  static bool writeTarget(void *ctx, const uint8_t *data, size_t length)
+  {
+    OtaUpdater *self = static_cast<OtaUpdater *>(ctx);
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+    mbedtls_sha256_update(&self->sha_, data, length);
+#pragma GCC diagnostic pop
+    return esp_ota_write(self->ota_handle_, data, length) == ESP_OK;
+  }
+
+  PubSubClient *mqtt_ = nullptr;
+  const char *signing_key_ = nullptr;
+  char manifest_topic_[OTA_TOPIC_LEN] = {0};
+  char chunk_topic_[OTA_TOPIC_LEN] = {0};
+  char status_topic_[OTA_TOPIC_LEN] = {0};
+  OtaManifest manifest_ = {};
+  State state_ = State::Idle;
+  uint32_t done_id_ = 0;
+  uint32_t failed_id_ = 0; // release whose image or delta base failed hash verification
+  uint32_t deferred_id_ = 0;
+  uint8_t rollout_bucket_ = 0;
+  bool app_confirmed_ = false;
+
+  OtaDeltaPatcher patcher_;
+  mbedtls_sha256_context sha_;
+  esp_ota_handle_t ota_handle_ = 0;
+  const esp_partition_t *target_partition_ = nullptr;
+  const esp_partition_t *source_partition_ = nullptr;
+  bool session_open_ = false;
+  uint8_t backlog_[OTA_BACKLOG_LEN] = {};
+  size_t backlog_start_ = 0;
+  size_t backlog_len_ = 0;
+  mbedtls_sha256_context base_sha_;
+  const esp_partition_t *base_partition_ = nullptr;
+  uint32_t base_hashed_ = 0;
+  OtaTransfer transfer_;
+  HTTPClient http_;
+  bool http_open_ = false;
+  uint8_t last_progress_ = 0;
+  unsigned long retry_from_ms_ = 0;
+  unsigned long retry_delay_ms_ = 0;
+  unsigned long restart_requested_ms_ = 0;
+  uint8_t io_buffer_[OTA_IO_BUFFER_LEN] = {};
+};
@@ -0,0 +1,198 @@
+/*
+ * Registered-card cache kept in sync with the backend through revisioned
+ * binary deltas (see php-backend/config/registry_sync.php for the encoder).
+ *
+ * Delta layout (little endian):
+ *   'R' 'D' | version u8 | flags u8 | from_rev u32 | to_rev u32 | count u16
+ *   count x ( entry_flags u8 | uid_len u8 | uid bytes )
+ *
+ * A delta carries every change in (from_rev, to_rev]. Entries are idempotent
+ * upserts/deletes, so any delta with from_rev <= local revision < to_rev can
+ * be applied; a delta starting past the local revision means changes were
+ * missed and the caller must fetch "changes since" from the backend.
+ *
+ * Cards are held in a CompactUidSet (see uid_set.h). A delta is validated in
+ * full before anything is applied. Status-only deltas, the common case since
+ * every scan toggles a card, are patched in place; inserts and deletes are
+ * merged into the set's inactive generation and published with one flip, so
+ * lookups never observe a partially applied delta.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "uid_set.h"
+
+constexpr size_t REGISTRY_MAX_UID_LEN = UID_SET_MAX_UID_LEN;
+constexpr size_t REGISTRY_MAX_DELTA_ENTRIES = 256;
+constexpr size_t REGISTRY_DELTA_HEADER_LEN = 14;
+constexpr uint8_t REGISTRY_DELTA_VERSION = 1;
+constexpr uint8_t REGISTRY_DELTA_FLAG_HAS_MORE = 0x01;
+constexpr uint8_t REGISTRY_ENTRY_FLAG_STATUS = 0x01;
+constexpr uint8_t REGISTRY_ENTRY_FLAG_DELETED = 0x02;
+
+enum class DeltaResult
+{
+  Applied,
+  Stale,     // everything in the delta is already applied
+  Gap,       // delta starts after our revision; fetch changes since revision()
+  Malformed, // bad header, truncated entry, trailing bytes or too many entries
+  Overflow,  // out of memory while growing the set
+};
+
+inline const char *deltaResultName(DeltaResult result)
+{
+  switch (result)
+  {
+  case DeltaResult::Applied:
+    return "applied";
+  case DeltaResult::Stale:
+    return "stale";
+  case DeltaResult::Gap:
+    return "gap";
+  case DeltaResult::Malformed:
+    return "malformed";
+  case DeltaResult::Overflow:
+    return "overflow";
+  }
+  return "unknown";
+}
+
+class RegistryCache
+{
+public:
+  bool begin(size_t expected_cards) { return set_.begin(expected_cards); }
+
+  DeltaResult applyDelta(const uint8_t *data, size_t len)
+  {
+    if (!data || len < REGISTRY_DELTA_HEADER_LEN || data[0] != 'R' || data[1] != 'D' ||
+        data[2] != REGISTRY_DELTA_VERSION)
+    {
+      return DeltaResult::Malformed;
+    }
+
+    const uint8_t flags = data[3];
+    const uint32_t from_rev = readU32(&data[4]);
+    const uint32_t to_rev = readU32(&data[8]);
+    const uint16_t count = static_cast<uint16_t>(data[12] | (data[13] << 8));
+
+    if (to_rev < from_rev || count > REGISTRY_MAX_DELTA_ENTRIES)
+    {
+      return DeltaResult::Malformed;
+    }
+    if (to_rev <= revision_)
+    {
+      return DeltaResult::Stale;
+    }
+    if (from_rev > revision_)
+    {
+      return DeltaResult::Gap;
+    }
+
+    // Decode and validate the whole payload before touching the set
+    bool membership_changes = false;
+    size_t offset = REGISTRY_DELTA_HEADER_LEN;
+    for (uint16_t i = 0; i < count; i++)
+    {
+      if (offset + 2 > len)
+      {
+        return DeltaResult::Malformed;
+      }
+      const uint8_t entry_flags = data[offset];
+      const uint8_t uid_len = data[offset + 1];
+      if (offset + 2 + uid_len > len || !ops_[i].key.assign(&data[offset + 2], uid_len))
+      {
+        return DeltaResult::Malformed;
+      }
+      ops_[i].status = (entry_flags & REGISTRY_ENTRY_FLAG_STATUS) ? 1 : 0;
+      ops_[i].deleted = (entry_flags & REGISTRY_ENTRY_FLAG_DELETED) != 0;
+      membership_changes = membership_changes || (ops_[i].deleted == set_.contains(ops_[i].key));
+      offset += 2 + uid_len;
+    }
+    if (offset != len)
+    {
+      return DeltaResult::Malformed;
+    }
+
+    if (membership_changes)
+    {
+      const size_t unique = sortOps(count);
+      if (!set_.rebuild(ops_, unique))
+      {
+        return DeltaResult::Overflow;
+      }
+    }
+    else
+    {
+      for (uint16_t i = 0; i < count; i++)
+      {
+        if (!ops_[i].deleted)
+        {
+          set_.setStatus(ops_[i].key, ops_[i].status);
+        }
+      }
+    }
+
+    revision_ = to_rev;
+    has_more_ = (flags & REGISTRY_DELTA_FLAG_HAS_MORE) != 0;
+    return DeltaResult::Applied;
+  }
+
+  // Returns false for unknown cards
+  bool lookup(const uint8_t *uid, uint8_t uid_len, uint8_t &status) const
+  {
+    UidKey key;
+    return key.assign(uid, uid_len) && set_.lookup(key, status);
+  }
+
+  uint32_t revision() const { return revision_; }
+  size_t size() const { return set_.size(); }
+  bool hasMore() const { return has_more_; }
+  UidSetUsage usage() const { return set_.usage(); }
+
+private:
+  static uint32_t readU32(const uint8_t *p)
+  {
+    return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) |
+           (static_cast<uint32_t>(p[2]) << 16) | (static_cast<uint32_t>(p[3]) << 24);
+  }
+
+  // Stable insertion sort (deltas are small and mostly ordered), keeping only
+  // the last op per card so later entries win
+  size_t sortOps(size_t count)
+  {
+    for (size_t i = 1; i < count; i++)
+    {
+      const UidSetOp op = ops_[i];
+      size_t j = i;
+      while (j > 0 && compareUidKeys(ops_[j - 1].key, op.key) > 0)
+      {
+        ops_[j] = ops_[j - 1];
+        j--;
+      }
+      ops_[j] = op;
+    }
+
+    size_t unique = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+      if (unique > 0 && compareUidKeys(ops_[unique - 1].key, ops_[i].key) == 0)
+      {
+        ops_[unique - 1] = ops_[i];
+      }
+      else
+      {
+        ops_[unique++] = ops_[i];
+      }
+    }
+    return unique;
+  }
+
+  CompactUidSet set_;
+  UidSetOp ops_[REGISTRY_MAX_DELTA_ENTRIES];
+  uint32_t revision_ = 0;
+  bool has_more_ = false;
+};
@@ -0,0 +1,370 @@
+/*
+ * Relay command messages, shared by the scanner (publisher) and the relay
+ * controller (subscriber). Each channel has its own retained topic,
+ * RFID_LOGIN/<ch>, so the last command of one lane never replaces another's:
+ *
+ *   {"ch":0,"seq":65537,"cmd":"set","state":1}    latch a channel on or off
+ *   {"ch":0,"seq":65538,"cmd":"pulse","ms":3000}  on now, back off after ms
+ *
+ * Sequence numbers are per channel and compared with serial-number
+ * arithmetic, so the relay drops commands that are older than the last one
+ * it applied (reordered or replayed). The scanner puts a boot epoch kept in
+ * NVS in the upper 16 bits, which keeps its numbers increasing across
+ * reboots. The legacy "0"/"1" payloads are still accepted as unsequenced
+ * latch commands for the topic's channel.
+ *
+ * The relay acknowledges by publishing its channel state, retained, on
+ * RFID_RELAY/status/<ch>:
+ *
+ *   {"ch":0,"seq":65538,"state":1,"gpio":1,"pulsing":1}
+ *
+ * seq is the last applied sequence number. state is what the scheduler
+ * commanded, and gpio is the output pin read back. RelayAckTracker waits for
+ * this status with a deadline and keeps latency and loss counts, both from
+ * the publish and from the card tap that caused it.
+ * RFID_RELAY/online is retained "1" while the relay is connected and "0"
+ * (its last will) when it drops off.
+ */
+
+#pragma once
+
+#include <ArduinoJson.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#if defined(ARDUINO_ARCH_ESP32)
+#include <Preferences.h>
+#include <esp_system.h>
+#endif
+
+constexpr uint32_t RELAY_MAX_PULSE_MS = 600000;
+constexpr size_t RELAY_COMMAND_JSON_CAPACITY = 128;
+constexpr size_t RELAY_COMMAND_MESSAGE_LEN = 80;
+constexpr const char *RELAY_SEQ_NVS_NAMESPACE = "rfid_seq";
+constexpr const char *RELAY_COMMAND_TOPIC_PREFIX = "RFID_LOGIN";
+constexpr size_t RELAY_COMMAND_TOPIC_LEN = 24;
+constexpr const char *RELAY_STATUS_TOPIC_PREFIX = "RFID_RELAY/status";
+constexpr const char *RELAY_ONLINE_TOPIC = "RFID_RELAY/online";
+constexpr size_t RELAY_STATUS_TOPIC_LEN = 32;
+constexpr size_t RELAY_STATUS_MESSAGE_LEN = 96;
+constexpr unsigned long RELAY_ACK_TIMEOUT_MS = 2000;
+
+enum class RelayCommandType : uint8_t
+{
+  Set,
+  Pulse,
+};
+
+struct RelayCommand
+{
+  uint8_t channel;
+  bool sequenced; // false for legacy "0"/"1" payloads
+  uint32_t seq;
+  RelayCommandType type;
+  bool state;        // Set only
+  uint32_t pulse_ms; // Pulse only
+};
+
+// True if sequence number a was issued after b
+inline bool relaySeqNewer(uint32_t a, uint32_t b)
+{
+  return static_cast<int32_t>(a - b) > 0;
+}
+
+inline bool parseRelayCommand(const uint8_t *payload, size_t length, RelayCommand &cmd)
+{
+  cmd = RelayCommand{};
+  cmd.type = RelayCommandType::Set;
+
+  if (length == 1 && (payload[0] == '0' || payload[0] == '1'))
+  {
+    cmd.state = payload[0] == '1';
+    return true;
+  }
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+  StaticJsonDocument<RELAY_COMMAND_JSON_CAPACITY> doc;
+#pragma GCC diagnostic pop
+  if (deserializeJson(doc, reinterpret_cast<const char *>(payload), length))
+  {
+    return false;
+  }
+
+  cmd.channel = static_cast<uint8_t>(doc["ch"] | 0u);
+  if (doc["seq"].is<uint32_t>())
+  {
+    cmd.seq = doc["seq"].as<uint32_t>();
+    cmd.sequenced = true;
+  }
+
+  const char *type = doc["cmd"] | "";
+  if (strcmp(type, "set") == 0 && doc["state"].is<int>())
+  {
+    cmd.state = doc["state"].as<int>() != 0;
+    return true;
+  }
+  if (strcmp(type, "pulse") == 0)
+  {
+    cmd.type = RelayCommandType::Pulse;
+    cmd.state = true;
+    cmd.pulse_ms = doc["ms"] | 0u;
+    return cmd.pulse_ms > 0 && cmd.pulse_ms <= RELAY_MAX_PULSE_MS;
+  }
+  return false;
+}
+
+inline int formatRelayCommand(char *buffer, size_t length, const RelayCommand &cmd)
+{
+  if (cmd.type == RelayCommandType::Pulse)
+  {
+    return snprintf(buffer, length, "{\"ch\":%u,\"seq\":%lu,\"cmd\":\"pulse\",\"ms\":%lu}", cmd.channel,
+                    static_cast<unsigned long>(cmd.seq), static_cast<unsigned long>(cmd.pulse_ms));
+  }
+  return snprintf(buffer, length, "{\"ch\":%u,\"seq\":%lu,\"cmd\":\"set\",\"state\":%u}", cmd.channel,
+                  static_cast<unsigned long>(cmd.seq), cmd.state ? 1u : 0u);
+}
+
+struct RelayStatus
+{
+  uint8_t channel;
+  bool has_seq; // false until the relay applied a sequenced command
+  uint32_t seq;
+  bool state;
+  bool gpio;
+  bool pulsing;
+};
+
+inline int formatRelayCommandTopic(char *buffer, size_t length, uint8_t channel)
+{
+  return snprintf(buffer, length, "%s/%u", RELAY_COMMAND_TOPIC_PREFIX, channel);
+}
+
+// Returns false unless topic is RFID_LOGIN/<ch>
+inline bool parseRelayCommandTopic(const char *topic, uint8_t &channel)
+{
+  const size_t prefix_len = strlen(RELAY_COMMAND_TOPIC_PREFIX);
+  if (strncmp(topic, RELAY_COMMAND_TOPIC_PREFIX, prefix_len) != 0 || topic[prefix_len] != '/')
+  {
+    return false;
+  }
+
+  const char *digits = &topic[prefix_len + 1];
+  unsigned value = 0;
+  size_t i = 0;
+  for (; digits[i] >= '0' && digits[i] <= '9' && i < 3; i++)
+  {
+    value = value * 10 + static_cast<unsigned>(digits[i] - '0');
+  }
+  if (i == 0 || digits[i] != '\0' || value > 255)
+  {
+    return false;
+  }
+  channel = static_cast<uint8_t>(value);
+  return true;
+}
+
+inline int formatRelayStatusTopic(char *buffer, size_t length, uint8_t channel)
+{
+  return snprintf(buffer, length, "%s/%u", RELAY_STATUS_TOPIC_PREFIX, channel);
+}
+
+inline int formatRelayStatus(char *buffer, size_t length, const RelayStatus &status)
+{
+  char seq[20] = {0};
+  if (status.has_seq)
+  {
+    snprintf(seq, sizeof(seq), "\"seq\":%lu,", static_cast<unsigned long>(status.seq));
+  }
+  return snprintf(buffer, length, "{\"ch\":%u,%s\"state\":%u,\"gpio\":%u,\"pulsing\":%u}", status.channel, seq,
+                  status.state ? 1u : 0u, status.gpio ? 1u : 0u, status.pulsing ? 1u : 0u);
+}
+
+inline bool parseRelayStatus(const uint8_t *payload, size_t length, RelayStatus &status)
+{
+  status = RelayStatus{};
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+  StaticJsonDocument<RELAY_COMMAND_JSON_CAPACITY> doc;
+#pragma GCC diagnostic pop
+  if (deserializeJson(doc, reinterpret_cast<const char *>(payload), length) || !doc["gpio"].is<int>())
+  {
+    return false;
+  }
+
+  status.channel = static_cast<uint8_t>(doc["ch"] | 0u);
+  if (doc["seq"].is<uint32_t>())
+  {
+    status.seq = doc["seq"].as<uint32_t>();
+    status.has_seq = true;
+  }
+  status.state = (doc["state"] | 0) != 0;
+  status.gpio = doc["gpio"].as<int>() != 0;
+  status.pulsing = (doc["pulsing"] | 0) != 0;
+  return true;
+}
+
+struct RelayAckStats
+{
+  uint32_t sent;
+  uint32_t acked;
+  uint32_t timed_out;
+  uint32_t superseded; // a newer command went out before the ack arrived
+  uint32_t mismatched; // acked, but the pin did not read back as commanded
+  unsigned long last_ms; // publish -> ack
+  unsigned long max_ms;
+  unsigned long total_ms;
+  unsigned long tap_last_ms; // card tap -> ack
+  unsigned long tap_max_ms;
+  unsigned long tap_total_ms;
+};
+
+// Closed-loop tracking of the last command sent to one relay channel
+class RelayAckTracker
+{
+public:
+  void expect(uint32_t seq, bool expected_gpio, unsigned long now)
+  {
+    expect(seq, expected_gpio, now, now, false);
+  }
+
+  // tap_ms is when the card that led to this command was read. For a pulse
+  // the ack may come from the relock status (same seq, state 0, not
+  // pulsing), which still means the pulse ran.
+  void expect(uint32_t seq, bool expected_gpio, unsigned long now, unsigned long tap_ms, bool pulse)
+  {
+    if (pending_)
+    {
+      stats_.superseded++;
+    }
+    pending_ = true;
+    seq_ = seq;
+    expected_gpio_ = expected_gpio;
+    pulse_ = pulse;
+    sent_ms_ = now;
+    tap_ms_ = tap_ms;
+    stats_.sent++;
+  }
+
+  // Returns true if the status acknowledged the pending command
+  bool onStatus(const RelayStatus &status, unsigned long now)
+  {
+    if (!pending_ || !status.has_seq || relaySeqNewer(seq_, status.seq))
+    {
+      return false;
+    }
+    pending_ = false;
+    stats_.acked++;
+    stats_.last_ms = now - sent_ms_;
+    stats_.total_ms += stats_.last_ms;
+    if (stats_.last_ms > stats_.max_ms)
+    {
+      stats_.max_ms = stats_.last_ms;
+    }
+    stats_.tap_last_ms = now - tap_ms_;
+    stats_.tap_total_ms += stats_.tap_last_ms;
+    if (stats_.tap_last_ms > stats_.tap_max_ms)
+    {
+      stats_.tap_max_ms = stats_.tap_last_ms;
+    }
+    // A newer command may legitimately have changed the pin since
+    const bool relocked = pulse_ && !status.pulsing && !status.state && !status.gpio;
+    if (status.seq == seq_ && status.gpio != expected_gpio_ && !relocked)
+    {
+      stats_.mismatched++;
+    }
+    return true;
+  }
+
+  // Returns true when the pending command just missed its deadline
+  bool poll(unsigned long now, unsigned long timeout_ms)
+  {
+    if (!pending_ || now - sent_ms_ < timeout_ms)
+    {
+      return false;
+    }
+    pending_ = false;
+    stats_.timed_out++;
+    return true;
+  }
+
+  bool pending() const { return pending_; }
+  uint32_t pendingSeq() const { return seq_; }
+  const RelayAckStats &stats() const { return stats_; }
+
+private:
+  bool pending_ = false;
+  bool expected_gpio_ = false;
+  bool pulse_ = false;
+  uint32_t seq_ = 0;
+  unsigned long sent_ms_ = 0;
+  unsigned long tap_ms_ = 0;
+  RelayAckStats stats_ = {};
+};
+
+#if defined(ARDUINO_ARCH_ESP32)
+
+// Issues (boot epoch << 16 | counter); the epoch is bumped in NVS once per
+// boot and again whenever the counter runs out. Without NVS the first epoch
+// is random, and observe() moves it past whatever the relay reports as
+// applied, so commands stay newer than the relay's last seq either way.
+class RelaySequencer
+{
+public:
+  void begin()
+  {
+    Preferences prefs;
+    if (prefs.begin(RELAY_SEQ_NVS_NAMESPACE, false))
+    {
+      epoch_ = (prefs.getUInt("epoch", 0) + 1) & 0xFFFF;
+      prefs.putUInt("epoch", epoch_);
+      prefs.end();
+    }
+    else
+    {
+      Serial.println("Relay seq: NVS unavailable; epoch not persisted, resyncing from relay status");
+      epoch_ = started_ ? (epoch_ + 1) & 0xFFFF : (esp_random() & 0xFFFF);
+    }
+    started_ = true;
+    counter_ = 0;
+  }
+
+  uint32_t next()
+  {
+    if (counter_ == 0xFFFF)
+    {
+      begin();
+    }
+    return (epoch_ << 16) | ++counter_;
+  }
+
+  // Called with the seq from every relay status (retained ones arrive right
+  // after subscribing). A seq ahead of ours means the epoch went backwards.
+  void observe(uint32_t applied)
+  {
+    if (!relaySeqNewer(applied, (epoch_ << 16) | counter_))
+    {
+      return;
+    }
+    epoch_ = ((applied >> 16) + 1) & 0xFFFF;
+    counter_ = 0;
+    Preferences prefs;
+    if (prefs.begin(RELAY_SEQ_NVS_NAMESPACE, false))
+    {
+      prefs.putUInt("epoch", epoch_);
+      prefs.end();
+    }
+    Serial.print("Relay seq: relay is ahead; epoch moved to ");
+    Serial.println(epoch_);
+  }
+
+private:
+  uint32_t epoch_ = 0;
+  uint32_t counter_ = 0;
+  bool started_ = false;
+};
+
+#endif // ARDUINO_ARCH_ESP32
@@ -0,0 +1,253 @@
+/*
+ * Relay actuation scheduler: applies RelayCommands (relay_protocol.h) to the
+ * relay channels and relocks pulsed channels from a timer wheel.
+ *
+ * tick() is meant to run from a periodic esp_timer every RELAY_TICK_MS, so a
+ * pulse ends on time even while loop() is stuck in a WiFi or MQTT reconnect.
+ * Every channel has at most one pending relock, so the wheel slots hold
+ * intrusive lists of channel indices and arming or cancelling is O(1).
+ * Deadlines are kept in microseconds, and a relock is only fired once its
+ * deadline has passed, so a pulse is never cut short and ends less than one
+ * tick late.
+ *
+ * The class does no locking itself. The caller serialises submit(), tick()
+ * and the accessors (the relay firmware uses a portMUX critical section).
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "relay_protocol.h"
+
+constexpr size_t RELAY_MAX_CHANNELS = 4;
+constexpr uint32_t RELAY_TICK_MS = 5;
+constexpr size_t RELAY_WHEEL_SLOTS = 64; // 320 ms per revolution; longer pulses wait extra rounds
+
+enum class RelaySubmitResult
+{
+  Applied,
+  Unchanged, // state command matching the current state
+  Stale,     // sequence number not newer than the last applied one
+  InvalidChannel,
+};
+
+inline const char *relaySubmitResultName(RelaySubmitResult result)
+{
+  switch (result)
+  {
+  case RelaySubmitResult::Applied:
+    return "applied";
+  case RelaySubmitResult::Unchanged:
+    return "unchanged";
+  case RelaySubmitResult::Stale:
+    return "stale";
+  case RelaySubmitResult::InvalidChannel:
+    return "invalid channel";
+  }
+  return "unknown";
+}
+
+struct RelayChannelStats
+{
+  uint32_t applied;
+  uint32_t unchanged;
+  uint32_t stale;
+  uint32_t pulses;
+  uint32_t relocks;
+  uint32_t max_relock_late_us; // how far past its deadline a relock fired
+};
+
+class RelayScheduler
+{
+public:
+  using WriteFn = void (*)(uint8_t channel, bool on, void *ctx);
+
+  // Drives every channel off
+  void begin(uint8_t channel_count, WriteFn write, void *ctx)
+  {
+    count_ = channel_count < RELAY_MAX_CHANNELS ? channel_count : RELAY_MAX_CHANNELS;
+    write_ = write;
+    ctx_ = ctx;
+    cursor_ = 0;
+    changed_mask_ = 0;
+    for (int8_t &head : slots_)
+    {
+      head = -1;
+    }
+    for (uint8_t i = 0; i < count_; i++)
+    {
+      channels_[i] = Channel{};
+      write_(i, false, ctx_);
+    }
+  }
+
+  RelaySubmitResult submit(const RelayCommand &cmd, int64_t now_us)
+  {
+    if (cmd.channel >= count_)
+    {
+      return RelaySubmitResult::InvalidChannel;
+    }
+
+    Channel &channel = channels_[cmd.channel];
+    if (cmd.sequenced)
+    {
+      if (channel.has_seq && !relaySeqNewer(cmd.seq, channel.last_seq))
+      {
+        channel.stats.stale++;
+        return RelaySubmitResult::Stale;
+      }
+      channel.last_seq = cmd.seq;
+      channel.has_seq = true;
+    }
+
+    const bool was_pulsing = channel.armed;
+    disarm(cmd.channel);
+
+    if (cmd.type == RelayCommandType::Pulse)
+    {
+      drive(cmd.channel, true);
+      channel.relock_at_us = now_us + static_cast<int64_t>(cmd.pulse_ms) * 1000;
+      arm(cmd.channel, (cmd.pulse_ms + RELAY_TICK_MS - 1) / RELAY_TICK_MS);
+      channel.stats.pulses++;
+      channel.stats.applied++;
+      return RelaySubmitResult::Applied;
+    }
+
+    // A latch command also cancels a running pulse (set 1 keeps it on)
+    if (channel.state == cmd.state && !was_pulsing)
+    {
+      channel.stats.unchanged++;
+      return RelaySubmitResult::Unchanged;
+    }
+    drive(cmd.channel, cmd.state);
+    channel.stats.applied++;
+    return RelaySubmitResult::Applied;
+  }
+
+  void tick(int64_t now_us)
+  {
+    cursor_ = (cursor_ + 1) % RELAY_WHEEL_SLOTS;
+    int8_t index = slots_[cursor_];
+    while (index >= 0)
+    {
+      Channel &channel = channels_[index];
+      const int8_t next = channel.next;
+      if (channel.rounds > 0)
+      {
+        channel.rounds--;
+      }
+      else if (now_us < channel.relock_at_us)
+      {
+        // Armed mid-tick; the deadline falls inside the next tick
+        disarm(static_cast<uint8_t>(index));
+        arm(static_cast<uint8_t>(index), 1);
+      }
+      else
+      {
+        disarm(static_cast<uint8_t>(index));
+        drive(static_cast<uint8_t>(index), false);
+        channel.stats.relocks++;
+        const uint32_t late_us = static_cast<uint32_t>(now_us - channel.relock_at_us);
+        if (late_us > channel.stats.max_relock_late_us)
+        {
+          channel.stats.max_relock_late_us = late_us;
+        }
+      }
+      index = next;
+    }
+  }
+
+  // Channels whose output changed since the last call, one bit per channel
+  uint32_t takeChanged()
+  {
+    const uint32_t mask = changed_mask_;
+    changed_mask_ = 0;
+    return mask;
+  }
+
+  uint8_t channelCount() const { return count_; }
+  bool state(uint8_t channel) const { return channels_[channel].state; }
+  bool pulsing(uint8_t channel) const { return channels_[channel].armed; }
+  bool hasSeq(uint8_t channel) const { return channels_[channel].has_seq; }
+  uint32_t lastSeq(uint8_t channel) const { return channels_[channel].last_seq; }
+  const RelayChannelStats &stats(uint8_t channel) const { return channels_[channel].stats; }
+
+private:
+  struct Channel
+  {
+    bool state = false;
+    bool has_seq = false;
+    uint32_t last_seq = 0;
+    bool armed = false;
+    uint8_t slot = 0;
+    uint32_t rounds = 0;
+    int8_t prev = -1;
+    int8_t next = -1;
+    int64_t relock_at_us = 0;
+    RelayChannelStats stats = {};
+  };
+
+  void drive(uint8_t index, bool on)
+  {
+    if (channels_[index].state != on)
+    {
+      channels_[index].state = on;
+      write_(index, on, ctx_);
+      changed_mask_ |= 1u << index;
+    }
+  }
+
+  // ticks >= 1; the slot is visited for the first time after `ticks % SLOTS` ticks
+  void arm(uint8_t index, uint32_t ticks)
+  {
+    if (ticks == 0)
+    {
+      ticks = 1;
+    }
+    Channel &channel = channels_[index];
+    channel.slot = static_cast<uint8_t>((cursor_ + ticks) % RELAY_WHEEL_SLOTS);
+    channel.rounds = (ticks - 1) / RELAY_WHEEL_SLOTS;
+    channel.prev = -1;
+    channel.next = slots_[channel.slot];
+    if (channel.next >= 0)
+    {
+      channels_[channel.next].prev = static_cast<int8_t>(index);
+    }
+    slots_[channel.slot] = static_cast<int8_t>(index);
+    channel.armed = true;
+  }
+
+  void disarm(uint8_t index)
+  {
+    Channel &channel = channels_[index];
+    if (!channel.armed)
+    {
+      return;
+    }
+    if (channel.prev >= 0)
+    {
+      channels_[channel.prev].next = channel.next;
+    }
+    else
+    {
+      slots_[channel.slot] = channel.next;
+    }
+    if (channel.next >= 0)
+    {
+      channels_[channel.next].prev = channel.prev;
+    }
+    channel.prev = -1;
+    channel.next = -1;
+    channel.armed = false;
+  }
+
+  Channel channels_[RELAY_MAX_CHANNELS];
+  int8_t slots_[RELAY_WHEEL_SLOTS] = {};
+  uint8_t count_ = 0;
+  size_t cursor_ = 0;
+  uint32_t changed_mask_ = 0;
+  WriteFn write_ = nullptr;
+  void *ctx_ = nullptr;
+};
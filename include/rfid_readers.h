@@ -0,0 +1,302 @@
+/*
+ * Drives several MFRC522 readers from one ESP32, so an entry/exit pair or a
+ * turnstile bank can share a board. All readers sit on the shared SPI bus
+ * with their own chip-select pin.
+ *
+ * Two kinds of readers can be mixed:
+ *   - polled (irq_pin = -1): poll() sends REQA to one reader at a time in
+ *     round-robin order. The receive timeout is cut from the library's 25 ms
+ *     to RFID_PICC_TIMEOUT_US, so an empty lane holds the bus only that long
+ *   - IRQ-driven: REQA is started without waiting, and the reader's IRQ line
+ *     signals the answer. All IRQ readers listen at the same time and only
+ *     use the bus when a card is there. Unanswered requests are re-armed
+ *     every RFID_IRQ_REARM_MS
+ *
+ * poll() resumes after the reader that was served last and gives every
+ * reader at most one turn per call, so a busy lane cannot starve the others.
+ * Per-reader stats show the fairness (bus time, turns, longest gap between
+ * turns) and the detection latency. For IRQ readers the latency runs from the interrupt
+ * to the UID being read. For polled readers it runs from the previous empty
+ * turn, which makes it an upper bound.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <MFRC522.h>
+#include <esp_timer.h>
+
+constexpr size_t RFID_MAX_READERS = 4;
+constexpr uint32_t RFID_PICC_TIMEOUT_US = 5000; // ATQA/SAK arrive within ~100 us
+constexpr uint32_t RFID_TIMER_TICK_US = 25;     // TPrescaler 0xA9 set by PCD_Init()
+constexpr unsigned long RFID_IRQ_REARM_MS = 20;
+
+struct RfidReaderPins
+{
+  uint8_t cs_pin;
+  uint8_t rst_pin; // may be shared between readers
+  int8_t irq_pin;  // -1 = polled
+};
+
+struct RfidScan
+{
+  uint8_t reader;
+  MFRC522::Uid uid;
+  unsigned long tap_ms;
+};
+
+struct RfidReaderStats
+{
+  uint32_t turns;      // times the scheduler gave this reader the bus
+  uint32_t scans;      // UIDs read
+  uint32_t irq_wakeups;
+  uint32_t max_gap_us; // longest time between two turns (polled readers)
+  uint64_t busy_us;     // bus time of this reader's turns and card releases
+  uint64_t cooldown_us; // time parked after scans, when the reader asks for no turns
+  uint32_t detect_last_us;
+  uint32_t detect_max_us;
+  uint64_t detect_total_us;
+};
+
+class RfidReaderManager
+{
+public:
+  // Initialises every reader and returns how many answered on the bus
+  uint8_t begin(const RfidReaderPins *pins, uint8_t count)
+  {
+    count_ = count < RFID_MAX_READERS ? count : RFID_MAX_READERS;
+    cursor_ = 0;
+    started_us_ = esp_timer_get_time();
+    uint8_t present = 0;
+
+    // Deselect every reader before talking to the first one
+    for (uint8_t i = 0; i < count_; i++)
+    {
+      pinMode(pins[i].cs_pin, OUTPUT);
+      digitalWrite(pins[i].cs_pin, HIGH);
+    }
+
+    // Reset every reader before configuring any: boards often share one RST
+    // line, and a later PCD_Init would reset the readers already set up
+    for (uint8_t i = 0; i < count_; i++)
+    {
+      Reader &reader = readers_[i];
+      reader.pins = pins[i];
+      reader.pcd.PCD_Init(reader.pins.cs_pin, reader.pins.rst_pin);
+    }
+
+    for (uint8_t i = 0; i < count_; i++)
+    {
+      Reader &reader = readers_[i];
+      reader.version = reader.pcd.PCD_ReadRegister(MFRC522::VersionReg);
+      reader.present = reader.version != 0x00 && reader.version != 0xFF;
+      reader.stats = RfidReaderStats{};
+      reader.cooldown_until_ms = millis();
+      reader.last_turn_us = esp_timer_get_time();
+      if (!reader.present)
+      {
+        continue;
+      }
+      present++;
+
+      const uint16_t reload = RFID_PICC_TIMEOUT_US / RFID_TIMER_TICK_US;
+      reader.pcd.PCD_WriteRegister(MFRC522::TReloadRegH, static_cast<byte>(reload >> 8));
+      reader.pcd.PCD_WriteRegister(MFRC522::TReloadRegL, static_cast<byte>(reload & 0xFF));
+
+      if (reader.pins.irq_pin >= 0)
+      {
+        // IRQ pin active low, raised by a received frame (RxIEn)
+        pinMode(reader.pins.irq_pin, INPUT_PULLUP);
+        reader.pcd.PCD_WriteRegister(MFRC522::ComIEnReg, 0xA0);
+        attachInterruptArg(digitalPinToInterrupt(reader.pins.irq_pin), onIrq, &reader, FALLING);
+        arm(reader, millis());
+      }
+    }
+    return present;
+  }
+
+  // Gives each reader at most one turn, starting after the last one served,
+  // and stops at the first card found
+  bool poll(RfidScan &scan)
+  {
+    for (uint8_t step = 0; step < count_; step++)
+    {
+      const uint8_t index = cursor_;
+      cursor_ = static_cast<uint8_t>((cursor_ + 1) % count_);
+      Reader &reader = readers_[index];
+      const unsigned long now_ms = millis();
+      if (!reader.present || static_cast<long>(now_ms - reader.cooldown_until_ms) < 0)
+      {
+        continue;
+      }
+
+      const bool found = reader.pins.irq_pin >= 0 ? serviceIrq(reader, now_ms) : servicePolled(reader);
+      if (found)
+      {
+        scan.reader = index;
+        scan.uid = reader.pcd.uid;
+        scan.tap_ms = millis();
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Releases the card and keeps the reader idle until cooldown_until_ms
+  void finishScan(const RfidScan &scan, unsigned long cooldown_until_ms)
+  {
+    Reader &reader = readers_[scan.reader];
+    const int64_t start_us = esp_timer_get_time();
+    reader.pcd.PICC_HaltA();
+    reader.pcd.PCD_StopCrypto1();
+    const unsigned long now_ms = millis();
+    reader.cooldown_until_ms = cooldown_until_ms;
+    if (static_cast<long>(cooldown_until_ms - now_ms) > 0)
+    {
+      reader.stats.cooldown_us += static_cast<uint64_t>(cooldown_until_ms - now_ms) * 1000;
+    }
+    if (reader.pins.irq_pin >= 0)
+    {
+      arm(reader, now_ms);
+    }
+    reader.stats.busy_us += static_cast<uint64_t>(esp_timer_get_time() - start_us);
+  }
+
+  uint8_t count() const { return count_; }
+  bool present(uint8_t index) const { return readers_[index].present; }
+  uint8_t version(uint8_t index) const { return readers_[index].version; }
+  const RfidReaderPins &pins(uint8_t index) const { return readers_[index].pins; }
+  const RfidReaderStats &stats(uint8_t index) const { return readers_[index].stats; }
+
+  // Jain's index over the bus time of the polled readers, each divided by
+  // the time it was waiting for turns (cooldowns left out). Turns are not
+  // equal: an empty REQA waits out RFID_PICC_TIMEOUT_US, a card read takes
+  // several frames. 1.0 means every reader got the same share of the bus,
+  // 1/n that one reader got all of it. IRQ readers only take turns when a
+  // card is there, so they are left out.
+  float fairness() const
+  {
+    const int64_t elapsed_us = esp_timer_get_time() - started_us_;
+    float sum = 0.0f;
+    float sum_sq = 0.0f;
+    uint8_t n = 0;
+    for (uint8_t i = 0; i < count_; i++)
+    {
+      const RfidReaderStats &stats = readers_[i].stats;
+      const int64_t waiting_us = elapsed_us - static_cast<int64_t>(stats.cooldown_us);
+      if (readers_[i].present && readers_[i].pins.irq_pin < 0 && waiting_us > 0)
+      {
+        const float share = static_cast<float>(stats.busy_us) / static_cast<float>(waiting_us);
+        sum += share;
+        sum_sq += share * share;
+        n++;
+      }
+    }
+    return sum_sq == 0.0f ? 1.0f : sum * sum / (n * sum_sq);
+  }
+
+private:
+  struct Reader
+  {
+    MFRC522 pcd;
+    RfidReaderPins pins = {};
+    bool present = false;
+    uint8_t version = 0;
+    unsigned long cooldown_until_ms = 0;
+    unsigned long armed_ms = 0;
+    int64_t last_turn_us = 0;
+    volatile bool irq_pending = false;
+    volatile int64_t irq_us = 0;
+    RfidReaderStats stats = {};
+  };
+
+  static void IRAM_ATTR onIrq(void *arg)
+  {
+    Reader *reader = static_cast<Reader *>(arg);
+    if (!reader->irq_pending)
+    {
+      reader->irq_us = esp_timer_get_time();
+      reader->irq_pending = true;
+    }
+  }
+
+  // Starts a REQA without waiting for the answer; the IRQ line reports it
+  void arm(Reader &reader, unsigned long now_ms)
+  {
+    reader.pcd.PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_Idle);
+    reader.pcd.PCD_WriteRegister(MFRC522::ComIrqReg, 0x7F);
+    reader.pcd.PCD_WriteRegister(MFRC522::FIFOLevelReg, 0x80); // flush FIFO
+    reader.irq_pending = false;
+    reader.pcd.PCD_WriteRegister(MFRC522::FIFODataReg, MFRC522::PICC_CMD_REQA);
+    reader.pcd.PCD_WriteRegister(MFRC522::CommandReg, MFRC522::PCD_Transceive);
+    reader.pcd.PCD_WriteRegister(MFRC522::BitFramingReg, 0x87); // StartSend, 7-bit short frame
+    reader.armed_ms = now_ms;
+  }
+
+  void recordScan(Reader &reader, int64_t since_us)
+  {
+    RfidReaderStats &stats = reader.stats;
+    stats.scans++;
+    stats.detect_last_us = static_cast<uint32_t>(esp_timer_get_time() - since_us);
+    stats.detect_total_us += stats.detect_last_us;
+    if (stats.detect_last_us > stats.detect_max_us)
+    {
+      stats.detect_max_us = stats.detect_last_us;
+    }
+  }
+
+  bool servicePolled(Reader &reader)
+  {
+    const int64_t previous_turn_us = reader.last_turn_us;
+    const int64_t start_us = esp_timer_get_time();
+    const uint32_t gap = static_cast<uint32_t>(start_us - previous_turn_us);
+    if (gap > reader.stats.max_gap_us)
+    {
+      reader.stats.max_gap_us = gap;
+    }
+    reader.stats.turns++;
+
+    const bool found = reader.pcd.PICC_IsNewCardPresent() && reader.pcd.PICC_ReadCardSerial();
+    reader.last_turn_us = esp_timer_get_time();
+    reader.stats.busy_us += static_cast<uint64_t>(reader.last_turn_us - start_us);
+    if (found)
+    {
+      recordScan(reader, previous_turn_us);
+    }
+    return found;
+  }
+
+  bool serviceIrq(Reader &reader, unsigned long now_ms)
+  {
+    if (!reader.irq_pending)
+    {
+      if (now_ms - reader.armed_ms >= RFID_IRQ_REARM_MS)
+      {
+        arm(reader, now_ms);
+      }
+      return false;
+    }
+
+    reader.stats.turns++;
+    reader.stats.irq_wakeups++;
+    const int64_t start_us = esp_timer_get_time();
+    // The card already answered the REQA and waits in READY for anticollision
+    const bool found = reader.pcd.PICC_ReadCardSerial();
+    reader.last_turn_us = esp_timer_get_time();
+    reader.stats.busy_us += static_cast<uint64_t>(reader.last_turn_us - start_us);
+    if (found)
+    {
+      recordScan(reader, reader.irq_us);
+    }
+    else
+    {
+      arm(reader, now_ms);
+    }
+    return found;
+  }
+
+  Reader readers_[RFID_MAX_READERS];
+  uint8_t count_ = 0;
+  uint8_t cursor_ = 0;
+  int64_t started_us_ = 0;
+};
@@ -0,0 +1,605 @@
+/*
+ * Runtime configuration shared by the scanner and relay firmwares.
+ *
+ * Values start from the compile-time defaults in each firmware, are
+ * overridden by whatever is stored in NVS, and can be changed live through
+ * retained JSON messages, e.g.
+ *
+ *   RFID_CONFIG/<role>          {"rev": 7, "scan_cooldown": 1200}
+ *   RFID_CONFIG/<role>/secrets  {"rev": 3, "wifi0_pass": "..."}
+ *
+ * Each firmware has its own schema (CONFIG_SCANNER_SCHEMA and
+ * CONFIG_RELAY_SCHEMA) describing its fields once: key, type, range and what
+ * has to be re-applied when it changes. Secret fields (passwords, tokens)
+ * are only accepted on the secrets topic and everything else only on the
+ * settings topic, so tuning pushes never carry credentials. Each topic has
+ * its own revision; "rev" must be higher than the one stored for that
+ * topic, so a retained message is not re-applied on every reconnect.
+ *
+ * An update may set any subset of its topic's keys; the rest keep their
+ * stored values. It is validated in full and merged all-or-nothing. Only the
+ * newest retained message reaches a device that was offline across several
+ * revisions, so the publisher keeps every key it has changed in the file it
+ * republishes.
+ *
+ * Escape paths for a push that strands the device:
+ *   - an update that changes WiFi or the broker is on trial until the broker
+ *     is reached again. After CONFIG_TRIAL_MAX_FAILURES failed WiFi or MQTT
+ *     connects the previous settings are restored (they are kept in NVS, so
+ *     this survives a restart). The bad revision is kept, so the retained
+ *     message is not applied again
+ *   - holding BOOT (GPIO 0) for CONFIG_RESET_HOLD_MS while powering up clears
+ *     NVS and restarts on the compile-time defaults
+ *
+ * Ports depend on the transport: a build with ENABLE_TLS=1 stores them under
+ * separate NVS keys, so it never picks up the plain build's 1883/81.
+ *
+ * The parsed values live in a plain RuntimeConfig struct, so hot paths read
+ * fields directly without any lookup.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <Preferences.h>
+#include <cstddef>
+#include <cstring>
+
+#ifndef ENABLE_TLS
+#define ENABLE_TLS 0
+#endif
+
+constexpr uint32_t CONFIG_SCHEMA_VERSION = 6;
+constexpr size_t CONFIG_MAX_WIFI_NETWORKS = 4;
+constexpr size_t CONFIG_SSID_LEN = 33;     // 32 chars + NUL
+constexpr size_t CONFIG_PASSWORD_LEN = 65; // 64 chars + NUL
+constexpr size_t CONFIG_IP_LEN = 16;       // "255.255.255.255"
+constexpr size_t CONFIG_TOKEN_LEN = 33;    // 32 chars + NUL
+constexpr size_t CONFIG_JSON_CAPACITY = 1536;
+constexpr size_t CONFIG_MAX_FIELDS = 32;
+constexpr size_t CONFIG_NVS_KEY_LEN = 16;  // 15 chars + NUL
+constexpr const char *CONFIG_NVS_NAMESPACE = "rfid_cfg";
+constexpr const char *CONFIG_NVS_GOOD_KEY = "good"; // last config that reached the broker, during a trial
+constexpr uint8_t CONFIG_TRIAL_MAX_FAILURES = 5;
+constexpr uint8_t CONFIG_RESET_PIN = 0; // BOOT button on ESP32 dev boards
+constexpr unsigned long CONFIG_RESET_HOLD_MS = 3000;
+
+struct WifiCredentials
+{
+  char ssid[CONFIG_SSID_LEN];
+  char password[CONFIG_PASSWORD_LEN];
+};
+
+struct RuntimeConfig
+{
+  uint32_t revision;         // last update applied from the settings topic
+  uint32_t secrets_revision; // last update applied from the secrets topic
+  WifiCredentials wifi[CONFIG_MAX_WIFI_NETWORKS];
+  char mqtt_broker_ip[CONFIG_IP_LEN];
+  uint16_t mqtt_port;
+  char api_server_ip[CONFIG_IP_LEN];
+  uint16_t api_port;
+  uint32_t scan_cooldown_ms;
+  uint32_t loop_idle_delay_ms;
+  uint32_t telemetry_interval_ms;
+  uint32_t mqtt_backoff_min_ms;
+  uint32_t mqtt_backoff_max_ms;
+  uint32_t http_timeout_ms;
+  uint32_t unlock_pulse_ms; // 0 = latch the relay until the next scan
+  char edge_host[CONFIG_IP_LEN]; // scanner: relay's edge broker, empty = off
+  uint16_t edge_port;            // relay: listen port, 0 = off; scanner: port to connect to
+  char edge_token[CONFIG_TOKEN_LEN]; // shared secret for the edge broker, empty = edge path off
+};
+
+enum class ConfigType : uint8_t
+{
+  U16,
+  U32,
+  Text,
+  Secret, // Text that is never echoed to the serial log
+};
+
+// What the firmware has to redo after a field changes
+enum ConfigApply : uint8_t
+{
+  CONFIG_APPLY_LIVE = 0x00, // read on every use
+  CONFIG_APPLY_WIFI = 0x01, // reconnect WiFi
+  CONFIG_APPLY_MQTT = 0x02, // re-resolve broker and reconnect MQTT
+  CONFIG_APPLY_API = 0x04,  // re-resolve backend, drop kept-alive socket
+  CONFIG_APPLY_EDGE = 0x08, // restart the edge broker / reconnect to it
+  CONFIG_APPLY_TRIAL = CONFIG_APPLY_WIFI | CONFIG_APPLY_MQTT, // rolled back if the broker is lost
+};
+
+enum ConfigFieldFlags : uint8_t
+{
+  CONFIG_FIELD_PER_TRANSPORT = 0x01, // stored under "<key>_tls" in TLS builds
+};
+
+struct ConfigField
+{
+  const char *key; // JSON and NVS key (NVS keys are limited to 15 chars, 11 for per-transport fields)
+  ConfigType type;
+  size_t offset;
+  size_t size;
+  uint32_t min;
+  uint32_t max;
+  uint8_t apply;
+  uint8_t flags = 0;
+};
+
+struct ConfigSchema
+{
+  const char *role;
+  const ConfigField *fields;
+  size_t count;
+
+  const ConfigField *begin() const { return fields; }
+  const ConfigField *end() const { return fields + count; }
+};
+
+#define CONFIG_WIFI_FIELDS(i)                                                                                    \
+  {"wifi" #i "_ssid", ConfigType::Text, offsetof(RuntimeConfig, wifi[i].ssid), CONFIG_SSID_LEN, 0, 0,            \
+   CONFIG_APPLY_WIFI},                                                                                           \
+  {"wifi" #i "_pass", ConfigType::Secret, offsetof(RuntimeConfig, wifi[i].password), CONFIG_PASSWORD_LEN, 0, 0, \
+   CONFIG_APPLY_WIFI}
+
+#define CONFIG_COMMON_FIELDS                                                                                    \
+  CONFIG_WIFI_FIELDS(0), CONFIG_WIFI_FIELDS(1), CONFIG_WIFI_FIELDS(2), CONFIG_WIFI_FIELDS(3),                  \
+  {"mqtt_host", ConfigType::Text, offsetof(RuntimeConfig, mqtt_broker_ip), CONFIG_IP_LEN, 0, 0, CONFIG_APPLY_MQTT}, \
+  {"mqtt_port", ConfigType::U16, offsetof(RuntimeConfig, mqtt_port), sizeof(uint16_t), 1, 65535, CONFIG_APPLY_MQTT, \
+   CONFIG_FIELD_PER_TRANSPORT},                                                                                  \
+  {"loop_idle_ms", ConfigType::U32, offsetof(RuntimeConfig, loop_idle_delay_ms), sizeof(uint32_t), 0, 100, CONFIG_APPLY_LIVE}, \
+  {"telemetry_ms", ConfigType::U32, offsetof(RuntimeConfig, telemetry_interval_ms), sizeof(uint32_t), 1000, 3600000, CONFIG_APPLY_LIVE}, \
+  {"backoff_min", ConfigType::U32, offsetof(RuntimeConfig, mqtt_backoff_min_ms), sizeof(uint32_t), 100, 60000, CONFIG_APPLY_LIVE}, \
+  {"backoff_max", ConfigType::U32, offsetof(RuntimeConfig, mqtt_backoff_max_ms), sizeof(uint32_t), 100, 600000, CONFIG_APPLY_LIVE}
+
+static const ConfigField CONFIG_SCANNER_FIELDS[] = {
+  CONFIG_COMMON_FIELDS,
+  {"api_host", ConfigType::Text, offsetof(RuntimeConfig, api_server_ip), CONFIG_IP_LEN, 0, 0, CONFIG_APPLY_API},
+  {"api_port", ConfigType::U16, offsetof(RuntimeConfig, api_port), sizeof(uint16_t), 1, 65535, CONFIG_APPLY_API,
+   CONFIG_FIELD_PER_TRANSPORT},
+  {"scan_cooldown", ConfigType::U32, offsetof(RuntimeConfig, scan_cooldown_ms), sizeof(uint32_t), 0, 60000, CONFIG_APPLY_LIVE},
+  {"http_timeout", ConfigType::U32, offsetof(RuntimeConfig, http_timeout_ms), sizeof(uint32_t), 100, 30000, CONFIG_APPLY_LIVE},
+  {"unlock_pulse", ConfigType::U32, offsetof(RuntimeConfig, unlock_pulse_ms), sizeof(uint32_t), 0, 60000, CONFIG_APPLY_LIVE},
+  {"edge_host", ConfigType::Text, offsetof(RuntimeConfig, edge_host), CONFIG_IP_LEN, 0, 0, CONFIG_APPLY_EDGE},
+  {"edge_port", ConfigType::U16, offsetof(RuntimeConfig, edge_port), sizeof(uint16_t), 0, 65535, CONFIG_APPLY_EDGE},
+  {"edge_token", ConfigType::Secret, offsetof(RuntimeConfig, edge_token), CONFIG_TOKEN_LEN, 0, 0, CONFIG_APPLY_EDGE},
+};
+
+static const ConfigField CONFIG_RELAY_FIELDS[] = {
+  CONFIG_COMMON_FIELDS,
+  {"edge_port", ConfigType::U16, offsetof(RuntimeConfig, edge_port), sizeof(uint16_t), 0, 65535, CONFIG_APPLY_EDGE},
+  {"edge_token", ConfigType::Secret, offsetof(RuntimeConfig, edge_token), CONFIG_TOKEN_LEN, 0, 0, CONFIG_APPLY_EDGE},
+};
+
+#undef CONFIG_COMMON_FIELDS
+#undef CONFIG_WIFI_FIELDS
+
+static const ConfigSchema CONFIG_SCANNER_SCHEMA = {
+  "scanner", CONFIG_SCANNER_FIELDS, sizeof(CONFIG_SCANNER_FIELDS) / sizeof(CONFIG_SCANNER_FIELDS[0])};
+static const ConfigSchema CONFIG_RELAY_SCHEMA = {
+  "relay", CONFIG_RELAY_FIELDS, sizeof(CONFIG_RELAY_FIELDS) / sizeof(CONFIG_RELAY_FIELDS[0])};
+
+static_assert(sizeof(CONFIG_SCANNER_FIELDS) / sizeof(ConfigField) <= CONFIG_MAX_FIELDS, "scanner schema too large");
+static_assert(sizeof(CONFIG_RELAY_FIELDS) / sizeof(ConfigField) <= CONFIG_MAX_FIELDS, "relay schema too large");
+
+enum class ConfigTopic : uint8_t
+{
+  Settings, // RFID_CONFIG/<role>: every field except secrets
+  Secrets,  // RFID_CONFIG/<role>/secrets: ConfigType::Secret fields only
+};
+
+enum class ConfigUpdateResult
+{
+  Applied,
+  Stale,         // rev not newer than the stored revision of its topic
+  Invalid,       // bad JSON, unknown key, key of the other topic, wrong type or out of range
+  NotPersisted,  // applied in RAM but the NVS write failed
+};
+
+inline const ConfigField *findConfigField(const ConfigSchema &schema, const char *key)
+{
+  for (const ConfigField &field : schema)
+  {
+    if (strcmp(field.key, key) == 0)
+    {
+      return &field;
+    }
+  }
+  return nullptr;
+}
+
+inline uint8_t *configFieldPtr(RuntimeConfig &config, const ConfigField &field)
+{
+  return reinterpret_cast<uint8_t *>(&config) + field.offset;
+}
+
+inline bool isTextField(const ConfigField &field)
+{
+  return field.type == ConfigType::Text || field.type == ConfigType::Secret;
+}
+
+inline const char *configNvsKey(const ConfigField &field, char *buffer, size_t length)
+{
+  if (!ENABLE_TLS || !(field.flags & CONFIG_FIELD_PER_TRANSPORT))
+  {
+    return field.key;
+  }
+  snprintf(buffer, length, "%s_tls", field.key);
+  return buffer;
+}
+
+// Overrides the defaults already in config with the values stored in NVS
+inline void loadRuntimeConfig(RuntimeConfig &config, const ConfigSchema &schema)
+{
+  Preferences prefs;
+  if (!prefs.begin(CONFIG_NVS_NAMESPACE, true))
+  {
+    Serial.println("Config: no stored configuration, using defaults");
+    return;
+  }
+
+  const uint32_t stored_schema = prefs.getUInt("schema", 0);
+  if (stored_schema > CONFIG_SCHEMA_VERSION)
+  {
+    Serial.println("Config: stored schema is newer than firmware; loading known keys only");
+  }
+
+  config.revision = prefs.getUInt("rev", config.revision);
+  config.secrets_revision = prefs.getUInt("srev", config.secrets_revision);
+  for (const ConfigField &field : schema)
+  {
+    char key_buffer[CONFIG_NVS_KEY_LEN];
+    const char *key = configNvsKey(field, key_buffer, sizeof(key_buffer));
+    if (!prefs.isKey(key))
+    {
+      continue;
+    }
+
+    uint8_t *ptr = configFieldPtr(config, field);
+    switch (field.type)
+    {
+    case ConfigType::U16:
+      *reinterpret_cast<uint16_t *>(ptr) = prefs.getUShort(key, *reinterpret_cast<uint16_t *>(ptr));
+      break;
+    case ConfigType::U32:
+      *reinterpret_cast<uint32_t *>(ptr) = prefs.getUInt(key, *reinterpret_cast<uint32_t *>(ptr));
+      break;
+    case ConfigType::Text:
+    case ConfigType::Secret:
+      prefs.getString(key, reinterpret_cast<char *>(ptr), field.size);
+      break;
+    }
+  }
+
+  prefs.end();
+}
+
+inline bool saveRuntimeConfig(const RuntimeConfig &config, const ConfigSchema &schema)
+{
+  Preferences prefs;
+  if (!prefs.begin(CONFIG_NVS_NAMESPACE, false))
+  {
+    return false;
+  }
+
+  bool ok = prefs.putUInt("schema", CONFIG_SCHEMA_VERSION) > 0;
+  ok = prefs.putUInt("rev", config.revision) > 0 && ok;
+  ok = prefs.putUInt("srev", config.secrets_revision) > 0 && ok;
+  for (const ConfigField &field : schema)
+  {
+    char key_buffer[CONFIG_NVS_KEY_LEN];
+    const char *key = configNvsKey(field, key_buffer, sizeof(key_buffer));
+    const uint8_t *ptr = reinterpret_cast<const uint8_t *>(&config) + field.offset;
+    switch (field.type)
+    {
+    case ConfigType::U16:
+      ok = prefs.putUShort(key, *reinterpret_cast<const uint16_t *>(ptr)) > 0 && ok;
+      break;
+    case ConfigType::U32:
+      ok = prefs.putUInt(key, *reinterpret_cast<const uint32_t *>(ptr)) > 0 && ok;
+      break;
+    case ConfigType::Text:
+    case ConfigType::Secret:
+      // putString() reports 0 bytes for an empty value, which is still a success
+      prefs.putString(key, reinterpret_cast<const char *>(ptr));
+      break;
+    }
+  }
+
+  prefs.end();
+  return ok;
+}
+
+// Last configuration that reached the broker, kept while network changes
+// are on trial. A trial that is already running keeps the older copy.
+inline void startConfigTrial(const RuntimeConfig &good)
+{
+  Preferences prefs;
+  if (!prefs.begin(CONFIG_NVS_NAMESPACE, false))
+  {
+    return;
+  }
+  if (!prefs.isKey(CONFIG_NVS_GOOD_KEY))
+  {
+    prefs.putBytes(CONFIG_NVS_GOOD_KEY, &good, sizeof(good));
+  }
+  prefs.end();
+}
+
+inline bool configTrialPending()
+{
+  Preferences prefs;
+  if (!prefs.begin(CONFIG_NVS_NAMESPACE, true))
+  {
+    return false;
+  }
+  const bool pending = prefs.isKey(CONFIG_NVS_GOOD_KEY);
+  prefs.end();
+  return pending;
+}
+
+inline void endConfigTrial()
+{
+  Preferences prefs;
+  if (prefs.begin(CONFIG_NVS_NAMESPACE, false))
+  {
+    prefs.remove(CONFIG_NVS_GOOD_KEY);
+    prefs.end();
+  }
+}
+
+// Restores the configuration saved by startConfigTrial(). The revisions stay,
+// so the retained update that failed is not applied again.
+inline bool rollbackRuntimeConfig(RuntimeConfig &config, const ConfigSchema &schema)
+{
+  RuntimeConfig good;
+  Preferences prefs;
+  if (!prefs.begin(CONFIG_NVS_NAMESPACE, false))
+  {
+    return false;
+  }
+  const bool found = prefs.getBytesLength(CONFIG_NVS_GOOD_KEY) == sizeof(good) &&
+                     prefs.getBytes(CONFIG_NVS_GOOD_KEY, &good, sizeof(good)) == sizeof(good);
+  prefs.remove(CONFIG_NVS_GOOD_KEY);
+  prefs.end();
+  if (!found)
+  {
+    return false;
+  }
+
+  good.revision = config.revision;
+  good.secrets_revision = config.secrets_revision;
+  config = good;
+  saveRuntimeConfig(config, schema);
+  return true;
+}
+
+// Counts failed connects while network changes are on trial
+class ConfigTrial
+{
+public:
+  void begin() { active_ = configTrialPending(); failures_ = 0; }
+  void start() { active_ = true; failures_ = 0; }
+  bool active() const { return active_; }
+
+  // Reaching the broker proves the new settings; returns true if one was on trial
+  bool confirm()
+  {
+    if (!active_)
+    {
+      return false;
+    }
+    endConfigTrial();
+    active_ = false;
+    return true;
+  }
+
+  // Returns true when the limit was hit and the previous settings are back
+  bool fail(RuntimeConfig &config, const ConfigSchema &schema)
+  {
+    if (!active_ || ++failures_ < CONFIG_TRIAL_MAX_FAILURES)
+    {
+      return false;
+    }
+    active_ = false;
+    return rollbackRuntimeConfig(config, schema);
+  }
+
+private:
+  bool active_ = false;
+  uint8_t failures_ = 0;
+};
+
+// True if the (active low) button is held for hold_ms right after power-up
+inline bool configResetRequested(uint8_t pin, unsigned long hold_ms)
+{
+  pinMode(pin, INPUT_PULLUP);
+  const unsigned long start = millis();
+  while (digitalRead(pin) == LOW)
+  {
+    if (millis() - start >= hold_ms)
+    {
+      return true;
+    }
+    delay(10);
+  }
+  return false;
+}
+
+inline bool clearRuntimeConfig()
+{
+  Preferences prefs;
+  if (!prefs.begin(CONFIG_NVS_NAMESPACE, false))
+  {
+    return false;
+  }
+  const bool ok = prefs.clear();
+  prefs.end();
+  return ok;
+}
+
+// Validates a JSON update from one config topic against the schema and
+// merges it into config all-or-nothing; keys it does not set are kept.
+// apply_flags receives the ConfigApply bits of every field that changed.
+// Changes to WiFi or the broker start a trial (see ConfigTrial).
+inline ConfigUpdateResult applyConfigUpdate(RuntimeConfig &config, const ConfigSchema &schema, ConfigTopic topic,
+                                            const uint8_t *payload, size_t length, uint8_t &apply_flags)
+{
+  apply_flags = 0;
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+  StaticJsonDocument<CONFIG_JSON_CAPACITY> doc;
+#pragma GCC diagnostic pop
+  DeserializationError error = deserializeJson(doc, reinterpret_cast<const char *>(payload), length);
+  if (error)
+  {
+    Serial.print("Config: JSON parse error: ");
+    Serial.println(error.c_str());
+    return ConfigUpdateResult::Invalid;
+  }
+
+  JsonObjectConst update = doc.as<JsonObjectConst>();
+  if (update.isNull() || !update["rev"].is<uint32_t>())
+  {
+    Serial.println("Config: update must be an object with a numeric \"rev\"");
+    return ConfigUpdateResult::Invalid;
+  }
+
+  const bool secrets = topic == ConfigTopic::Secrets;
+  const uint32_t revision = update["rev"].as<uint32_t>();
+  if (revision <= (secrets ? config.secrets_revision : config.revision))
+  {
+    return ConfigUpdateResult::Stale;
+  }
+
+  if (update["schema"].is<uint32_t>() && update["schema"].as<uint32_t>() > CONFIG_SCHEMA_VERSION)
+  {
+    Serial.println("Config: update targets a newer schema; rejected");
+    return ConfigUpdateResult::Invalid;
+  }
+
+  RuntimeConfig candidate = config;
+  for (JsonPairConst item : update)
+  {
+    const char *key = item.key().c_str();
+    if (strcmp(key, "rev") == 0 || strcmp(key, "schema") == 0)
+    {
+      continue;
+    }
+
+    const ConfigField *field = findConfigField(schema, key);
+    if (!field)
+    {
+      Serial.print("Config: unknown key for the ");
+      Serial.print(schema.role);
+      Serial.print(": ");
+      Serial.println(key);
+      return ConfigUpdateResult::Invalid;
+    }
+    if ((field->type == ConfigType::Secret) != secrets)
+    {
+      Serial.print("Config: ");
+      Serial.print(key);
+      Serial.println(secrets ? " is not a secret; set it on the settings topic"
+                             : " is a secret; set it on the secrets topic");
+      return ConfigUpdateResult::Invalid;
+    }
+
+    uint8_t *ptr = configFieldPtr(candidate, *field);
+    JsonVariantConst value = item.value();
+
+    if (isTextField(*field))
+    {
+      const char *text = value.as<const char *>();
+      if (!value.is<const char *>() || strlen(text) >= field->size)
+      {
+        Serial.print("Config: invalid text for ");
+        Serial.println(key);
+        return ConfigUpdateResult::Invalid;
+      }
+      strncpy(reinterpret_cast<char *>(ptr), text, field->size);
+      continue;
+    }
+
+    if (!value.is<uint32_t>() || value.as<uint32_t>() < field->min || value.as<uint32_t>() > field->max)
+    {
+      Serial.print("Config: value out of range for ");
+      Serial.println(key);
+      return ConfigUpdateResult::Invalid;
+    }
+    if (field->type == ConfigType::U16)
+    {
+      *reinterpret_cast<uint16_t *>(ptr) = static_cast<uint16_t>(value.as<uint32_t>());
+    }
+    else
+    {
+      *reinterpret_cast<uint32_t *>(ptr) = value.as<uint32_t>();
+    }
+  }
+
+  if (candidate.mqtt_backoff_min_ms > candidate.mqtt_backoff_max_ms)
+  {
+    Serial.println("Config: backoff_min must not exceed backoff_max");
+    return ConfigUpdateResult::Invalid;
+  }
+
+  for (const ConfigField &field : schema)
+  {
+    const uint8_t *before = reinterpret_cast<const uint8_t *>(&config) + field.offset;
+    const uint8_t *after = reinterpret_cast<const uint8_t *>(&candidate) + field.offset;
+    if (memcmp(before, after, field.size) != 0)
+    {
+      apply_flags |= field.apply;
+    }
+  }
+
+  if (apply_flags & CONFIG_APPLY_TRIAL)
+  {
+    startConfigTrial(config);
+  }
+  (secrets ? candidate.secrets_revision : candidate.revision) = revision;
+  config = candidate;
+  return saveRuntimeConfig(config, schema) ? ConfigUpdateResult::Applied : ConfigUpdateResult::NotPersisted;
+}
+
+inline void printRuntimeConfig(const RuntimeConfig &config, const ConfigSchema &schema)
+{
+  Serial.print("Config rev ");
+  Serial.print(config.revision);
+  Serial.print(", secrets rev ");
+  Serial.print(config.secrets_revision);
+  Serial.print(" (schema ");
+  Serial.print(CONFIG_SCHEMA_VERSION);
+  Serial.println("):");
+
+  for (const ConfigField &field : schema)
+  {
+    const uint8_t *ptr = reinterpret_cast<const uint8_t *>(&config) + field.offset;
+    if (isTextField(field) && reinterpret_cast<const char *>(ptr)[0] == '\0')
+    {
+      continue;
+    }
+
+    Serial.print("  ");
+    Serial.print(field.key);
+    Serial.print(" = ");
+    switch (field.type)
+    {
+    case ConfigType::U16:
+      Serial.println(*reinterpret_cast<const uint16_t *>(ptr));
+      break;
+    case ConfigType::U32:
+      Serial.println(*reinterpret_cast<const uint32_t *>(ptr));
+      break;
+    case ConfigType::Text:
+      Serial.println(reinterpret_cast<const char *>(ptr));
+      break;
+    case ConfigType::Secret:
+      Serial.println("********");
+      break;
+    }
+  }
+}
@@ -0,0 +1,190 @@
+/*
+ * Per-scan decision logic of the scanner firmware, kept free of hardware and
+ * network calls so it also builds on the host (tools/replay_trace.cpp):
+ *
+ *   UID bytes -> "63:70:DA:39" -> URL-encoded check request
+ *   registry cache lookup -> local decision, published before the backend answers
+ *   backend JSON response -> status -> relay commands for the lane
+ *
+ * The firmware does the I/O around these steps (SPI, HTTP, MQTT).
+ */
+
+#pragma once
+
+#include <ArduinoJson.h>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "relay_protocol.h"
+
+constexpr size_t CHECK_RESPONSE_JSON_CAPACITY = 256;
+constexpr size_t CHECK_MESSAGE_LEN = 48;
+
+// Formats a UID as colon-separated hex, the key used by rfid_reg
+inline bool formatUid(const uint8_t *uid, uint8_t size, char *buffer, size_t bufferLen)
+{
+  if (bufferLen == 0)
+  {
+    return false;
+  }
+
+  size_t offset = 0;
+
+  for (uint8_t i = 0; i < size; i++)
+  {
+    if (i > 0)
+    {
+      if (offset + 1 >= bufferLen)
+      {
+        buffer[offset] = '\0';
+        return false;
+      }
+      buffer[offset++] = ':';
+    }
+
+    if (offset + 2 >= bufferLen)
+    {
+      buffer[offset] = '\0';
+      return false;
+    }
+
+    snprintf(&buffer[offset], bufferLen - offset, "%02X", uid[i]);
+    offset += 2;
+  }
+
+  buffer[offset] = '\0';
+  return true;
+}
+
+inline bool urlEncode(const char *input, char *output, size_t outputLen)
+{
+  if (!input || !output || outputLen == 0)
+  {
+    return false;
+  }
+
+  const char *hex = "0123456789ABCDEF";
+  size_t outIndex = 0;
+
+  for (size_t i = 0; input[i] != '\0'; i++)
+  {
+    const char c = input[i];
+    const bool is_unreserved =
+      (c >= 'A' && c <= 'Z') ||
+      (c >= 'a' && c <= 'z') ||
+      (c >= '0' && c <= '9') ||
+      c == '-' || c == '_' || c == '.' || c == '~';
+
+    if (is_unreserved)
+    {
+      if (outIndex + 1 >= outputLen)
+      {
+        return false;
+      }
+      output[outIndex++] = c;
+    }
+    else
+    {
+      if (outIndex + 3 >= outputLen)
+      {
+        return false;
+      }
+      uint8_t byteVal = static_cast<uint8_t>(c);
+      output[outIndex++] = '%';
+      output[outIndex++] = hex[(byteVal >> 4) & 0x0F];
+      output[outIndex++] = hex[byteVal & 0x0F];
+    }
+  }
+
+  if (outIndex >= outputLen)
+  {
+    return false;
+  }
+
+  output[outIndex] = '\0';
+  return true;
+}
+
+// Reply of php-backend/api/check_rfid.php
+struct CheckResponse
+{
+  int status; // 1 = grant, 0 = deny
+  bool found;
+  char message[CHECK_MESSAGE_LEN];
+};
+
+// Returns false (and sets error, if given) when the body is not valid JSON
+inline bool parseCheckResponse(const char *body, size_t length, CheckResponse &response, const char **error = nullptr)
+{
+  response = CheckResponse{};
+
+  // StaticJsonDocument is deprecated in ArduinoJson v7, but JsonDocument is
+  // not a template in v7.4.2, so the warning is suppressed
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wdeprecated-declarations"
+  StaticJsonDocument<CHECK_RESPONSE_JSON_CAPACITY> doc;
+#pragma GCC diagnostic pop
+  const DeserializationError result = deserializeJson(doc, body, length);
+  if (result)
+  {
+    if (error)
+    {
+      *error = result.c_str();
+    }
+    return false;
+  }
+
+  response.status = doc["status"] | 0;
+  response.found = doc["found"] | false;
+  strncpy(response.message, doc["message"] | "", sizeof(response.message) - 1);
+  return true;
+}
+
+// Decision taken from the registry cache before the backend answers.
+// check_rfid.php toggles a registered card on every tap, so the cached
+// status (from before this tap) is flipped, and unknown cards are denied.
+// Returns -1 while the cache is catching up, so only the backend decides.
+inline int localDecision(bool cache_current, bool cached, uint8_t cached_status)
+{
+  if (!cache_current)
+  {
+    return -1;
+  }
+  return cached && cached_status == 0 ? 1 : 0;
+}
+
+struct RelayPlan
+{
+  RelayCommand commands[2];
+  bool retained[2];
+  uint8_t count;
+};
+
+// Latch mode sends one retained "set". Pulse mode sends a retained "set 0"
+// first, so a relay that reboots comes back locked, then the pulse itself
+// unretained, so it is never replayed. Sequence numbers are left to the caller.
+inline RelayPlan planRelayCommands(int status, uint8_t channel, uint32_t unlock_pulse_ms)
+{
+  RelayPlan plan = {};
+  RelayCommand &set = plan.commands[0];
+  set.channel = channel;
+  set.sequenced = true;
+  set.type = RelayCommandType::Set;
+  set.state = status == 1 && unlock_pulse_ms == 0;
+  plan.retained[0] = true;
+  plan.count = 1;
+
+  if (status == 1 && unlock_pulse_ms > 0)
+  {
+    RelayCommand &pulse = plan.commands[1];
+    pulse = set;
+    pulse.type = RelayCommandType::Pulse;
+    pulse.state = true; // the relay reports the pin ON while the pulse runs
+    pulse.pulse_ms = unlock_pulse_ms;
+    plan.retained[1] = false;
+    plan.count = 2;
+  }
+  return plan;
+}
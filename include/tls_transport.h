@@ -0,0 +1,396 @@
+/*
+ * TLS transport helpers shared by the scanner and relay firmwares.
+ *
+ * WiFiClientSecure is backed by mbedTLS, which the ESP32 Arduino core builds
+ * with the AES/SHA/RSA hardware accelerators enabled, so record encryption
+ * and the handshake maths already run on the crypto peripheral. The remaining
+ * cost is the number of full handshakes, so both firmwares keep their TLS
+ * sockets open across requests, can use a PSK cipher suite (no certificate
+ * chain, no ECDHE), and resume the previous session on reconnect.
+ *
+ * The saved mbedtls_ssl_session has to be installed after mbedtls_ssl_setup()
+ * (which resets the context) and before the ClientHello is written, and
+ * WiFiClientSecure runs both inside start_ssl_client() with no hook in
+ * between. The firmwares therefore link with
+ * -Wl,--wrap=mbedtls_ssl_handshake (see platformio.ini): for a connection
+ * started by ResumableTlsClient the wrapper offers the saved session, then
+ * runs the handshake steps itself and watches the state after ServerHello.
+ * A resumed TLS 1.2 handshake goes straight to the server's
+ * ChangeCipherSpec; a full one continues with its certificate or key
+ * exchange. Every other connection goes to the real mbedtls_ssl_handshake.
+ *
+ * Arduino core 3.x is needed because it separates the TCP connect from the
+ * handshake (setPlainStart() and startTLS()); on core 2.x every reconnect is
+ * a full handshake and the telemetry says so. The server falls back to a
+ * full handshake by itself when it no longer knows the session.
+ *
+ * Include this header from one translation unit only; it defines the
+ * handshake wrapper.
+ *
+ * Build with -D ENABLE_TLS=1 (see platformio.ini) to switch both the MQTT and
+ * the backend connections over to TLS.
+ */
+
+#pragma once
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <WiFiClientSecure.h>
+
+#ifndef ENABLE_TLS
+#define ENABLE_TLS 0
+#endif
+
+#include <mbedtls/ssl.h>
+
+#if ENABLE_TLS && defined(ESP_ARDUINO_VERSION_MAJOR) && ESP_ARDUINO_VERSION_MAJOR >= 3
+#define TLS_SESSION_RESUMPTION 1
+#else
+#define TLS_SESSION_RESUMPTION 0
+#endif
+
+constexpr unsigned long TLS_HANDSHAKE_TIMEOUT_S = 5;
+constexpr size_t TLS_MAX_RESUMABLE_CLIENTS = 4;
+
+// Credentials for one TLS endpoint. Set psk_hex to use a PSK suite,
+// otherwise ca_cert (PEM) is used to verify the server certificate.
+struct TlsCredentials
+{
+  const char *ca_cert;
+  const char *psk_identity;
+  const char *psk_hex;
+};
+
+// Connection setup timings, split into cold connects (TCP + full handshake)
+// and warm requests that reused an already established session.
+struct ConnectionStats
+{
+  uint32_t cold_count;
+  uint32_t warm_count;
+  uint32_t failures;
+  unsigned long cold_last_ms;
+  unsigned long cold_max_ms;
+  unsigned long cold_total_ms;
+  unsigned long warm_last_ms;
+  unsigned long warm_total_ms;
+};
+
+// TLS handshake timings only (no TCP connect), split into full handshakes
+// and abbreviated ones that resumed the previous session
+struct HandshakeStats
+{
+  uint32_t full_count;
+  uint32_t resumed_count;
+  uint32_t not_resumed; // a saved session was offered but the server ran a full handshake
+  unsigned long full_last_ms;
+  unsigned long full_max_ms;
+  unsigned long full_total_ms;
+  unsigned long resumed_last_ms;
+  unsigned long resumed_max_ms;
+  unsigned long resumed_total_ms;
+};
+
+extern "C" int __real_mbedtls_ssl_handshake(mbedtls_ssl_context *ssl);
+
+#if TLS_SESSION_RESUMPTION
+class ResumableTlsClient;
+static ResumableTlsClient *tls_resumable_clients[TLS_MAX_RESUMABLE_CLIENTS] = {};
+
+// WiFiClientSecure that keeps the last session and offers it on reconnect
+class ResumableTlsClient : public WiFiClientSecure
+{
+public:
+  ResumableTlsClient()
+  {
+    mbedtls_ssl_session_init(&session_);
+    for (ResumableTlsClient *&slot : tls_resumable_clients)
+    {
+      if (slot == nullptr)
+      {
+        slot = this;
+        break;
+      }
+    }
+  }
+
+  ~ResumableTlsClient()
+  {
+    for (ResumableTlsClient *&slot : tls_resumable_clients)
+    {
+      if (slot == this)
+      {
+        slot = nullptr;
+      }
+    }
+    mbedtls_ssl_session_free(&session_);
+  }
+
+  using WiFiClientSecure::connect;
+
+  int connect(IPAddress ip, uint16_t port)
+  {
+    setPlainStart();
+    return WiFiClientSecure::connect(ip, port) ? handshake() : 0;
+  }
+
+  int connect(IPAddress ip, uint16_t port, int32_t timeout)
+  {
+    setPlainStart();
+    return WiFiClientSecure::connect(ip, port, timeout) ? handshake() : 0;
+  }
+
+  int connect(const char *host, uint16_t port)
+  {
+    setPlainStart();
+    return WiFiClientSecure::connect(host, port) ? handshake() : 0;
+  }
+
+  int connect(const char *host, uint16_t port, int32_t timeout)
+  {
+    setPlainStart();
+    return WiFiClientSecure::connect(host, port, timeout) ? handshake() : 0;
+  }
+
+  void dropSession()
+  {
+    mbedtls_ssl_session_free(&session_);
+    mbedtls_ssl_session_init(&session_);
+    has_session_ = false;
+  }
+
+  const HandshakeStats &handshakeStats() const { return stats_; }
+
+  bool handshaking(const mbedtls_ssl_context *ssl) const { return handshaking_ == ssl; }
+
+  // Called by __wrap_mbedtls_ssl_handshake, possibly several times per
+  // handshake (start_ssl_client() retries on WANT_READ/WANT_WRITE)
+  int runHandshake(mbedtls_ssl_context *ssl)
+  {
+    // mbedtls_ssl_setup() has run, and the ClientHello is not written yet
+    if (ssl->MBEDTLS_PRIVATE(state) == MBEDTLS_SSL_HELLO_REQUEST)
+    {
+      offered_ = has_session_ && mbedtls_ssl_set_session(ssl, &session_) == 0;
+      resumed_ = false;
+    }
+
+    int ret = 0;
+    while (ssl->MBEDTLS_PRIVATE(state) != MBEDTLS_SSL_HANDSHAKE_OVER)
+    {
+      const int before = ssl->MBEDTLS_PRIVATE(state);
+      ret = mbedtls_ssl_handshake_step(ssl);
+      if (ret != 0)
+      {
+        break;
+      }
+      if (before == MBEDTLS_SSL_SERVER_HELLO && ssl->MBEDTLS_PRIVATE(state) != MBEDTLS_SSL_SERVER_HELLO)
+      {
+        resumed_ = ssl->MBEDTLS_PRIVATE(state) == MBEDTLS_SSL_SERVER_CHANGE_CIPHER_SPEC;
+      }
+    }
+    return ret;
+  }
+
+private:
+  // TCP is up; startTLS() sets up mbedTLS and runs the handshake through runHandshake()
+  int handshake()
+  {
+    offered_ = false;
+    resumed_ = false;
+    handshaking_ = &sslclient->ssl_ctx;
+    const unsigned long start = millis();
+    startTLS();
+    const unsigned long elapsed = millis() - start;
+    handshaking_ = nullptr;
+    if (!connected())
+    {
+      dropSession();
+      return 0;
+    }
+
+    // Keep this connection's session (a new one, or the resumed one) for the next connect
+    mbedtls_ssl_session fresh;
+    mbedtls_ssl_session_init(&fresh);
+    const bool saved = mbedtls_ssl_get_session(&sslclient->ssl_ctx, &fresh) == 0;
+    dropSession();
+    if (saved)
+    {
+      session_ = fresh; // takes over the peer certificate and ticket buffers
+      has_session_ = true;
+    }
+    else
+    {
+      mbedtls_ssl_session_free(&fresh);
+    }
+
+    if (offered_ && !resumed_)
+    {
+      stats_.not_resumed++;
+    }
+    if (resumed_)
+    {
+      stats_.resumed_count++;
+      stats_.resumed_last_ms = elapsed;
+      stats_.resumed_total_ms += elapsed;
+      if (elapsed > stats_.resumed_max_ms)
+      {
+        stats_.resumed_max_ms = elapsed;
+      }
+    }
+    else
+    {
+      stats_.full_count++;
+      stats_.full_last_ms = elapsed;
+      stats_.full_total_ms += elapsed;
+      if (elapsed > stats_.full_max_ms)
+      {
+        stats_.full_max_ms = elapsed;
+      }
+    }
+    return 1;
+  }
+
+  mbedtls_ssl_session session_;
+  bool has_session_ = false;
+  const mbedtls_ssl_context *handshaking_ = nullptr; // set while startTLS() runs
+  bool offered_ = false;
+  bool resumed_ = false;
+  HandshakeStats stats_ = {};
+};
+#endif
+
+// Linked in place of mbedtls_ssl_handshake (-Wl,--wrap=mbedtls_ssl_handshake)
+extern "C" int __wrap_mbedtls_ssl_handshake(mbedtls_ssl_context *ssl)
+{
+#if TLS_SESSION_RESUMPTION
+  for (ResumableTlsClient *client : tls_resumable_clients)
+  {
+    if (client != nullptr && client->handshaking(ssl))
+    {
+      return client->runHandshake(ssl);
+    }
+  }
+#endif
+  return __real_mbedtls_ssl_handshake(ssl);
+}
+
+#if TLS_SESSION_RESUMPTION
+typedef ResumableTlsClient TransportClient;
+#elif ENABLE_TLS
+typedef WiFiClientSecure TransportClient;
+#else
+typedef WiFiClient TransportClient;
+#endif
+
+// Authentication mode for telemetry, so PSK and certificate runs can be told apart
+inline const char *tlsModeName(const TlsCredentials &creds)
+{
+  if (creds.psk_hex && creds.psk_hex[0] != '\0' && creds.psk_identity)
+  {
+    return "PSK";
+  }
+  return creds.ca_cert && creds.ca_cert[0] != '\0' ? "certificate" : "unverified";
+}
+
+#if ENABLE_TLS
+inline void configureTlsClient(WiFiClientSecure &client, const TlsCredentials &creds)
+{
+  client.setHandshakeTimeout(TLS_HANDSHAKE_TIMEOUT_S);
+
+  if (creds.psk_hex && creds.psk_hex[0] != '\0' && creds.psk_identity)
+  {
+    client.setPreSharedKey(creds.psk_identity, creds.psk_hex);
+    return;
+  }
+
+  if (creds.ca_cert && creds.ca_cert[0] != '\0')
+  {
+    client.setCACert(creds.ca_cert);
+    return;
+  }
+
+  // Without a CA or PSK the link is encrypted but the peer is not verified
+  Serial.println("WARNING: TLS enabled without CA or PSK; server identity not verified");
+  client.setInsecure();
+}
+#endif
+
+inline void recordConnection(ConnectionStats &stats, bool cold, unsigned long elapsed_ms, bool ok)
+{
+  if (!ok)
+  {
+    stats.failures++;
+    return;
+  }
+
+  if (cold)
+  {
+    stats.cold_count++;
+    stats.cold_last_ms = elapsed_ms;
+    stats.cold_total_ms += elapsed_ms;
+    if (elapsed_ms > stats.cold_max_ms)
+    {
+      stats.cold_max_ms = elapsed_ms;
+    }
+  }
+  else
+  {
+    stats.warm_count++;
+    stats.warm_last_ms = elapsed_ms;
+    stats.warm_total_ms += elapsed_ms;
+  }
+}
+
+inline void printConnectionStats(const char *label, const ConnectionStats &stats)
+{
+  Serial.print(label);
+  Serial.print(ENABLE_TLS ? " (TLS)" : " (plain)");
+  Serial.print(": cold ");
+  Serial.print(stats.cold_count);
+  Serial.print("x last ");
+  Serial.print(stats.cold_last_ms);
+  Serial.print(" ms avg ");
+  Serial.print(stats.cold_count ? stats.cold_total_ms / stats.cold_count : 0);
+  Serial.print(" ms max ");
+  Serial.print(stats.cold_max_ms);
+  Serial.print(" ms | warm ");
+  Serial.print(stats.warm_count);
+  Serial.print("x avg ");
+  Serial.print(stats.warm_count ? stats.warm_total_ms / stats.warm_count : 0);
+  Serial.print(" ms | failures ");
+  Serial.println(stats.failures);
+}
+
+// Full versus resumed handshake times of one TLS client
+inline void printHandshakeStats(const char *label, const TransportClient &client, const TlsCredentials &creds)
+{
+#if TLS_SESSION_RESUMPTION
+  const HandshakeStats &stats = client.handshakeStats();
+  Serial.print(label);
+  Serial.print(" TLS handshake (");
+  Serial.print(tlsModeName(creds));
+  Serial.print("): full ");
+  Serial.print(stats.full_count);
+  Serial.print("x avg ");
+  Serial.print(stats.full_count ? stats.full_total_ms / stats.full_count : 0);
+  Serial.print(" ms max ");
+  Serial.print(stats.full_max_ms);
+  Serial.print(" ms | resumed ");
+  Serial.print(stats.resumed_count);
+  Serial.print("x avg ");
+  Serial.print(stats.resumed_count ? stats.resumed_total_ms / stats.resumed_count : 0);
+  Serial.print(" ms max ");
+  Serial.print(stats.resumed_max_ms);
+  Serial.print(" ms | not resumed ");
+  Serial.println(stats.not_resumed);
+#elif ENABLE_TLS
+  (void)client;
+  Serial.print(label);
+  Serial.print(" TLS handshake (");
+  Serial.print(tlsModeName(creds));
+  Serial.println("): session resumption needs Arduino core 3.x, every reconnect is a full handshake");
+#else
+  (void)label;
+  (void)client;
+  (void)creds;
+#endif
+}
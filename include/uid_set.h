@@ -0,0 +1,578 @@
+/*
+ * Memory-compact set of card UIDs with a per-card status bit.
+ *
+ * Layout (one "generation"):
+ *   data   - keys sorted by (uid_len, uid bytes), grouped in blocks of
+ *            UID_SET_BLOCK_SIZE. Each entry is front-coded against the previous
+ *            entry of its block: header (shared << 4 | suffix_len) + suffix.
+ *   index  - first key and data offset of every block, stored in Eytzinger
+ *            (BFS) order so the search walks memory front to back.
+ *   status - one bit per card, indexed by sorted rank.
+ *
+ * data/index/status live in PSRAM when the board has it. A Bloom filter
+ * answers "definitely not registered" in O(1) without searching the table,
+ * which is the common case for an unknown card at the door. It is sized at
+ * UID_SET_BLOOM_BITS_PER_CARD for the expected population (about 99% of
+ * unknown cards rejected) and goes to internal RAM when that leaves
+ * UID_SET_BLOOM_INTERNAL_RESERVE free, to PSRAM otherwise. On a board
+ * without PSRAM, a filter that does not fit is halved until it does (5 bits
+ * per card lets ~9% of unknown cards through instead of ~1%); the expected
+ * rate is in usage().bloom_pass_rate. On a plain ESP32 with WiFi and TLS up
+ * the 99% figure holds up to about 50k cards. The filter grows with the
+ * registry when a rebuild takes it past the planned size.
+ *
+ * Status changes are applied in place. Inserts and deletes rebuild into the
+ * inactive generation, which is then published with a pointer flip; a failed
+ * allocation leaves the active generation untouched. Lookups and updates are
+ * both expected to run on the loop task.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(ARDUINO_ARCH_ESP32)
+#include <esp_heap_caps.h>
+#endif
+
+constexpr size_t UID_SET_MAX_UID_LEN = 10; // MFRC522 UIDs are 4, 7 or 10 bytes
+constexpr size_t UID_SET_KEY_LEN = UID_SET_MAX_UID_LEN + 1;
+constexpr size_t UID_SET_BLOCK_SIZE = 16;
+constexpr size_t UID_SET_BLOOM_BITS_PER_CARD = 10;    // ~1% false positives
+constexpr size_t UID_SET_BLOOM_MIN_BITS = 1024;
+constexpr size_t UID_SET_BLOOM_MAX_BITS = 16 * 1024 * 1024 * 8; // 16 MB, beyond any PSRAM
+constexpr size_t UID_SET_BLOOM_INTERNAL_RESERVE = 64 * 1024;  // left for WiFi/TLS buffers
+
+// Normalised key: [uid_len, uid bytes, zero padding]. memcmp order equals
+// (uid_len, uid bytes) order.
+struct UidKey
+{
+  uint8_t bytes[UID_SET_KEY_LEN];
+
+  bool assign(const uint8_t *uid, uint8_t uid_len)
+  {
+    if (!uid || uid_len == 0 || uid_len > UID_SET_MAX_UID_LEN)
+    {
+      return false;
+    }
+    memset(bytes, 0, sizeof(bytes));
+    bytes[0] = uid_len;
+    memcpy(&bytes[1], uid, uid_len);
+    return true;
+  }
+
+  uint8_t length() const { return static_cast<uint8_t>(bytes[0] + 1); }
+};
+
+inline int compareUidKeys(const UidKey &a, const UidKey &b)
+{
+  return memcmp(a.bytes, b.bytes, UID_SET_KEY_LEN);
+}
+
+// One change for CompactUidSet::rebuild(); ops must be sorted and unique
+struct UidSetOp
+{
+  UidKey key;
+  uint8_t status;
+  bool deleted;
+};
+
+struct UidSetUsage
+{
+  size_t cards;
+  size_t data_bytes;   // front-coded keys
+  size_t index_bytes;  // Eytzinger block index
+  size_t status_bytes; // status bitmap
+  size_t bloom_bytes;
+  bool bloom_internal;    // false: PSRAM
+  float bloom_pass_rate;  // expected share of unknown cards that reach the table
+};
+
+class CompactUidSet
+{
+public:
+  ~CompactUidSet()
+  {
+    for (Generation &gen : generations_)
+    {
+      releaseGeneration(gen);
+    }
+    free(sorted_index_);
+    free(bloom_);
+  }
+
+  // Sizes the Bloom filter for the expected population and the free heap.
+  // Returns false only when not even the minimum filter could be allocated.
+  bool begin(size_t expected_cards)
+  {
+    size_t bits = expected_cards * UID_SET_BLOOM_BITS_PER_CARD;
+    bits = bits < UID_SET_BLOOM_MIN_BITS ? UID_SET_BLOOM_MIN_BITS : bits;
+    bits = bits > UID_SET_BLOOM_MAX_BITS ? UID_SET_BLOOM_MAX_BITS : bits;
+
+    size_t pow2 = UID_SET_BLOOM_MIN_BITS;
+    while (pow2 < bits)
+    {
+      pow2 <<= 1;
+    }
+
+    free(bloom_);
+    bloom_ = nullptr;
+    bloom_planned_cards_ = expected_cards;
+    for (; !bloom_ && pow2 >= UID_SET_BLOOM_MIN_BITS; pow2 >>= 1)
+    {
+      bloom_ = allocateBloom(pow2 / 8, bloom_internal_);
+      bloom_mask_ = pow2 - 1;
+    }
+    bloom_mask_ = bloom_ ? bloom_mask_ : 0;
+    rebuildBloom();
+    return bloom_ != nullptr;
+  }
+
+  // Bloom filter only: false means the card is definitely not in the set
+  bool mayContain(const UidKey &key) const { return bloomMayContain(key); }
+
+  bool contains(const UidKey &key) const
+  {
+    uint8_t status = 0;
+    return lookup(key, status);
+  }
+
+  bool lookup(const UidKey &key, uint8_t &status) const
+  {
+    if (!bloomMayContain(key))
+    {
+      return false;
+    }
+
+    size_t rank = 0;
+    if (!findRank(active(), key, rank))
+    {
+      return false;
+    }
+    status = (active().status[rank / 8] >> (rank % 8)) & 1;
+    return true;
+  }
+
+  // Updates the status of an existing card in place
+  bool setStatus(const UidKey &key, uint8_t status)
+  {
+    size_t rank = 0;
+    Generation &gen = generations_[active_];
+    if (!findRank(gen, key, rank))
+    {
+      return false;
+    }
+    const uint8_t mask = static_cast<uint8_t>(1 << (rank % 8));
+    gen.status[rank / 8] = status ? (gen.status[rank / 8] | mask) : (gen.status[rank / 8] & ~mask);
+    return true;
+  }
+
+  // Merges the active generation with ops into the inactive generation and
+  // flips to it. Returns false (set unchanged) if memory runs out.
+  bool rebuild(const UidSetOp *ops, size_t op_count)
+  {
+    const Generation &src = active();
+    Generation &dst = generations_[active_ ^ 1];
+
+    const size_t max_cards = src.count + op_count;
+    const size_t max_blocks = (max_cards + UID_SET_BLOCK_SIZE - 1) / UID_SET_BLOCK_SIZE;
+    const size_t max_data = src.data_len + op_count * (1 + UID_SET_KEY_LEN);
+
+    if (!reserve(dst.data, dst.data_capacity, max_data) ||
+        !reserve(dst.status, dst.status_capacity, (max_cards + 7) / 8) ||
+        !reserve(sorted_index_, sorted_index_capacity_, max_blocks * sizeof(IndexEntry)) ||
+        !reserve(dst.index, dst.index_capacity, (max_blocks + 1) * sizeof(IndexEntry)))
+    {
+      return false;
+    }
+
+    Writer writer(dst, reinterpret_cast<IndexEntry *>(sorted_index_));
+    Reader reader(src);
+    UidKey current;
+    uint8_t current_status = 0;
+    bool has_current = reader.next(current, current_status);
+    size_t op = 0;
+
+    while (has_current || op < op_count)
+    {
+      const int order = !has_current ? 1 : (op >= op_count ? -1 : compareUidKeys(current, ops[op].key));
+      if (order < 0)
+      {
+        writer.append(current, current_status);
+        has_current = reader.next(current, current_status);
+        continue;
+      }
+
+      if (!ops[op].deleted)
+      {
+        writer.append(ops[op].key, ops[op].status);
+      }
+      if (order == 0)
+      {
+        has_current = reader.next(current, current_status);
+      }
+      op++;
+    }
+
+    dst.count = writer.count;
+    dst.data_len = writer.data_len;
+    dst.block_count = writer.block_count;
+    buildEytzinger(reinterpret_cast<const IndexEntry *>(sorted_index_), dst);
+
+    active_ ^= 1;
+    // Grow the filter once the registry outgrows the size it was planned for
+    if (bloom_ && active().count > bloom_planned_cards_)
+    {
+      begin(active().count + active().count / 4);
+    }
+    else
+    {
+      rebuildBloom();
+    }
+    return true;
+  }
+
+  size_t size() const { return active().count; }
+
+  UidSetUsage usage() const
+  {
+    const Generation &gen = active();
+    UidSetUsage usage = {};
+    usage.cards = gen.count;
+    usage.data_bytes = gen.data_len;
+    usage.index_bytes = (gen.block_count + 1) * sizeof(IndexEntry);
+    usage.status_bytes = (gen.count + 7) / 8;
+    usage.bloom_bytes = bloom_ ? (bloom_mask_ + 1) / 8 : 0;
+    usage.bloom_internal = bloom_internal_;
+    usage.bloom_pass_rate = 1.0f;
+    if (bloom_ && gen.count > 0)
+    {
+      // (1 - e^(-kn/m))^k
+      const double fill = 1.0 - std::exp(-static_cast<double>(bloom_hashes_) * gen.count / (bloom_mask_ + 1));
+      usage.bloom_pass_rate = static_cast<float>(std::pow(fill, bloom_hashes_));
+    }
+    return usage;
+  }
+
+private:
+  struct IndexEntry
+  {
+    UidKey first;
+    uint32_t offset;
+    uint32_t block;
+  };
+
+  struct Generation
+  {
+    uint8_t *data = nullptr;
+    uint8_t *index = nullptr; // IndexEntry[block_count + 1], 1-based Eytzinger
+    uint8_t *status = nullptr;
+    size_t data_capacity = 0;
+    size_t index_capacity = 0;
+    size_t status_capacity = 0;
+    size_t data_len = 0;
+    size_t count = 0;
+    size_t block_count = 0;
+  };
+
+  // Sequential decoder over a generation in sorted order
+  struct Reader
+  {
+    explicit Reader(const Generation &gen) : gen(gen) {}
+
+    bool next(UidKey &key, uint8_t &status)
+    {
+      if (rank >= gen.count)
+      {
+        return false;
+      }
+      if (rank % UID_SET_BLOCK_SIZE == 0)
+      {
+        memset(previous.bytes, 0, sizeof(previous.bytes));
+      }
+      offset = decodeEntry(gen.data, offset, previous);
+      key = previous;
+      status = (gen.status[rank / 8] >> (rank % 8)) & 1;
+      rank++;
+      return true;
+    }
+
+    const Generation &gen;
+    UidKey previous = {};
+    size_t offset = 0;
+    size_t rank = 0;
+  };
+
+  struct Writer
+  {
+    Writer(Generation &gen, IndexEntry *sorted) : gen(gen), sorted(sorted) {}
+
+    void append(const UidKey &key, uint8_t status)
+    {
+      size_t shared = 0;
+      if (count % UID_SET_BLOCK_SIZE == 0)
+      {
+        sorted[block_count].first = key;
+        sorted[block_count].offset = static_cast<uint32_t>(data_len);
+        sorted[block_count].block = static_cast<uint32_t>(block_count);
+        block_count++;
+      }
+      else
+      {
+        while (shared < key.length() && key.bytes[shared] == previous.bytes[shared])
+        {
+          shared++;
+        }
+      }
+
+      const size_t suffix = key.length() - shared;
+      gen.data[data_len++] = static_cast<uint8_t>((shared << 4) | suffix);
+      memcpy(&gen.data[data_len], &key.bytes[shared], suffix);
+      data_len += suffix;
+
+      const uint8_t mask = static_cast<uint8_t>(1 << (count % 8));
+      gen.status[count / 8] = status ? (gen.status[count / 8] | mask) : (gen.status[count / 8] & ~mask);
+      previous = key;
+      count++;
+    }
+
+    Generation &gen;
+    IndexEntry *sorted;
+    UidKey previous = {};
+    size_t data_len = 0;
+    size_t count = 0;
+    size_t block_count = 0;
+  };
+
+  static size_t decodeEntry(const uint8_t *data, size_t offset, UidKey &key)
+  {
+    const uint8_t header = data[offset++];
+    const size_t shared = header >> 4;
+    const size_t suffix = header & 0x0F;
+    memcpy(&key.bytes[shared], &data[offset], suffix);
+    memset(&key.bytes[shared + suffix], 0, UID_SET_KEY_LEN - shared - suffix);
+    return offset + suffix;
+  }
+
+  static void buildEytzinger(const IndexEntry *sorted, Generation &gen)
+  {
+    IndexEntry *eytzinger = reinterpret_cast<IndexEntry *>(gen.index);
+    size_t next = 0;
+    fillEytzinger(sorted, eytzinger, gen.block_count, 1, next);
+  }
+
+  static void fillEytzinger(const IndexEntry *sorted, IndexEntry *eytzinger, size_t n, size_t k, size_t &next)
+  {
+    if (k > n)
+    {
+      return;
+    }
+    fillEytzinger(sorted, eytzinger, n, 2 * k, next);
+    eytzinger[k] = sorted[next++];
+    fillEytzinger(sorted, eytzinger, n, 2 * k + 1, next);
+  }
+
+  static bool findRank(const Generation &gen, const UidKey &key, size_t &rank)
+  {
+    if (gen.block_count == 0)
+    {
+      return false;
+    }
+
+    // Descend the Eytzinger tree remembering the last block whose first key
+    // is <= key; the card can only live in that block
+    const IndexEntry *eytzinger = reinterpret_cast<const IndexEntry *>(gen.index);
+    size_t k = 1;
+    size_t candidate = 0;
+    while (k <= gen.block_count)
+    {
+      if (compareUidKeys(eytzinger[k].first, key) <= 0)
+      {
+        candidate = k;
+        k = 2 * k + 1;
+      }
+      else
+      {
+        k = 2 * k;
+      }
+    }
+    if (candidate == 0)
+    {
+      return false;
+    }
+
+    const size_t first_rank = eytzinger[candidate].block * UID_SET_BLOCK_SIZE;
+    const size_t end_rank = first_rank + UID_SET_BLOCK_SIZE < gen.count ? first_rank + UID_SET_BLOCK_SIZE : gen.count;
+    size_t offset = eytzinger[candidate].offset;
+
+    UidKey current = {};
+    for (size_t r = first_rank; r < end_rank; r++)
+    {
+      offset = decodeEntry(gen.data, offset, current);
+      const int order = compareUidKeys(current, key);
+      if (order == 0)
+      {
+        rank = r;
+        return true;
+      }
+      if (order > 0)
+      {
+        return false;
+      }
+    }
+    return false;
+  }
+
+  static uint64_t hashKey(const UidKey &key)
+  {
+    // FNV-1a, then a murmur finaliser to spread low bits
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < key.length(); i++)
+    {
+      h = (h ^ key.bytes[i]) * 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h;
+  }
+
+  bool bloomMayContain(const UidKey &key) const
+  {
+    if (!bloom_)
+    {
+      return true;
+    }
+    const uint64_t h = hashKey(key);
+    const uint32_t h1 = static_cast<uint32_t>(h);
+    const uint32_t h2 = static_cast<uint32_t>(h >> 32) | 1;
+    for (uint8_t i = 0; i < bloom_hashes_; i++)
+    {
+      const size_t bit = (h1 + i * h2) & bloom_mask_;
+      if (!(bloom_[bit / 8] & (1 << (bit % 8))))
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void bloomAdd(const UidKey &key)
+  {
+    const uint64_t h = hashKey(key);
+    const uint32_t h1 = static_cast<uint32_t>(h);
+    const uint32_t h2 = static_cast<uint32_t>(h >> 32) | 1;
+    for (uint8_t i = 0; i < bloom_hashes_; i++)
+    {
+      const size_t bit = (h1 + i * h2) & bloom_mask_;
+      bloom_[bit / 8] |= static_cast<uint8_t>(1 << (bit % 8));
+    }
+  }
+
+  // Deletes cannot be removed from a Bloom filter, so it is rebuilt whenever
+  // membership changes; k is re-tuned for the current bits per card
+  void rebuildBloom()
+  {
+    if (!bloom_)
+    {
+      return;
+    }
+
+    const Generation &gen = active();
+    const size_t bits = bloom_mask_ + 1;
+    const size_t per_card = gen.count ? bits / gen.count : bits;
+    size_t hashes = (per_card * 69 + 50) / 100; // k = m/n * ln 2
+    hashes = hashes < 1 ? 1 : (hashes > 8 ? 8 : hashes);
+    bloom_hashes_ = static_cast<uint8_t>(hashes);
+
+    memset(bloom_, 0, bits / 8);
+    Reader reader(gen);
+    UidKey key;
+    uint8_t status = 0;
+    while (reader.next(key, status))
+    {
+      bloomAdd(key);
+    }
+  }
+
+  // Internal RAM when it leaves the reserve free, else PSRAM, else nothing
+  static uint8_t *allocateBloom(size_t bytes, bool &internal)
+  {
+    internal = true;
+#if defined(ARDUINO_ARCH_ESP32)
+    const uint32_t caps = MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT;
+    if (bytes + UID_SET_BLOOM_INTERNAL_RESERVE <= heap_caps_get_free_size(caps) &&
+        bytes <= heap_caps_get_largest_free_block(caps))
+    {
+      void *ptr = heap_caps_calloc(1, bytes, caps);
+      if (ptr)
+      {
+        return static_cast<uint8_t *>(ptr);
+      }
+    }
+    internal = false;
+    return static_cast<uint8_t *>(heap_caps_calloc(1, bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT));
+#else
+    return static_cast<uint8_t *>(calloc(bytes, 1));
+#endif
+  }
+
+  static void *allocateBulk(size_t size)
+  {
+#if defined(ARDUINO_ARCH_ESP32)
+    void *ptr = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (ptr)
+    {
+      return ptr;
+    }
+#endif
+    return malloc(size);
+  }
+
+  // Grow-only buffers so steady-state rebuilds do not allocate
+  static bool reserve(uint8_t *&buffer, size_t &capacity, size_t needed)
+  {
+    if (needed == 0)
+    {
+      needed = 1;
+    }
+    if (buffer && capacity >= needed)
+    {
+      return true;
+    }
+    const size_t grown = needed + needed / 4;
+    uint8_t *fresh = static_cast<uint8_t *>(allocateBulk(grown));
+    if (!fresh)
+    {
+      return false;
+    }
+    free(buffer);
+    buffer = fresh;
+    capacity = grown;
+    return true;
+  }
+
+  static void releaseGeneration(Generation &gen)
+  {
+    free(gen.data);
+    free(gen.index);
+    free(gen.status);
+    gen = Generation();
+  }
+
+  const Generation &active() const { return generations_[active_]; }
+
+  Generation generations_[2];
+  uint8_t active_ = 0;
+  uint8_t *sorted_index_ = nullptr; // rebuild scratch
+  size_t sorted_index_capacity_ = 0;
+  uint8_t *bloom_ = nullptr;
+  size_t bloom_mask_ = 0;
+  uint8_t bloom_hashes_ = 1;
+  bool bloom_internal_ = true;
+  size_t bloom_planned_cards_ = 0;
+};
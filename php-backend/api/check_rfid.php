@@ -10,6 +10,7 @@ header('Content-Type: application/json');
 require_once '../config/database.php';
 require_once '../config/timezone.php';
 require_once '../config/realtime.php';
+require_once '../config/registry_sync.php';
 
 // Function to format response
 function sendResponse($status, $found, $message, $rfid_data = '', $status_text = null)
@@ -66,11 +67,14 @@ try {
         $status_text = (string) $status;
 
         // Update the status in the database
+        $revision_before = currentRegistryRevision($conn);
         $update_stmt = $conn->prepare("UPDATE rfid_reg SET rfid_status = :new_status, updated_at = NOW() WHERE rfid_data = :rfid_data");
         $update_stmt->execute([
             'new_status' => $status,
             'rfid_data' => $rfid_data
         ]);
+
+        publishRegistryDelta($conn, $revision_before);
     }
 
     // Log the activity to rfid_logs (using the new toggled status)
@@ -0,0 +1,73 @@
+<?php
+// API endpoint for delta sync of registered RFID cards
+// Returns the latest change per card with revision > since
+// format=binary returns the compact delta decoded by the ESP32 firmware
+
+header('Cache-Control: no-cache, must-revalidate');
+
+require_once '../config/database.php';
+require_once '../config/registry_sync.php';
+
+define('CHANGES_DEFAULT_LIMIT', 500);
+define('CHANGES_MAX_LIMIT', 2000);
+
+$since = isset($_GET['since']) ? max(0, (int) $_GET['since']) : 0;
+$limit = isset($_GET['limit']) ? (int) $_GET['limit'] : CHANGES_DEFAULT_LIMIT;
+$limit = max(1, min($limit, CHANGES_MAX_LIMIT));
+$binary = isset($_GET['format']) && $_GET['format'] === 'binary';
+
+$conn = getDBConnection();
+if (!$conn) {
+    http_response_code(503);
+    header('Content-Type: application/json');
+    echo json_encode([
+        'success' => false,
+        'message' => 'Database connection failed'
+    ]);
+    exit();
+}
+
+try {
+    $revision = currentRegistryRevision($conn);
+
+    // Fetch one extra row to know whether the client has to page
+    $changes = fetchRegistryChanges($conn, $since, $limit + 1);
+    $hasMore = count($changes) > $limit;
+    if ($hasMore) {
+        $changes = array_slice($changes, 0, $limit);
+    }
+
+    $lastRev = empty($changes) ? $since : $changes[count($changes) - 1]['rev'];
+    $toRev = $hasMore ? $lastRev : max($since, $revision, $lastRev);
+    header('X-Registry-Revision: ' . $revision);
+
+    if ($binary) {
+        $payload = encodeRegistryDelta($since, $toRev, $changes, $hasMore);
+        header('Content-Type: application/octet-stream');
+        header('Content-Length: ' . strlen($payload));
+        echo $payload;
+        exit();
+    }
+
+    ob_start('ob_gzhandler');
+    header('Content-Type: application/json');
+    echo json_encode([
+        'success' => true,
+        'revision' => $revision,
+        'from_rev' => $since,
+        'to_rev' => $toRev,
+        'has_more' => $hasMore,
+        'count' => count($changes),
+        'changes' => $changes,
+    ]);
+    ob_end_flush();
+
+} catch (PDOException $e) {
+    error_log("Database Error: " . $e->getMessage());
+    http_response_code(500);
+    header('Content-Type: application/json');
+    echo json_encode([
+        'success' => false,
+        'message' => 'Database error occurred'
+    ]);
+}
@@ -19,6 +19,7 @@ if ($_SERVER['REQUEST_METHOD'] !== 'POST') {
 }
 
 require_once '../config/database.php';
+require_once '../config/registry_sync.php';
 
 $rawInput = file_get_contents('php://input');
 $data = [];
@@ -80,6 +81,7 @@ try {
         exit();
     }
 
+    $revisionBefore = currentRegistryRevision($conn);
     $updateStmt = $conn->prepare('UPDATE rfid_reg SET rfid_status = :status WHERE id = :id');
     $updateStmt->execute([
         'status' => $status,
@@ -103,6 +105,8 @@ try {
         'updated_at' => $updated['updated_at'],
     ];
 
+    publishRegistryDelta($conn, $revisionBefore);
+
     // Clear APCu cache for registered list (if available)
     if (function_exists('apcu_delete')) {
         apcu_delete('rfid_registered_list');
@@ -0,0 +1,203 @@
+<?php
+// Revisioned delta sync for the registered-card list.
+// rfid_reg_changes (filled by triggers, see database/init.sql) is the change log;
+// devices ask for "changes since rev N" and receive compact binary deltas,
+// either over HTTP (api/get_registered_changes.php) or on a retained MQTT topic.
+//
+// Binary delta layout (little endian), decoded by include/registry_sync.h:
+//   'RD' | version u8 | flags u8 | from_rev u32 | to_rev u32 | count u16
+//   count x (entry_flags u8 | uid_len u8 | uid bytes)
+
+define('REGISTRY_DELTA_VERSION', 1);
+define('REGISTRY_DELTA_FLAG_HAS_MORE', 0x01);
+define('REGISTRY_ENTRY_FLAG_STATUS', 0x01);
+define('REGISTRY_ENTRY_FLAG_DELETED', 0x02);
+define('REGISTRY_MAX_UID_BYTES', 10);
+
+define('REGISTRY_MQTT_ENABLED', getenv('REGISTRY_MQTT_ENABLED') !== '0');
+define('REGISTRY_MQTT_HOST', getenv('REGISTRY_MQTT_HOST') ?: '127.0.0.1');
+define('REGISTRY_MQTT_PORT', (int) (getenv('REGISTRY_MQTT_PORT') ?: 1883));
+define('REGISTRY_MQTT_TOPIC', getenv('REGISTRY_MQTT_TOPIC') ?: 'RFID_REG_DELTA');
+define('REGISTRY_MQTT_PUB_BIN', getenv('REGISTRY_MQTT_PUB_BIN') ?: 'mosquitto_pub');
+// PHP_BINARY points at httpd under mod_php, so locate the CLI next to it
+define('REGISTRY_PHP_CLI', getenv('REGISTRY_PHP_CLI') ?: PHP_BINDIR . DIRECTORY_SEPARATOR . (stripos(PHP_OS_FAMILY, 'Windows') === 0 ? 'php.exe' : 'php'));
+// Keep pushed deltas within the device's MQTT buffer; larger ones fall back to HTTP
+define('REGISTRY_MQTT_MAX_CHANGES', 64);
+
+function currentRegistryRevision(PDO $conn): int
+{
+    $stmt = $conn->query('SELECT COALESCE(MAX(rev), 0) FROM rfid_reg_changes');
+    return (int) $stmt->fetchColumn();
+}
+
+// Latest change per card with rev > $sinceRev, in revision order
+function fetchRegistryChanges(PDO $conn, int $sinceRev, int $limit): array
+{
+    $stmt = $conn->prepare(
+        'SELECT c.rev, c.rfid_data, c.rfid_status, c.deleted
+         FROM rfid_reg_changes c
+         WHERE c.rev > :since
+           AND NOT EXISTS (
+               SELECT 1 FROM rfid_reg_changes newer
+               WHERE newer.rfid_data = c.rfid_data AND newer.rev > c.rev
+           )
+         ORDER BY c.rev ASC
+         LIMIT :limit'
+    );
+    $stmt->bindValue(':since', $sinceRev, PDO::PARAM_INT);
+    $stmt->bindValue(':limit', $limit, PDO::PARAM_INT);
+    $stmt->execute();
+
+    $changes = [];
+    foreach ($stmt->fetchAll() as $row) {
+        $changes[] = [
+            'rev' => (int) $row['rev'],
+            'rfid_data' => $row['rfid_data'],
+            'rfid_status' => (bool) $row['rfid_status'],
+            'deleted' => (bool) $row['deleted'],
+        ];
+    }
+
+    return $changes;
+}
+
+// "63:70:DA:39" -> raw UID bytes, or null if the value is not a card UID
+function registryUidBytes(string $rfidData): ?string
+{
+    $hex = str_replace([':', '-', ' '], '', $rfidData);
+    if ($hex === '' || strlen($hex) % 2 !== 0 || !ctype_xdigit($hex)) {
+        return null;
+    }
+
+    $bytes = hex2bin($hex);
+    if ($bytes === false || strlen($bytes) > REGISTRY_MAX_UID_BYTES) {
+        return null;
+    }
+
+    return $bytes;
+}
+
+function encodeRegistryDelta(int $fromRev, int $toRev, array $changes, bool $hasMore): string
+{
+    $entries = '';
+    $count = 0;
+
+    foreach ($changes as $change) {
+        $uid = registryUidBytes($change['rfid_data']);
+        if ($uid === null) {
+            // Cannot be presented by an MFRC522, so devices never need it
+            continue;
+        }
+
+        $flags = ($change['rfid_status'] ? REGISTRY_ENTRY_FLAG_STATUS : 0)
+            | ($change['deleted'] ? REGISTRY_ENTRY_FLAG_DELETED : 0);
+        $entries .= pack('CC', $flags, strlen($uid)) . $uid;
+        $count++;
+    }
+
+    return 'RD'
+        . pack('CCVVv', REGISTRY_DELTA_VERSION, $hasMore ? REGISTRY_DELTA_FLAG_HAS_MORE : 0, $fromRev, $toRev, $count)
+        . $entries;
+}
+
+// Pushes the delta for (sinceRev, latest] without holding up the API
+// response: the publish runs in a background CLI process when exec() is
+// available and falls back to publishing inline.
+function publishRegistryDelta(PDO $conn, int $sinceRev): bool
+{
+    if (!REGISTRY_MQTT_ENABLED) {
+        return false;
+    }
+
+    if (triggerAsyncRegistryPublish($sinceRev)) {
+        return true;
+    }
+
+    return publishRegistryDeltaNow($conn, $sinceRev);
+}
+
+function triggerAsyncRegistryPublish(int $sinceRev): bool
+{
+    if (!function_exists('exec')) {
+        return false;
+    }
+
+    $script = escapeshellarg(__DIR__ . '/../tools/publish_registry_delta.php');
+    $php = escapeshellarg(REGISTRY_PHP_CLI);
+
+    if (stripos(PHP_OS_FAMILY, 'Windows') === 0) {
+        $command = sprintf('start "" /B %s %s --since=%d > NUL 2>&1', $php, $script, $sinceRev);
+    } else {
+        $command = sprintf('%s %s --since=%d > /dev/null 2>&1 &', $php, $script, $sinceRev);
+    }
+
+    try {
+        exec($command);
+        return true;
+    } catch (\Throwable $e) {
+        error_log('Registry sync async exec failed: ' . $e->getMessage());
+        return false;
+    }
+}
+
+// Builds the delta for (sinceRev, latest] and pushes it as the retained
+// message on the registry topic. Devices that missed earlier deltas detect
+// the gap from from_rev and catch up over HTTP.
+function publishRegistryDeltaNow(PDO $conn, int $sinceRev): bool
+{
+    try {
+        $changes = fetchRegistryChanges($conn, $sinceRev, REGISTRY_MQTT_MAX_CHANGES + 1);
+        if (empty($changes)) {
+            return false;
+        }
+
+        $hasMore = count($changes) > REGISTRY_MQTT_MAX_CHANGES;
+        if ($hasMore) {
+            $changes = array_slice($changes, 0, REGISTRY_MQTT_MAX_CHANGES);
+        }
+
+        $toRev = $changes[count($changes) - 1]['rev'];
+        $payload = encodeRegistryDelta($sinceRev, $toRev, $changes, $hasMore);
+    } catch (PDOException $e) {
+        error_log('Registry sync: failed to build delta: ' . $e->getMessage());
+        return false;
+    }
+
+    return publishRetainedBinary(REGISTRY_MQTT_TOPIC, $payload);
+}
+
+function publishRetainedBinary(string $topic, string $payload): bool
+{
+    if (!function_exists('proc_open')) {
+        return false;
+    }
+
+    // -s sends stdin as a single message, which keeps binary payloads intact
+    $command = sprintf(
+        '%s -h %s -p %d -t %s -r -q 1 -s',
+        escapeshellcmd(REGISTRY_MQTT_PUB_BIN),
+        escapeshellarg(REGISTRY_MQTT_HOST),
+        REGISTRY_MQTT_PORT,
+        escapeshellarg($topic)
+    );
+
+    $process = proc_open($command, [0 => ['pipe', 'r'], 1 => ['pipe', 'w'], 2 => ['pipe', 'w']], $pipes);
+    if (!is_resource($process)) {
+        error_log('Registry sync: failed to start ' . REGISTRY_MQTT_PUB_BIN);
+        return false;
+    }
+
+    fwrite($pipes[0], $payload);
+    fclose($pipes[0]);
+    $stderr = stream_get_contents($pipes[2]);
+    fclose($pipes[1]);
+    fclose($pipes[2]);
+    $exitCode = proc_close($process);
+
+    if ($exitCode !== 0) {
+        error_log('Registry sync: mosquitto_pub exited with ' . $exitCode . ': ' . trim((string) $stderr));
+        return false;
+    }
+
+    return true;
+}
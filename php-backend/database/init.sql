@@ -24,6 +24,53 @@ CREATE TABLE IF NOT EXISTS rfid_logs (
     INDEX idx_covering (time_log DESC, rfid_data, rfid_status, id)
 ) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4;
 
+-- Change log for registered RFID cards (delta sync for devices)
+-- Every insert/update/delete on rfid_reg appends a row; rev is the monotonically
+-- increasing registry revision. Devices ask for "changes since rev N".
+CREATE TABLE IF NOT EXISTS rfid_reg_changes (
+    rev BIGINT UNSIGNED AUTO_INCREMENT PRIMARY KEY,
+    rfid_data VARCHAR(50) NOT NULL,
+    rfid_status BOOLEAN NOT NULL,
+    deleted BOOLEAN NOT NULL DEFAULT 0,
+    changed_at TIMESTAMP DEFAULT CURRENT_TIMESTAMP,
+    INDEX idx_rfid_data_rev (rfid_data, rev)
+) ENGINE=InnoDB DEFAULT CHARSET=utf8mb4;
+
+-- Seed the change log with cards registered before it existed, so "since=0"
+-- returns the full registry. Cards that already have a change row are skipped,
+-- which keeps re-running this script harmless.
+INSERT INTO rfid_reg_changes (rfid_data, rfid_status, deleted)
+SELECT r.rfid_data, r.rfid_status, 0
+FROM rfid_reg r
+WHERE NOT EXISTS (SELECT 1 FROM rfid_reg_changes c WHERE c.rfid_data = r.rfid_data)
+ORDER BY r.id;
+
+DROP TRIGGER IF EXISTS trg_rfid_reg_insert;
+DROP TRIGGER IF EXISTS trg_rfid_reg_update;
+DROP TRIGGER IF EXISTS trg_rfid_reg_delete;
+
+DELIMITER $$
+CREATE TRIGGER trg_rfid_reg_insert AFTER INSERT ON rfid_reg FOR EACH ROW
+BEGIN
+    INSERT INTO rfid_reg_changes (rfid_data, rfid_status, deleted) VALUES (NEW.rfid_data, NEW.rfid_status, 0);
+END$$
+
+CREATE TRIGGER trg_rfid_reg_update AFTER UPDATE ON rfid_reg FOR EACH ROW
+BEGIN
+    IF NEW.rfid_data <> OLD.rfid_data THEN
+        INSERT INTO rfid_reg_changes (rfid_data, rfid_status, deleted) VALUES (OLD.rfid_data, OLD.rfid_status, 1);
+        INSERT INTO rfid_reg_changes (rfid_data, rfid_status, deleted) VALUES (NEW.rfid_data, NEW.rfid_status, 0);
+    ELSEIF NEW.rfid_status <> OLD.rfid_status THEN
+        INSERT INTO rfid_reg_changes (rfid_data, rfid_status, deleted) VALUES (NEW.rfid_data, NEW.rfid_status, 0);
+    END IF;
+END$$
+
+CREATE TRIGGER trg_rfid_reg_delete AFTER DELETE ON rfid_reg FOR EACH ROW
+BEGIN
+    INSERT INTO rfid_reg_changes (rfid_data, rfid_status, deleted) VALUES (OLD.rfid_data, OLD.rfid_status, 1);
+END$$
+DELIMITER ;
+
 -- Insert sample RFID data for testing
 INSERT INTO rfid_reg (rfid_data, rfid_status) VALUES 
 ('63:70:DA:39', 1), 
@@ -12,6 +12,7 @@ USE it414_db_ajjcr;
 
 ANALYZE TABLE rfid_reg;
 ANALYZE TABLE rfid_logs;
+ANALYZE TABLE rfid_reg_changes;
 
 -- ==================== TABLE OPTIMIZATION ====================
 -- Defragments tables and reclaims unused space
@@ -68,6 +69,18 @@ LIMIT 1000;
 -- Note: Use LIMIT to prevent long-running deletes
 -- Run multiple times if needed
 
+-- ==================== COMPACT REGISTRY CHANGE LOG ====================
+-- Drop change rows superseded by a newer row for the same card.
+-- "Changes since rev N" stays correct: the newer row (higher rev) is still
+-- returned to any device that had not seen the dropped one, and the table
+-- never grows beyond one row per card ever registered.
+-- Run: Weekly
+
+DELETE c FROM rfid_reg_changes c
+JOIN rfid_reg_changes newer
+  ON newer.rfid_data = c.rfid_data
+ AND newer.rev > c.rev;
+
 -- ==================== CHECK TABLE SIZE ====================
 -- Monitor table sizes
 
@@ -0,0 +1,103 @@
+<?php
+// Exports rfid_logs as a binary tap trace for the host replay harness
+// (tools/replay_trace.cpp in the repository root):
+//   php tools/export_log_trace.php --out=taps.trace
+//   php tools/export_log_trace.php --out=week.trace --since="2025-03-01 00:00:00" --until="2025-03-08 00:00:00"
+//
+// Trace layout (little endian):
+//   'RTRC' | version u8 | reserved u8 | reserved u16 | count u32 | start_unix u32
+//   count x (delta_ms u32 | flags u8 | uid_len u8 | uid[10], zero padded)
+// delta_ms is the gap to the previous tap (0 for the first). flags bit 0 is
+// the recorded rfid_status and bit 1 is set when the card is in rfid_reg now.
+
+require_once __DIR__ . '/../config/database.php';
+require_once __DIR__ . '/../config/timezone.php';
+require_once __DIR__ . '/../config/registry_sync.php';
+
+define('TRACE_VERSION', 1);
+define('TRACE_FLAG_STATUS', 0x01);
+define('TRACE_FLAG_REGISTERED', 0x02);
+define('TRACE_HEADER_LEN', 16);
+
+$options = getopt('', ['out:', 'since::', 'until::', 'limit::']);
+
+if (empty($options['out'])) {
+    fwrite(STDERR, "Usage: php tools/export_log_trace.php --out=FILE [--since=DATETIME] [--until=DATETIME] [--limit=N]\n");
+    exit(1);
+}
+
+$limit = isset($options['limit']) ? max(1, (int) $options['limit']) : null;
+
+$pdo = getDBConnection();
+if (!$pdo) {
+    fwrite(STDERR, "Failed to connect to the database.\n");
+    exit(1);
+}
+
+// Months of logs: stream rows instead of buffering the whole result
+$pdo->setAttribute(PDO::MYSQL_ATTR_USE_BUFFERED_QUERY, false);
+
+$query = 'SELECT l.time_log, l.rfid_data, l.rfid_status, (r.id IS NOT NULL) AS registered
+          FROM rfid_logs l
+          LEFT JOIN rfid_reg r ON r.rfid_data = l.rfid_data
+          WHERE l.time_log >= :since AND l.time_log < :until
+          ORDER BY l.time_log, l.id';
+if ($limit !== null) {
+    $query .= ' LIMIT :limit';
+}
+
+$stmt = $pdo->prepare($query);
+$stmt->bindValue(':since', $options['since'] ?? '1970-01-01 00:00:00');
+$stmt->bindValue(':until', $options['until'] ?? '9999-12-31 23:59:59');
+if ($limit !== null) {
+    $stmt->bindValue(':limit', $limit, PDO::PARAM_INT);
+}
+$stmt->execute();
+
+$out = fopen($options['out'], 'wb');
+if (!$out) {
+    fwrite(STDERR, "Cannot open {$options['out']} for writing.\n");
+    exit(1);
+}
+
+// The header is rewritten with the real count and start time at the end
+fwrite($out, str_repeat("\0", TRACE_HEADER_LEN));
+
+$count = 0;
+$skipped = 0;
+$startUnix = 0;
+$previousMs = null;
+
+while ($row = $stmt->fetch()) {
+    $uid = registryUidBytes((string) $row['rfid_data']);
+    if ($uid === null) {
+        $skipped++;
+        continue;
+    }
+
+    try {
+        $time = new DateTimeImmutable($row['time_log'], manila_timezone());
+    } catch (Exception $e) {
+        $skipped++;
+        continue;
+    }
+
+    $timeMs = $time->getTimestamp() * 1000;
+    if ($previousMs === null) {
+        $startUnix = $time->getTimestamp();
+        $previousMs = $timeMs;
+    }
+    $deltaMs = min(max(0, $timeMs - $previousMs), 0xFFFFFFFF);
+    $previousMs = $timeMs;
+
+    $flags = ((int) $row['rfid_status'] ? TRACE_FLAG_STATUS : 0) | ((int) $row['registered'] ? TRACE_FLAG_REGISTERED : 0);
+    fwrite($out, pack('VCC', $deltaMs, $flags, strlen($uid)) . str_pad($uid, REGISTRY_MAX_UID_BYTES, "\0"));
+    $count++;
+}
+
+fseek($out, 0);
+fwrite($out, 'RTRC' . pack('CCvVV', TRACE_VERSION, 0, 0, $count, $startUnix));
+fclose($out);
+
+echo "Exported {$count} taps to {$options['out']}";
+echo $skipped > 0 ? " ({$skipped} rows with unreadable UIDs or times skipped)\n" : "\n";
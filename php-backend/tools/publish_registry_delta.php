@@ -0,0 +1,24 @@
+<?php
+// Publishes the registry delta for (since, latest] on the retained MQTT topic.
+// Spawned in the background by publishRegistryDelta() so API responses do not
+// wait on mosquitto_pub; can also be run by hand to re-seed the retained message:
+//   php tools/publish_registry_delta.php --since=0
+
+require_once __DIR__ . '/../config/database.php';
+require_once __DIR__ . '/../config/registry_sync.php';
+
+$options = getopt('', ['since::']);
+$since = isset($options['since']) ? max(0, (int) $options['since']) : 0;
+
+$pdo = getDBConnection();
+if (!$pdo) {
+    fwrite(STDERR, "Failed to connect to the database.\n");
+    exit(1);
+}
+
+if (!publishRegistryDeltaNow($pdo, $since)) {
+    fwrite(STDERR, "Registry delta since rev {$since} was not published.\n");
+    exit(1);
+}
+
+echo "Published registry delta since rev {$since}\n";
@@ -12,6 +12,9 @@
  * GND    --> GND
  * RST    --> GPIO 2 (D2)
  * 3.3V   --> 3.3V
+ *
+ * Further readers share SCK/MOSI/MISO (and may share RST), each with its own
+ * SDA pin and optionally its own IRQ pin; see scanner_lanes below.
  */
 
 #include <Arduino.h>
@@ -24,11 +27,41 @@
 #include <cstring>
 #include <esp_system.h>
 #include <esp_wifi.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/task.h>
+#include "mem_diag.h"
+#include "ota_update.h"
+#include "registry_sync.h"
+#include "relay_protocol.h"
+#include "rfid_readers.h"
+#include "runtime_config.h"
+#include "scan_logic.h"
+#include "tls_transport.h"
 
 // RFID Pin Configuration
 #define RST_PIN 2 // Reset pin
 #define SS_PIN 5  // SDA/SS pin
 
+// One lane per reader: each reader has its own chip-select (and optionally
+// IRQ, -1 = polled) and drives its own relay channel
+struct ScannerLane
+{
+  RfidReaderPins reader;
+  uint8_t relay_channel;
+};
+const ScannerLane scanner_lanes[] = {
+  {{SS_PIN, RST_PIN, -1}, 0},
+  // {{17, RST_PIN, 16}, 1}, // Second lane: SDA GPIO 17, IRQ GPIO 16, relay channel 1
+};
+constexpr uint8_t num_scanner_lanes = sizeof(scanner_lanes) / sizeof(scanner_lanes[0]);
+static_assert(num_scanner_lanes <= RFID_MAX_READERS, "too many RFID readers");
+
+// Compile-time defaults below seed the runtime configuration on first boot.
+// Afterwards the values stored in NVS win, and they can be changed live by a
+// retained JSON message on mqtt_config_topic, secrets on mqtt_secrets_topic
+// (see include/runtime_config.h).
+
 // WiFi Networks Configuration
 const char *wifi_networks[][2] = {
   {"Cloud Control Network", "ccv7network"},
@@ -41,79 +74,252 @@ const int num_networks = sizeof(wifi_networks) / sizeof(wifi_networks[0]);
 // Set this to your MQTT broker IP address (where Mosquitto is running)
 // Use your PC's IP: 192.168.43.17
 const char *mqtt_broker_ip = "192.168.43.17"; // Change this to your MQTT broker IP
-const int mqtt_port = 1883;
-const char *mqtt_topic = "RFID_LOGIN";
+const int mqtt_port = ENABLE_TLS ? 8883 : 1883;
 const char *mqtt_client_id = "ESP32_RFID_Scanner";
+const char *mqtt_registry_topic = "RFID_REG_DELTA"; // Retained binary registry deltas
+const char *mqtt_config_topic = "RFID_CONFIG/scanner"; // Retained runtime configuration
+const char *mqtt_secrets_topic = "RFID_CONFIG/scanner/secrets"; // Retained WiFi passwords and edge_token
+const char *mqtt_ota_topic_prefix = "RFID_OTA/scanner"; // Firmware manifest, chunks and status
 
 // PHP Backend Configuration
 // Set this to your PC's IP address (where Apache/PHP backend is running)
 const char *api_server_ip = "192.168.43.17"; // Change this to your PC's IP
-const uint16_t api_port = 81;
+const uint16_t api_port = ENABLE_TLS ? 443 : 81;
+const char *api_scheme = ENABLE_TLS ? "https" : "http";
 const char *api_path = "/php-backend/api/check_rfid.php";
+const char *api_registry_path = "/php-backend/api/get_registered_changes.php";
+
+// TLS Configuration (only used when built with -D ENABLE_TLS=1)
+// Mosquitto supports PSK suites (psk_file/psk_hint), which give the cheapest
+// reconnect; Apache needs a certificate, so the backend verifies against a CA.
+const TlsCredentials mqtt_tls = {
+  nullptr,      // CA certificate (PEM)
+  "esp32_rfid", // PSK identity
+  nullptr,      // PSK as hex string, e.g. "1a2b3c..."
+};
+const TlsCredentials api_tls = {
+  nullptr,      // CA certificate (PEM) of the Apache/XAMPP server
+  nullptr,
+  nullptr,
+};
+
+// OTA manifests must be signed with the matching private key (see README);
+// without a key every release is rejected
+const char *ota_signing_key = nullptr; // ECDSA P-256 public key (PEM)
 
 // Runtime tuning constants
 constexpr size_t RFID_UID_BUFFER_LEN = 32;
 constexpr size_t ENCODED_UID_BUFFER_LEN = RFID_UID_BUFFER_LEN * 3;
 constexpr size_t URL_BUFFER_LEN = 256;
-constexpr unsigned long SCAN_COOLDOWN_MS = 1500;
-constexpr unsigned long LOOP_IDLE_DELAY_MS = 5;
-constexpr unsigned long TELEMETRY_INTERVAL_MS = 60000;
-constexpr unsigned long MQTT_BACKOFF_MIN_MS = 1000;
-constexpr unsigned long MQTT_BACKOFF_MAX_MS = 10000;
+constexpr unsigned long DEFAULT_SCAN_COOLDOWN_MS = 1500;
+constexpr unsigned long DEFAULT_LOOP_IDLE_DELAY_MS = 5;
+constexpr unsigned long DEFAULT_TELEMETRY_INTERVAL_MS = 60000;
+constexpr unsigned long DEFAULT_MQTT_BACKOFF_MIN_MS = 1000;
+constexpr unsigned long DEFAULT_MQTT_BACKOFF_MAX_MS = 10000;
+constexpr unsigned long DEFAULT_HTTP_TIMEOUT_MS = 2000;
+constexpr unsigned long DEFAULT_UNLOCK_PULSE_MS = 0;     // 0 = latch relay until the next scan
+constexpr uint16_t DEFAULT_EDGE_PORT = 1883;            // Relay edge broker, used when edge_host is set
+constexpr unsigned long EDGE_RETRY_INTERVAL_MS = 10000;
+constexpr int32_t EDGE_TCP_CONNECT_TIMEOUT_MS = 250;    // The relay is on the LAN; fail fast
+constexpr uint16_t EDGE_SOCKET_TIMEOUT_S = 1;           // CONNACK wait
+constexpr uint16_t MQTT_BUFFER_SIZE = 1536;              // Room for full config updates, registry deltas and OTA chunks
+constexpr size_t REGISTRY_HTTP_BUFFER_LEN = 2048;
+constexpr unsigned int REGISTRY_HTTP_PAGE_LIMIT = 150;   // 150 x 12 B entries fit the buffer
+constexpr unsigned long REGISTRY_RETRY_INTERVAL_MS = 5000;
+constexpr size_t REGISTRY_EXPECTED_CARDS = 10000;        // Sizes the Bloom prefilter
+constexpr size_t CHECK_QUEUE_LEN = RFID_MAX_READERS;     // Room for one pending check per lane
+constexpr uint32_t CHECK_TASK_STACK = 8192;              // Same as loopTask, which ran the checks before
 
 // Initialize objects
-MFRC522 mfrc522(SS_PIN, RST_PIN);
-WiFiClient espClient;
-WiFiClient httpClient;
+RfidReaderManager rfid_readers;
+TransportClient espClient;
+TransportClient httpClient;         // Backend checks, owned by the check task
+TransportClient registryHttpClient; // Registry catch-up from loop()
 PubSubClient mqtt_client(espClient);
+WiFiClient edgeTransport; // LAN only, plain TCP
+PubSubClient edge_client(edgeTransport);
+RegistryCache registry_cache;
+RelaySequencer relay_sequencer;
+RelayAckTracker relay_ack_central[RFID_MAX_READERS]; // Per lane, commands sent to the central broker
+RelayAckTracker relay_ack_edge[RFID_MAX_READERS];    // Per lane, commands sent to the relay's edge broker
+char relay_status_topic[RELAY_STATUS_TOPIC_LEN] = {0}; // Wildcard over every relay channel
+WiFiClient otaHttpClient; // HTTP-pulled images are checked against the signed manifest
+OtaUpdater ota_updater;
+MemDiag mem_diag;
 
 // Variables
 unsigned long lastReconnectAttempt = 0;
-unsigned long mqttBackoffDelay = MQTT_BACKOFF_MIN_MS;
-unsigned long nextScanAllowed = 0;
+RuntimeConfig config;
+uint8_t pending_config_apply = 0;
+ConfigTrial config_trial;
+unsigned long mqttBackoffDelay = DEFAULT_MQTT_BACKOFF_MIN_MS;
 unsigned long lastTelemetryReport = 0;
 bool wifi_connected = false;
 IPAddress gateway_ip;
 IPAddress mqtt_broker;
 IPAddress api_server;
+IPAddress edge_broker;
 char gateway_host[16] = {0};
 bool gateway_ready = false;
 bool mqtt_broker_ready = false;
 bool api_server_ready = false;
+bool edge_broker_ready = false;
+unsigned long lastEdgeAttempt = 0;
+ConnectionStats mqtt_connection_stats = {};
+ConnectionStats api_connection_stats = {};
+bool registry_sync_pending = true; // Catch up over HTTP at boot and after gaps
+unsigned long nextRegistrySyncAttempt = 0;
+uint8_t registry_http_buffer[REGISTRY_HTTP_BUFFER_LEN];
+
+// Backend checks run on their own task, so a slow request never holds the
+// readers. Results come back to loop(), which owns the MQTT clients.
+struct CheckRequest
+{
+  char url[URL_BUFFER_LEN];
+  uint8_t lane;
+  unsigned long tap_ms;
+  int8_t local_status; // decision already published from the registry cache, -1 = none
+  uint32_t http_timeout_ms; // copied here, config belongs to loop()
+};
+struct CheckResult
+{
+  uint8_t lane;
+  unsigned long tap_ms;
+  int8_t local_status;
+  bool ok; // false when the request failed or the reply was unreadable
+  CheckResponse response;
+  // Request timing, recorded into api_connection_stats by loop()
+  bool requested; // false when HTTPClient could not even start
+  bool cold_connect;
+  bool answered; // the server sent an HTTP status
+  unsigned long elapsed_ms;
+};
+QueueHandle_t check_requests = nullptr;
+QueueHandle_t check_results = nullptr;
+TaskHandle_t check_task = nullptr;
+volatile bool check_client_reset = false; // Set by loop() when the backend changed
 
 // Function declarations
 void connectToWiFi();
 void connectToMQTT();
-bool readRFID(char *buffer, size_t bufferLen);
-void checkRFIDWithServer(const char *rfid_uid);
-void publishMQTT(const char *message);
-bool urlEncode(const char *input, char *output, size_t outputLen);
+void queueCheckWithServer(const char *rfid_uid, uint8_t lane, unsigned long tap_ms, int local_status);
+void checkTask(void *arg);
+bool runCheck(const CheckRequest &request, CheckResult &result);
+void handleCheckResults();
+void connectToEdge();
+bool publishMQTT(PubSubClient &client, const char *topic, const char *message, bool retained);
+void publishRelayCommand(int status, uint8_t lane, unsigned long tap_ms);
+void handleRelayStatus(const uint8_t *payload, size_t length);
 void updateNetworkTargets();
 void reportRuntimeStats(unsigned long now);
+void printRelayAckStats(const char *label, const RelayAckStats &ack);
+void printReaderStats();
+void mqttCallback(char *topic, byte *payload, unsigned int length);
+void handleRegistryDelta(const uint8_t *payload, size_t length, const char *source);
+void syncRegistryFromServer();
+void loadDefaultConfig(RuntimeConfig &cfg);
+void handleConfigUpdate(ConfigTopic topic, const uint8_t *payload, size_t length);
+void applyPendingConfig();
+void failConfigTrial();
 
 void setup()
 {
   Serial.begin(115200);
   Serial.println("\n\n=== ESP32 RFID Scanner Starting ===");
+
+  // Load configuration: compile-time defaults, then NVS overrides
+  if (configResetRequested(CONFIG_RESET_PIN, CONFIG_RESET_HOLD_MS))
+  {
+    Serial.println(clearRuntimeConfig() ? "Config: BOOT held, stored configuration cleared"
+                                        : "Config: BOOT held, but NVS could not be cleared");
+  }
+  loadDefaultConfig(config);
+  loadRuntimeConfig(config, CONFIG_SCANNER_SCHEMA);
+  printRuntimeConfig(config, CONFIG_SCANNER_SCHEMA);
+  config_trial.begin();
+  mqttBackoffDelay = config.mqtt_backoff_min_ms;
+
+  // Relay command sequence numbers continue from the last boot's epoch
+  relay_sequencer.begin();
+  snprintf(relay_status_topic, sizeof(relay_status_topic), "%s/+", RELAY_STATUS_TOPIC_PREFIX);
   
   // Initialize SPI bus with optimized settings
   SPI.begin();
   SPI.setFrequency(10000000); // 10MHz for MFRC522 (optimal)
   SPI.setDataMode(SPI_MODE0);
   
-  // Initialize MFRC522
-  mfrc522.PCD_Init();
-  delay(100);
-  mfrc522.PCD_DumpVersionToSerial();
-  Serial.println("RFID Reader initialized!");
+  // Initialize the MFRC522 readers, one per lane
+  RfidReaderPins reader_pins[RFID_MAX_READERS];
+  for (uint8_t i = 0; i < num_scanner_lanes; i++)
+  {
+    reader_pins[i] = scanner_lanes[i].reader;
+  }
+  const uint8_t readers_found = rfid_readers.begin(reader_pins, num_scanner_lanes);
+  for (uint8_t i = 0; i < rfid_readers.count(); i++)
+  {
+    Serial.print("RFID reader ");
+    Serial.print(i);
+    Serial.print(" (SS GPIO ");
+    Serial.print(scanner_lanes[i].reader.cs_pin);
+    Serial.print(scanner_lanes[i].reader.irq_pin >= 0 ? ", IRQ" : ", polled");
+    Serial.print("): ");
+    if (rfid_readers.present(i))
+    {
+      Serial.print("version 0x");
+      Serial.println(rfid_readers.version(i), HEX);
+    }
+    else
+    {
+      Serial.println("not responding");
+    }
+  }
+  Serial.print(readers_found);
+  Serial.println(" RFID reader(s) initialized!");
+
+#if ENABLE_TLS
+  configureTlsClient(espClient, mqtt_tls);
+  configureTlsClient(httpClient, api_tls);
+  configureTlsClient(registryHttpClient, api_tls);
+  Serial.println("TLS enabled for MQTT and backend connections");
+#endif
   
   // Connect to WiFi
   connectToWiFi();
+
+  if (!registry_cache.begin(REGISTRY_EXPECTED_CARDS))
+  {
+    Serial.println("Registry Bloom filter allocation failed; lookups go straight to the table");
+  }
+
+  // Same priority as loopTask; the check task mostly waits on the socket
+  check_requests = xQueueCreate(CHECK_QUEUE_LEN, sizeof(CheckRequest));
+  check_results = xQueueCreate(CHECK_QUEUE_LEN, sizeof(CheckResult));
+  if (check_requests == nullptr || check_results == nullptr ||
+      xTaskCreate(checkTask, "rfid_check", CHECK_TASK_STACK, nullptr, 1, &check_task) != pdPASS)
+  {
+    check_task = nullptr;
+    Serial.println("ERROR: check task could not be started; taps will not reach the backend");
+  }
+
+  // Setup MQTT
+  mqtt_client.setBufferSize(MQTT_BUFFER_SIZE);
+  mqtt_client.setCallback(mqttCallback);
+  edge_client.setCallback(mqttCallback);
+  edge_client.setSocketTimeout(EDGE_SOCKET_TIMEOUT_S);
+  ota_updater.begin(mqtt_client, mqtt_ota_topic_prefix, mqtt_client_id, ota_signing_key);
   
   // Configure WiFi power management for balanced performance
   WiFi.setSleep(WIFI_PS_MIN_MODEM); // Balanced: saves power but maintains responsiveness
   esp_wifi_set_ps(WIFI_PS_MIN_MODEM);
   Serial.println("WiFi power management: Balanced mode");
+
+  // Stack high-water marks for telemetry (tiT is the lwIP TCP/IP task)
+  mem_diag.watchTask("loopTask", nullptr);
+  mem_diag.watchTask("tiT");
+  if (check_task != nullptr)
+  {
+    mem_diag.watchTask("rfid_check", check_task);
+  }
   
   Serial.println("=== Setup Complete ===");
   Serial.println("Ready to scan RFID cards...\n");
@@ -142,7 +348,7 @@ void loop()
   if (mqtt_client.connected())
   {
     mqtt_client.loop();
-    mqttBackoffDelay = MQTT_BACKOFF_MIN_MS;
+    mqttBackoffDelay = config.mqtt_backoff_min_ms;
   }
   else if (wifi_connected)
   {
@@ -151,34 +357,110 @@ void loop()
       lastReconnectAttempt = now;
       connectToMQTT();
       unsigned long nextDelay = mqttBackoffDelay * 2;
-      mqttBackoffDelay = nextDelay > MQTT_BACKOFF_MAX_MS ? MQTT_BACKOFF_MAX_MS : nextDelay;
+      mqttBackoffDelay = nextDelay > config.mqtt_backoff_max_ms ? config.mqtt_backoff_max_ms : nextDelay;
     }
   }
 
-  // Check for RFID card without blocking delays
-  if (now >= nextScanAllowed && mfrc522.PICC_IsNewCardPresent() && mfrc522.PICC_ReadCardSerial())
+  // Direct LAN path to the relay; the central broker stays the fallback
+  if (edge_client.connected())
   {
-    char rfid_uid[RFID_UID_BUFFER_LEN] = {0};
-    
-    if (readRFID(rfid_uid, sizeof(rfid_uid)))
+    edge_client.loop();
+  }
+  else if (wifi_connected && edge_broker_ready && now - lastEdgeAttempt >= EDGE_RETRY_INTERVAL_MS)
+  {
+    lastEdgeAttempt = now;
+    connectToEdge();
+  }
+
+  // Re-apply network settings changed through the config topic
+  if (pending_config_apply)
+  {
+    applyPendingConfig();
+  }
+
+  // Count relay commands that were never acknowledged
+  for (uint8_t lane = 0; lane < num_scanner_lanes; lane++)
+  {
+    if (relay_ack_central[lane].poll(now, RELAY_ACK_TIMEOUT_MS))
+    {
+      Serial.print("Relay ack timed out for seq ");
+      Serial.println(relay_ack_central[lane].pendingSeq());
+    }
+    if (relay_ack_edge[lane].poll(now, RELAY_ACK_TIMEOUT_MS))
+    {
+      Serial.print("Relay ack timed out for seq ");
+      Serial.print(relay_ack_edge[lane].pendingSeq());
+      Serial.println(" (edge broker)");
+    }
+  }
+
+  // Watch for stalled firmware transfers, pull HTTP releases, reboot when installed
+  ota_updater.loop(otaHttpClient, now);
+
+  // Catch up on registry changes missed while offline (paged, one page per loop)
+  if (registry_sync_pending && wifi_connected && api_server_ready && now >= nextRegistrySyncAttempt)
+  {
+    nextRegistrySyncAttempt = now + REGISTRY_RETRY_INTERVAL_MS;
+    syncRegistryFromServer();
+  }
+
+  // Relay commands for checks that finished since the last pass
+  handleCheckResults();
+
+  // Give every reader a turn on the SPI bus; stops at the first card.
+  // The SPI read, UID formatting and local lookup must stay off the heap
+  // (checked in debug builds).
+  RfidScan scan;
+  char rfid_uid[RFID_UID_BUFFER_LEN] = {0};
+  bool uid_read = false;
+  bool cached = false;
+  uint8_t cached_status = 0;
+  mem_diag.beginNoAlloc();
+  const bool detected = rfid_readers.poll(scan);
+  if (detected)
+  {
+    uid_read = formatUid(scan.uid.uidByte, scan.uid.size, rfid_uid, sizeof(rfid_uid));
+    cached = uid_read && registry_cache.lookup(scan.uid.uidByte, scan.uid.size, cached_status);
+  }
+  mem_diag.endNoAlloc("scan path");
+
+  if (detected)
+  {
+    if (uid_read)
     {
       Serial.println("\n---------------------------------");
-      Serial.print("RFID Detected: ");
+      Serial.print("RFID Detected on reader ");
+      Serial.print(scan.reader);
+      Serial.print(": ");
       Serial.println(rfid_uid);
-      checkRFIDWithServer(rfid_uid);
+
+      Serial.print("Registry cache: ");
+      Serial.println(cached ? (cached_status ? "registered (status 1)" : "registered (status 0)") : "unknown card");
+
+      // Act on the cache right away; the backend still logs the tap and
+      // overrides the decision if it disagrees, or decides alone while the
+      // cache is catching up
+      const int local_status = localDecision(!registry_sync_pending, cached, cached_status);
+      if (local_status >= 0)
+      {
+        Serial.print("Local decision: status ");
+        Serial.println(local_status);
+        publishRelayCommand(local_status, scan.reader, scan.tap_ms);
+      }
+
+      queueCheckWithServer(rfid_uid, scan.reader, scan.tap_ms, local_status);
+      Serial.println("---------------------------------\n");
     }
     else
     {
       Serial.println("RFID buffer insufficient; skipping read");
     }
     
-    mfrc522.PICC_HaltA();
-    mfrc522.PCD_StopCrypto1();
-    nextScanAllowed = now + SCAN_COOLDOWN_MS;
+    rfid_readers.finishScan(scan, millis() + config.scan_cooldown_ms);
   }
 
   reportRuntimeStats(now);
-  delay(LOOP_IDLE_DELAY_MS);
+  delay(config.loop_idle_delay_ms);
 }
 
 void connectToWiFi()
@@ -191,12 +473,17 @@ void connectToWiFi()
   gateway_host[0] = '\0';
   
   // Try each configured network
-  for (int i = 0; i < num_networks; i++)
+  for (size_t i = 0; i < CONFIG_MAX_WIFI_NETWORKS; i++)
   {
+    if (config.wifi[i].ssid[0] == '\0')
+    {
+      continue;
+    }
+
     Serial.print("Attempting: ");
-    Serial.println(wifi_networks[i][0]);
+    Serial.println(config.wifi[i].ssid);
     
-    WiFi.begin(wifi_networks[i][0], wifi_networks[i][1]);
+    WiFi.begin(config.wifi[i].ssid, config.wifi[i].password);
     
     int attempts = 0;
     while (WiFi.status() != WL_CONNECTED && attempts < 20)
@@ -228,6 +515,7 @@ void connectToWiFi()
   
   Serial.println("Could not connect to any WiFi network!");
   wifi_connected = false;
+  failConfigTrial();
 }
 
 void connectToMQTT()
@@ -240,110 +528,115 @@ void connectToMQTT()
   if (!mqtt_broker_ready)
   {
     Serial.println("Skipping MQTT connect: MQTT broker IP not configured");
+    failConfigTrial();
     return;
   }
 
   Serial.print("Connecting to MQTT broker... ");
-  Serial.print(mqtt_broker_ip);
+  Serial.print(config.mqtt_broker_ip);
   Serial.print(":");
-  Serial.print(mqtt_port);
+  Serial.print(config.mqtt_port);
   Serial.print(" ... ");
 
-  if (mqtt_client.connect(mqtt_client_id))
-  {
-    Serial.println("Connected!");
-    mqttBackoffDelay = MQTT_BACKOFF_MIN_MS;
-  }
-  else
-  {
-    Serial.print("Failed, rc=");
-    Serial.println(mqtt_client.state());
-  }
-}
+  const unsigned long connectStart = millis();
+  const bool mqttConnected = mqtt_client.connect(mqtt_client_id);
+  recordConnection(mqtt_connection_stats, true, millis() - connectStart, mqttConnected);
 
-bool readRFID(char *buffer, size_t bufferLen)
-{
-  if (bufferLen == 0)
+  if (mqttConnected)
   {
-    return false;
-  }
+    Serial.print("Connected in ");
+    Serial.print(mqtt_connection_stats.cold_last_ms);
+    Serial.println(" ms");
+    mqttBackoffDelay = config.mqtt_backoff_min_ms;
+    if (config_trial.confirm())
+    {
+      Serial.print("Config: rev ");
+      Serial.print(config.revision);
+      Serial.println(" reached the broker, keeping it");
+    }
 
-  size_t offset = 0;
+    // The retained delta arrives right after subscribing
+    if (mqtt_client.subscribe(mqtt_registry_topic))
+    {
+      Serial.print("Subscribed to topic: ");
+      Serial.println(mqtt_registry_topic);
+    }
+    else
+    {
+      Serial.println("Registry subscription failed!");
+    }
 
-  for (byte i = 0; i < mfrc522.uid.size; i++)
-  {
-    if (i > 0)
+    if (mqtt_client.subscribe(mqtt_config_topic))
     {
-      if (offset + 1 >= bufferLen)
-      {
-        buffer[offset] = '\0';
-        return false;
-      }
-      buffer[offset++] = ':';
+      Serial.print("Subscribed to topic: ");
+      Serial.println(mqtt_config_topic);
+    }
+    else
+    {
+      Serial.println("Config subscription failed!");
     }
 
-    if (offset + 2 >= bufferLen)
+    if (mqtt_client.subscribe(mqtt_secrets_topic))
+    {
+      Serial.print("Subscribed to topic: ");
+      Serial.println(mqtt_secrets_topic);
+    }
+    else
     {
-      buffer[offset] = '\0';
-      return false;
+      Serial.println("Secrets subscription failed!");
     }
 
-    byte value = mfrc522.uid.uidByte[i];
-    snprintf(&buffer[offset], bufferLen - offset, "%02X", value);
-    offset += 2;
-  }
+    // The relay's retained status tells us what it applied last
+    if (mqtt_client.subscribe(relay_status_topic))
+    {
+      Serial.print("Subscribed to topic: ");
+      Serial.println(relay_status_topic);
+    }
+    else
+    {
+      Serial.println("Relay status subscription failed!");
+    }
 
-  buffer[offset] = '\0';
-  return true;
+    // Reaching the broker proves a freshly installed image works
+    ota_updater.markRunningAppValid();
+    ota_updater.subscribe();
+  }
+  else
+  {
+    Serial.print("Failed, rc=");
+    Serial.println(mqtt_client.state());
+    failConfigTrial();
+  }
 }
 
-bool urlEncode(const char *input, char *output, size_t outputLen)
+void connectToEdge()
 {
-  if (!input || !output || outputLen == 0)
+  Serial.print("Connecting to edge broker... ");
+  Serial.print(config.edge_host);
+  Serial.print(":");
+  Serial.print(config.edge_port);
+  Serial.print(" ... ");
+
+  // Open the socket with a short timeout first; PubSubClient reuses it
+  // instead of blocking loop() for the core's default connect timeout
+  if (!edgeTransport.connect(edge_broker, config.edge_port, EDGE_TCP_CONNECT_TIMEOUT_MS))
   {
-    return false;
+    Serial.println("Failed, no answer");
+    return;
   }
-
-  const char *hex = "0123456789ABCDEF";
-  size_t outIndex = 0;
-
-  for (size_t i = 0; input[i] != '\0'; i++)
+  if (!edge_client.connect(mqtt_client_id, mqtt_client_id, config.edge_token))
   {
-    const char c = input[i];
-    const bool is_unreserved =
-      (c >= 'A' && c <= 'Z') ||
-      (c >= 'a' && c <= 'z') ||
-      (c >= '0' && c <= '9') ||
-      c == '-' || c == '_' || c == '.' || c == '~';
-
-    if (is_unreserved)
-    {
-      if (outIndex + 1 >= outputLen)
-      {
-        return false;
-      }
-      output[outIndex++] = c;
-    }
-    else
-    {
-      if (outIndex + 3 >= outputLen)
-      {
-        return false;
-      }
-      uint8_t byteVal = static_cast<uint8_t>(c);
-      output[outIndex++] = '%';
-      output[outIndex++] = hex[(byteVal >> 4) & 0x0F];
-      output[outIndex++] = hex[byteVal & 0x0F];
-    }
+    Serial.print("Failed, rc=");
+    Serial.println(edge_client.state());
+    edgeTransport.stop();
+    return;
   }
 
-  if (outIndex >= outputLen)
+  Serial.println("Connected");
+  if (!edge_client.subscribe(relay_status_topic))
   {
-    return false;
+    Serial.println("Edge relay status subscription failed!");
   }
-
-  output[outIndex] = '\0';
-  return true;
 }
 
 void updateNetworkTargets()
@@ -373,43 +666,70 @@ void updateNetworkTargets()
   Serial.println(gateway_host);
 
   // Parse MQTT broker IP from string
-  if (mqtt_broker.fromString(mqtt_broker_ip))
+  if (mqtt_broker.fromString(config.mqtt_broker_ip))
   {
     mqtt_broker_ready = true;
-    mqtt_client.setServer(mqtt_broker, mqtt_port);
+    mqtt_client.setServer(mqtt_broker, config.mqtt_port);
     Serial.print("Configured MQTT broker: ");
-    Serial.print(mqtt_broker_ip);
+    Serial.print(config.mqtt_broker_ip);
   Serial.print(":");
-  Serial.println(mqtt_port);
+  Serial.println(config.mqtt_port);
   }
   else
   {
     mqtt_broker_ready = false;
     Serial.print("ERROR: Failed to parse MQTT broker IP: ");
-    Serial.println(mqtt_broker_ip);
+    Serial.println(config.mqtt_broker_ip);
   }
 
   // Parse API server IP from string
-  if (api_server.fromString(api_server_ip))
+  if (api_server.fromString(config.api_server_ip))
   {
     api_server_ready = true;
     Serial.print("Configured API server: ");
-    Serial.print(api_server_ip);
+    Serial.print(config.api_server_ip);
   Serial.print(":");
-  Serial.print(api_port);
+  Serial.print(config.api_port);
   Serial.println(api_path);
 }
   else
   {
     api_server_ready = false;
     Serial.print("ERROR: Failed to parse API server IP: ");
-    Serial.println(api_server_ip);
+    Serial.println(config.api_server_ip);
+  }
+
+  // Edge broker on the relay is optional; an empty host keeps the central path
+  edge_broker_ready = false;
+  if (config.edge_host[0] == '\0')
+  {
+    return;
+  }
+  if (config.edge_token[0] == '\0')
+  {
+    Serial.println("Edge broker not used: edge_token is not set");
+    return;
+  }
+  if (edge_broker.fromString(config.edge_host))
+  {
+    edge_broker_ready = true;
+    edge_client.setServer(edge_broker, config.edge_port);
+    lastEdgeAttempt = millis() - EDGE_RETRY_INTERVAL_MS;
+    Serial.print("Configured edge broker: ");
+    Serial.print(config.edge_host);
+    Serial.print(":");
+    Serial.println(config.edge_port);
+  }
+  else
+  {
+    Serial.print("ERROR: Failed to parse edge broker IP: ");
+    Serial.println(config.edge_host);
   }
 }
 
 void reportRuntimeStats(unsigned long now)
 {
-  if (now - lastTelemetryReport < TELEMETRY_INTERVAL_MS)
+  if (now - lastTelemetryReport < config.telemetry_interval_ms)
   {
     return;
   }
@@ -417,9 +737,7 @@ void reportRuntimeStats(unsigned long now)
   lastTelemetryReport = now;
 
   Serial.println("\n--- Runtime Telemetry ---");
-  Serial.print("Free Heap: ");
-  Serial.print(ESP.getFreeHeap());
-  Serial.println(" bytes");
+  mem_diag.print();
 
   Serial.print("WiFi RSSI: ");
   if (wifi_connected)
@@ -434,10 +752,116 @@ void reportRuntimeStats(unsigned long now)
 
   Serial.print("MQTT Connected: ");
   Serial.println(mqtt_client.connected() ? "Yes" : "No");
+  printConnectionStats("MQTT connect", mqtt_connection_stats);
+  printHandshakeStats("MQTT", espClient, mqtt_tls);
+  printConnectionStats("API request", api_connection_stats);
+  printHandshakeStats("API", httpClient, api_tls);
+
+  Serial.print("Edge broker connected: ");
+  Serial.println(edge_client.connected() ? "Yes" : (edge_broker_ready ? "No" : "Not configured"));
+  for (uint8_t lane = 0; lane < num_scanner_lanes; lane++)
+  {
+    char label[40];
+    snprintf(label, sizeof(label), "Lane %u relay acks (central)", lane);
+    printRelayAckStats(label, relay_ack_central[lane].stats());
+    snprintf(label, sizeof(label), "Lane %u relay acks (edge)", lane);
+    printRelayAckStats(label, relay_ack_edge[lane].stats());
+  }
+  printReaderStats();
+
+  Serial.print("Registry: rev ");
+  Serial.print(registry_cache.revision());
+  Serial.print(", ");
+  Serial.print(registry_cache.size());
+  Serial.println(registry_sync_pending ? " cards (sync pending)" : " cards");
+
+  const UidSetUsage registry_usage = registry_cache.usage();
+  Serial.print("Registry memory: ");
+  Serial.print(registry_usage.data_bytes + registry_usage.index_bytes + registry_usage.status_bytes);
+  Serial.print(" bytes table + ");
+  Serial.print(registry_usage.bloom_bytes);
+  Serial.print(registry_usage.bloom_internal ? " bytes Bloom filter (internal RAM), " : " bytes Bloom filter (PSRAM), ");
+  Serial.print(registry_usage.bloom_pass_rate * 100.0f, 1);
+  Serial.println("% of unknown cards reach the table");
   Serial.println("-------------------------");
 }
 
-void checkRFIDWithServer(const char *rfid_uid)
+void printRelayAckStats(const char *label, const RelayAckStats &ack)
+{
+  Serial.print(label);
+  Serial.print(": ");
+  Serial.print(ack.acked);
+  Serial.print("/");
+  Serial.print(ack.sent);
+  Serial.print(" acked, ");
+  Serial.print(ack.timed_out);
+  Serial.print(" timed out, ");
+  Serial.print(ack.superseded);
+  Serial.print(" superseded, ");
+  Serial.print(ack.mismatched);
+  Serial.print(" pin mismatches");
+  if (ack.acked > 0)
+  {
+    Serial.print(", publish->ack avg ");
+    Serial.print(ack.total_ms / ack.acked);
+    Serial.print(" ms, max ");
+    Serial.print(ack.max_ms);
+    Serial.print(" ms, tap->ack avg ");
+    Serial.print(ack.tap_total_ms / ack.acked);
+    Serial.print(" ms, max ");
+    Serial.print(ack.tap_max_ms);
+    Serial.print(" ms");
+  }
+  Serial.println();
+}
+
+void printReaderStats()
+{
+  Serial.print("RFID readers: fairness ");
+  Serial.println(rfid_readers.fairness(), 3);
+  for (uint8_t i = 0; i < rfid_readers.count(); i++)
+  {
+    if (!rfid_readers.present(i))
+    {
+      continue;
+    }
+    const RfidReaderStats &stats = rfid_readers.stats(i);
+    Serial.print("  Reader ");
+    Serial.print(i);
+    Serial.print(": ");
+    Serial.print(stats.turns);
+    Serial.print(" turns, ");
+    Serial.print(stats.scans);
+    Serial.print(" scans, bus ");
+    Serial.print(static_cast<uint32_t>(stats.busy_us / 1000));
+    Serial.print(" ms");
+    if (rfid_readers.pins(i).irq_pin >= 0)
+    {
+      Serial.print(", ");
+      Serial.print(stats.irq_wakeups);
+      Serial.print(" IRQ wakeups");
+    }
+    else
+    {
+      Serial.print(", max gap ");
+      Serial.print(stats.max_gap_us / 1000);
+      Serial.print(" ms");
+    }
+    if (stats.scans > 0)
+    {
+      Serial.print(", detect avg ");
+      Serial.print(static_cast<uint32_t>(stats.detect_total_us / stats.scans / 1000));
+      Serial.print(" ms, max ");
+      Serial.print(stats.detect_max_us / 1000);
+      Serial.print(" ms");
+    }
+    Serial.println();
+  }
+}
+
+// Builds the check URL and hands it to the check task. Without the backend
+// the local decision (if any) stands.
+void queueCheckWithServer(const char *rfid_uid, uint8_t lane, unsigned long tap_ms, int local_status)
 {
   if (!wifi_connected)
   {
@@ -450,11 +874,12 @@ void checkRFIDWithServer(const char *rfid_uid)
     Serial.println("Cannot check RFID: API server IP not configured");
     return;
   }
-  
-  HTTPClient http;
-  http.setTimeout(2000);
-  http.setConnectTimeout(2000);
-  http.setReuse(true); // Connection pooling
+
+  if (check_task == nullptr)
+  {
+    Serial.println("Cannot check RFID: check task not running");
+    return;
+  }
 
   char encoded_rfid[ENCODED_UID_BUFFER_LEN] = {0};
   if (!urlEncode(rfid_uid, encoded_rfid, sizeof(encoded_rfid)))
@@ -463,7 +888,11 @@ void checkRFIDWithServer(const char *rfid_uid)
     return;
   }
 
-  char url[URL_BUFFER_LEN] = {0};
+  CheckRequest request = {};
+  request.lane = lane;
+  request.tap_ms = tap_ms;
+  request.local_status = static_cast<int8_t>(local_status);
+  request.http_timeout_ms = config.http_timeout_ms;
   char api_host[16] = {0};
   snprintf(
       api_host,
@@ -475,31 +904,86 @@ void checkRFIDWithServer(const char *rfid_uid)
       api_server[3]);
   
   int written = snprintf(
-    url,
-    sizeof(url),
-    "http://%s:%u%s?rfid_data=%s",
+    request.url,
+    sizeof(request.url),
+    "%s://%s:%u%s?rfid_data=%s",
+    api_scheme,
       api_host,
-    api_port,
+    config.api_port,
     api_path,
       encoded_rfid);
 
-  if (written <= 0 || static_cast<size_t>(written) >= sizeof(url))
+  if (written <= 0 || static_cast<size_t>(written) >= sizeof(request.url))
   {
     Serial.println("URL buffer overflow; request skipped");
     return;
   }
+
+  if (xQueueSend(check_requests, &request, 0) != pdTRUE)
+  {
+    Serial.println("Check queue full; tap not sent to the server");
+  }
+}
+
+void checkTask(void *arg)
+{
+  (void)arg;
+  CheckRequest request;
+  CheckResult result;
+  for (;;)
+  {
+    if (xQueueReceive(check_requests, &request, portMAX_DELAY) != pdTRUE)
+    {
+      continue;
+    }
+
+    // Drop the kept-alive socket so the request goes to the new backend
+    if (check_client_reset)
+    {
+      check_client_reset = false;
+      httpClient.stop();
+    }
+
+    result.lane = request.lane;
+    result.tap_ms = request.tap_ms;
+    result.local_status = request.local_status;
+    result.ok = runCheck(request, result);
+    xQueueSend(check_results, &result, portMAX_DELAY);
+  }
+}
+
+// Runs on the check task, so it only uses what the request carries and
+// leaves config and the connection stats to loop()
+bool runCheck(const CheckRequest &request, CheckResult &result)
+{
+  HTTPClient http;
+  http.setTimeout(request.http_timeout_ms);
+  http.setConnectTimeout(request.http_timeout_ms);
+  http.setReuse(true); // Connection pooling
+  result.requested = false;
+  result.cold_connect = false;
+  result.answered = false;
+  result.elapsed_ms = 0;
   
   Serial.print("Checking with server: ");
-  Serial.println(url);
+  Serial.println(request.url);
   
-  if (!http.begin(httpClient, url))
+  if (!http.begin(httpClient, request.url))
   {
     Serial.println("HTTP begin failed");
-    return;
+    return false;
   }
   
+  // HTTPClient reuses httpClient when it is still connected, so only the
+  // first request after a drop pays for the TCP connect and TLS handshake
+  result.requested = true;
+  result.cold_connect = !httpClient.connected();
+  const unsigned long requestStart = millis();
   int httpCode = http.GET();
+  result.elapsed_ms = millis() - requestStart;
+  result.answered = httpCode > 0;
   
+  bool parsed = false;
   if (httpCode > 0)
   {
     Serial.print("HTTP Response Code: ");
@@ -519,36 +1003,12 @@ void checkRFIDWithServer(const char *rfid_uid)
         Serial.print("Response: ");
         Serial.println(response_buffer);
         
-        // Use StaticJsonDocument for pre-allocated memory
-        // Note: StaticJsonDocument is deprecated in ArduinoJson v7, but JsonDocument
-        // is not a template in v7.4.2, so we suppress the warning
-        #pragma GCC diagnostic push
-        #pragma GCC diagnostic ignored "-Wdeprecated-declarations"
-        StaticJsonDocument<256> doc;
-        #pragma GCC diagnostic pop
-        DeserializationError error = deserializeJson(doc, response_buffer);
-        
-        if (!error)
-        {
-          int status = doc["status"];
-          bool found = doc["found"];
-          const char *message = doc["message"];
-          
-          Serial.print("Status: ");
-          Serial.println(status);
-          Serial.print("Found: ");
-          Serial.println(found ? "Yes" : "No");
-          Serial.print("Message: ");
-          Serial.println(message);
-          
-          char mqtt_message[8] = {0};
-          snprintf(mqtt_message, sizeof(mqtt_message), "%d", status);
-          publishMQTT(mqtt_message);
-        }
-        else
+        const char *error = nullptr;
+        parsed = parseCheckResponse(response_buffer, bytesRead, result.response, &error);
+        if (!parsed)
         {
           Serial.print("JSON Parse Error: ");
-          Serial.println(error.c_str());
+          Serial.println(error);
         }
       }
       else
@@ -564,30 +1024,405 @@ void checkRFIDWithServer(const char *rfid_uid)
   }
   
   http.end();
-  Serial.println("---------------------------------\n");
+  return parsed;
 }
 
-void publishMQTT(const char *message)
+void handleCheckResults()
 {
-  if (mqtt_client.connected())
+  CheckResult result;
+  while (check_results != nullptr && xQueueReceive(check_results, &result, 0) == pdTRUE)
+  {
+    if (result.requested)
+    {
+      recordConnection(api_connection_stats, result.cold_connect, result.elapsed_ms, result.answered);
+    }
+
+    if (!result.ok)
+    {
+      if (result.local_status >= 0)
+      {
+        Serial.print("Backend check failed; lane ");
+        Serial.print(result.lane);
+        Serial.println(" keeps the local decision");
+      }
+      continue;
+    }
+
+    Serial.println("\n---------------------------------");
+    Serial.print("Check result for lane ");
+    Serial.println(result.lane);
+    Serial.print("Status: ");
+    Serial.println(result.response.status);
+    Serial.print("Found: ");
+    Serial.println(result.response.found ? "Yes" : "No");
+    Serial.print("Message: ");
+    Serial.println(result.response.message);
+
+    if (result.response.status == result.local_status)
+    {
+      Serial.println("Matches the local decision; nothing to send");
+    }
+    else
+    {
+      if (result.local_status >= 0)
+      {
+        Serial.println("Overrides the local decision (registry cache was behind)");
+      }
+      publishRelayCommand(result.response.status, result.lane, result.tap_ms);
+    }
+    Serial.println("---------------------------------\n");
+  }
+}
+
+// Commands (see planRelayCommands) go straight to the relay's edge broker
+// when connected (it bridges them upstream) and to the central broker
+// otherwise.
+void publishRelayCommand(int status, uint8_t lane, unsigned long tap_ms)
+{
+  const bool via_edge = edge_client.connected();
+  PubSubClient &client = via_edge ? edge_client : mqtt_client;
+
+  RelayPlan plan = planRelayCommands(status, scanner_lanes[lane].relay_channel, config.unlock_pulse_ms);
+  char topic[RELAY_COMMAND_TOPIC_LEN] = {0};
+  formatRelayCommandTopic(topic, sizeof(topic), scanner_lanes[lane].relay_channel);
+  const RelayCommand *last = nullptr;
+  for (uint8_t i = 0; i < plan.count; i++)
   {
-    // Enable message retention so new clients get last state immediately
-    bool published = mqtt_client.publish(mqtt_topic, message, true);
+    RelayCommand &cmd = plan.commands[i];
+    cmd.seq = relay_sequencer.next();
+
+    char message[RELAY_COMMAND_MESSAGE_LEN] = {0};
+    formatRelayCommand(message, sizeof(message), cmd);
+    if (!publishMQTT(client, topic, message, plan.retained[i]))
+    {
+      break;
+    }
+    last = &cmd;
+  }
+
+  // The relay acknowledges on its status topic; a pulse reads back ON, or
+  // OFF once it has already relocked
+  if (last == plan.commands + plan.count - 1)
+  {
+    RelayAckTracker &ack = via_edge ? relay_ack_edge[lane] : relay_ack_central[lane];
+    ack.expect(last->seq, last->state, millis(), tap_ms, last->type == RelayCommandType::Pulse);
+  }
+}
+
+void handleRelayStatus(const uint8_t *payload, size_t length)
+{
+  RelayStatus status;
+  if (!parseRelayStatus(payload, length, status))
+  {
+    Serial.println("Relay status: unreadable payload");
+    return;
+  }
+
+  if (status.has_seq)
+  {
+    relay_sequencer.observe(status.seq);
+  }
+
+  // The status arrives on both brokers; whichever comes first acknowledges
+  const unsigned long now = millis();
+  for (uint8_t lane = 0; lane < num_scanner_lanes; lane++)
+  {
+    if (scanner_lanes[lane].relay_channel != status.channel)
+    {
+      continue;
+    }
+
+    RelayAckTracker *ack = nullptr;
+    if (relay_ack_edge[lane].onStatus(status, now))
+    {
+      ack = &relay_ack_edge[lane];
+    }
+    else if (relay_ack_central[lane].onStatus(status, now))
+    {
+      ack = &relay_ack_central[lane];
+    }
+    if (ack == nullptr)
+    {
+      continue;
+    }
+
+    Serial.print("Relay ack: lane ");
+    Serial.print(lane);
+    Serial.print(", seq ");
+    Serial.print(status.seq);
+    Serial.print(status.gpio ? ", pin ON" : ", pin OFF");
+    Serial.print(" after ");
+    Serial.print(ack->stats().last_ms);
+    Serial.print(" ms (");
+    Serial.print(ack->stats().tap_last_ms);
+    Serial.print(" ms from tap, ");
+    Serial.print(ack == &relay_ack_edge[lane] ? "edge" : "central");
+    Serial.println(")");
+  }
+}
+
+bool publishMQTT(PubSubClient &client, const char *topic, const char *message, bool retained)
+{
+  const char *label = &client == &edge_client ? "Edge" : "MQTT";
+  if (client.connected())
+  {
+    // Retained state lets the relay restore each channel's last decision after a restart
+    bool published = client.publish(topic, message, retained);
     
     if (published)
     {
-      Serial.print("MQTT Published (retained): ");
-      Serial.print(mqtt_topic);
+      Serial.print(label);
+      Serial.print(retained ? " Published (retained): " : " Published: ");
+      Serial.print(topic);
       Serial.print(" -> ");
       Serial.println(message);
     }
     else
     {
-      Serial.println("MQTT Publish Failed!");
+      Serial.print(label);
+      Serial.println(" Publish Failed!");
     }
+    return published;
+  }
+
+  Serial.print("Cannot publish: ");
+  Serial.print(label);
+  Serial.println(" not connected");
+  return false;
+}
+
+void mqttCallback(char *topic, byte *payload, unsigned int length)
+{
+  if (strcmp(topic, mqtt_registry_topic) == 0)
+  {
+    handleRegistryDelta(payload, length, "MQTT");
+  }
+  else if (strcmp(topic, mqtt_config_topic) == 0)
+  {
+    handleConfigUpdate(ConfigTopic::Settings, payload, length);
+  }
+  else if (strcmp(topic, mqtt_secrets_topic) == 0)
+  {
+    handleConfigUpdate(ConfigTopic::Secrets, payload, length);
+  }
+  else if (strncmp(topic, RELAY_STATUS_TOPIC_PREFIX, strlen(RELAY_STATUS_TOPIC_PREFIX)) == 0 &&
+           topic[strlen(RELAY_STATUS_TOPIC_PREFIX)] == '/')
+  {
+    handleRelayStatus(payload, length);
   }
   else
   {
-    Serial.println("Cannot publish: MQTT not connected");
+    ota_updater.handleMessage(topic, payload, length);
+  }
+}
+
+void handleRegistryDelta(const uint8_t *payload, size_t length, const char *source)
+{
+  const DeltaResult result = registry_cache.applyDelta(payload, length);
+
+  Serial.print("Registry delta (");
+  Serial.print(source);
+  Serial.print(", ");
+  Serial.print(length);
+  Serial.print(" bytes): ");
+  Serial.print(deltaResultName(result));
+  Serial.print(" -> rev ");
+  Serial.println(registry_cache.revision());
+
+  switch (result)
+  {
+  case DeltaResult::Applied:
+    registry_sync_pending = registry_cache.hasMore();
+    break;
+  case DeltaResult::Stale:
+    // Catch-up returned nothing newer (e.g. an empty change log): we are current
+    if (strcmp(source, "HTTP") == 0)
+    {
+      registry_sync_pending = false;
+    }
+    break;
+  case DeltaResult::Gap:
+  case DeltaResult::Malformed:
+    registry_sync_pending = true;
+    break;
+  case DeltaResult::Overflow:
+    // Retrying cannot succeed until memory is freed; keep the current table
+    registry_sync_pending = false;
+    Serial.println("Registry cache out of memory; keeping previous revision");
+    break;
   }
 }
+
+void syncRegistryFromServer()
+{
+  char api_host[16] = {0};
+  snprintf(api_host, sizeof(api_host), "%u.%u.%u.%u", api_server[0], api_server[1], api_server[2], api_server[3]);
+
+  char url[URL_BUFFER_LEN] = {0};
+  int written = snprintf(
+    url,
+    sizeof(url),
+    "%s://%s:%u%s?since=%lu&limit=%u&format=binary",
+    api_scheme,
+    api_host,
+    config.api_port,
+    api_registry_path,
+    static_cast<unsigned long>(registry_cache.revision()),
+    REGISTRY_HTTP_PAGE_LIMIT);
+
+  if (written <= 0 || static_cast<size_t>(written) >= sizeof(url))
+  {
+    Serial.println("Registry URL buffer overflow; sync skipped");
+    return;
+  }
+
+  HTTPClient http;
+  http.setTimeout(config.http_timeout_ms);
+  http.setConnectTimeout(config.http_timeout_ms);
+  http.setReuse(true);
+
+  if (!http.begin(registryHttpClient, url))
+  {
+    Serial.println("Registry sync: HTTP begin failed");
+    return;
+  }
+
+  int httpCode = http.GET();
+  if (httpCode == HTTP_CODE_OK)
+  {
+    int len = http.getSize();
+    if (len > 0 && len <= static_cast<int>(sizeof(registry_http_buffer)))
+    {
+      size_t bytesRead = http.getStream().readBytes(registry_http_buffer, len);
+      handleRegistryDelta(registry_http_buffer, bytesRead, "HTTP");
+    }
+    else
+    {
+      Serial.println("Registry sync: response too large or invalid size");
+    }
+  }
+  else
+  {
+    Serial.print("Registry sync failed: ");
+    if (httpCode > 0)
+    {
+      Serial.println(httpCode);
+    }
+    else
+    {
+      Serial.println(http.errorToString(httpCode));
+    }
+  }
+
+  http.end();
+}
+
+void loadDefaultConfig(RuntimeConfig &cfg)
+{
+  memset(&cfg, 0, sizeof(cfg));
+  for (int i = 0; i < num_networks && i < static_cast<int>(CONFIG_MAX_WIFI_NETWORKS); i++)
+  {
+    strncpy(cfg.wifi[i].ssid, wifi_networks[i][0], sizeof(cfg.wifi[i].ssid) - 1);
+    strncpy(cfg.wifi[i].password, wifi_networks[i][1], sizeof(cfg.wifi[i].password) - 1);
+  }
+  strncpy(cfg.mqtt_broker_ip, mqtt_broker_ip, sizeof(cfg.mqtt_broker_ip) - 1);
+  cfg.mqtt_port = mqtt_port;
+  strncpy(cfg.api_server_ip, api_server_ip, sizeof(cfg.api_server_ip) - 1);
+  cfg.api_port = api_port;
+  cfg.scan_cooldown_ms = DEFAULT_SCAN_COOLDOWN_MS;
+  cfg.http_timeout_ms = DEFAULT_HTTP_TIMEOUT_MS;
+  cfg.unlock_pulse_ms = DEFAULT_UNLOCK_PULSE_MS;
+  cfg.edge_port = DEFAULT_EDGE_PORT;
+  cfg.loop_idle_delay_ms = DEFAULT_LOOP_IDLE_DELAY_MS;
+  cfg.telemetry_interval_ms = DEFAULT_TELEMETRY_INTERVAL_MS;
+  cfg.mqtt_backoff_min_ms = DEFAULT_MQTT_BACKOFF_MIN_MS;
+  cfg.mqtt_backoff_max_ms = DEFAULT_MQTT_BACKOFF_MAX_MS;
+}
+
+void handleConfigUpdate(ConfigTopic topic, const uint8_t *payload, size_t length)
+{
+  uint8_t apply_flags = 0;
+  const ConfigUpdateResult result =
+      applyConfigUpdate(config, CONFIG_SCANNER_SCHEMA, topic, payload, length, apply_flags);
+
+  switch (result)
+  {
+  case ConfigUpdateResult::Applied:
+  case ConfigUpdateResult::NotPersisted:
+    Serial.print(topic == ConfigTopic::Secrets ? "Secrets updated to rev " : "Config updated to rev ");
+    Serial.println(topic == ConfigTopic::Secrets ? config.secrets_revision : config.revision);
+    if (result == ConfigUpdateResult::NotPersisted)
+    {
+      Serial.println("WARNING: config could not be written to NVS; it will not survive a reboot");
+    }
+    printRuntimeConfig(config, CONFIG_SCANNER_SCHEMA);
+    if (apply_flags & CONFIG_APPLY_TRIAL)
+    {
+      config_trial.start();
+    }
+    // Reconnects happen from loop(), not from inside the MQTT callback
+    pending_config_apply |= apply_flags;
+    break;
+  case ConfigUpdateResult::Stale:
+    break;
+  case ConfigUpdateResult::Invalid:
+    Serial.println("Config update rejected; keeping current configuration");
+    break;
+  }
+}
+
+void applyPendingConfig()
+{
+  const uint8_t apply = pending_config_apply;
+  pending_config_apply = 0;
+
+  if (apply & CONFIG_APPLY_WIFI)
+  {
+    Serial.println("Config: WiFi settings changed, reconnecting");
+    mqtt_client.disconnect();
+    edge_client.disconnect();
+    check_client_reset = true;
+    registryHttpClient.stop();
+    wifi_connected = false;
+    connectToWiFi();
+    return;
+  }
+
+  if (apply & (CONFIG_APPLY_MQTT | CONFIG_APPLY_API | CONFIG_APPLY_EDGE))
+  {
+    updateNetworkTargets();
+  }
+  if (apply & CONFIG_APPLY_API)
+  {
+    // Drop the kept-alive sockets so the next requests go to the new backend
+    check_client_reset = true;
+    registryHttpClient.stop();
+  }
+  if (apply & CONFIG_APPLY_MQTT)
+  {
+    Serial.println("Config: MQTT broker changed, reconnecting");
+    mqtt_client.disconnect();
+    lastReconnectAttempt = 0;
+    mqttBackoffDelay = config.mqtt_backoff_min_ms;
+  }
+  if (apply & CONFIG_APPLY_EDGE)
+  {
+    // Commands fall back to the central broker until the new target connects
+    Serial.println("Config: edge broker changed, reconnecting");
+    edge_client.disconnect();
+  }
+}
+
+// Called for every failed WiFi round or MQTT connect while new network
+// settings are on trial
+void failConfigTrial()
+{
+  if (!config_trial.fail(config, CONFIG_SCANNER_SCHEMA))
+  {
+    return;
+  }
+
+  Serial.println("Config: new network settings never reached the broker, rolled back");
+  printRuntimeConfig(config, CONFIG_SCANNER_SCHEMA);
+  pending_config_apply = CONFIG_APPLY_WIFI | CONFIG_APPLY_MQTT | CONFIG_APPLY_API | CONFIG_APPLY_EDGE;
+}
@@ -25,11 +25,35 @@
 #include <WiFi.h>
 #include <PubSubClient.h>
 #include <esp_system.h>
+#include <esp_timer.h>
 #include <esp_wifi.h>
+#include "edge_broker.h"
+#include "mem_diag.h"
+#include "ota_update.h"
+#include "relay_scheduler.h"
+#include "runtime_config.h"
+#include "tls_transport.h"
 
 // Relay Pin Configuration
 #define RELAY_PIN 26
 
+// Channel N of a relay command drives relay_channels[N]
+struct RelayChannelPin {
+  uint8_t pin;
+  bool active_high;  // false for modules that switch on LOW
+};
+const RelayChannelPin relay_channels[] = {
+  {RELAY_PIN, true},
+  // Add more relays here if needed
+  // {27, true},
+};
+const uint8_t num_relay_channels = sizeof(relay_channels) / sizeof(relay_channels[0]);
+
+// Compile-time defaults below seed the runtime configuration on first boot.
+// Afterwards the values stored in NVS win, and they can be changed live by a
+// retained JSON message on mqtt_config_topic, secrets on mqtt_secrets_topic
+// (see include/runtime_config.h).
+
 // WiFi Networks Configuration
 const char* wifi_networks[][2] = {
   {"Cloud Control Network", "ccv7network"},
@@ -42,23 +66,53 @@ const int num_networks = sizeof(wifi_networks) / sizeof(wifi_networks[0]);
 // Set this to your MQTT broker IP address (where Mosquitto is running)
 // Use your PC's IP: 192.168.43.17
 const char* mqtt_broker_ip = "192.168.43.17";  // Change this to your MQTT broker IP
-const int mqtt_port = 1883;
-const char* mqtt_topic = "RFID_LOGIN";
+const int mqtt_port = ENABLE_TLS ? 8883 : 1883;
 const char* mqtt_client_id = "ESP32_Relay_Controller";
+const char* mqtt_config_topic = "RFID_CONFIG/relay";  // Retained runtime configuration
+const char* mqtt_secrets_topic = "RFID_CONFIG/relay/secrets";  // Retained WiFi passwords and edge_token
+const char* mqtt_ota_topic_prefix = "RFID_OTA/relay";  // Firmware manifest, chunks and status
+
+// TLS Configuration (only used when built with -D ENABLE_TLS=1)
+// A PSK suite gives the cheapest reconnect; set ca_cert instead to verify
+// the broker certificate.
+const TlsCredentials mqtt_tls = {
+  nullptr,       // CA certificate (PEM)
+  "esp32_relay", // PSK identity
+  nullptr,       // PSK as hex string, e.g. "1a2b3c..."
+};
+
+// OTA manifests must be signed with the matching private key (see README);
+// without a key every release is rejected
+const char* ota_signing_key = nullptr;  // ECDSA P-256 public key (PEM)
 
 // Runtime tuning constants
-constexpr unsigned long LOOP_IDLE_DELAY_MS = 5;
-constexpr unsigned long TELEMETRY_INTERVAL_MS = 60000;
-constexpr unsigned long MQTT_BACKOFF_MIN_MS = 1000;
-constexpr unsigned long MQTT_BACKOFF_MAX_MS = 10000;
+constexpr unsigned long DEFAULT_LOOP_IDLE_DELAY_MS = 5;
+constexpr unsigned long DEFAULT_TELEMETRY_INTERVAL_MS = 60000;
+constexpr unsigned long DEFAULT_MQTT_BACKOFF_MIN_MS = 1000;
+constexpr unsigned long DEFAULT_MQTT_BACKOFF_MAX_MS = 10000;
+constexpr uint16_t MQTT_BUFFER_SIZE = 1536;  // Room for full config updates and OTA chunks
+constexpr uint16_t DEFAULT_EDGE_PORT = 0;    // Edge broker listen port, 0 = disabled (1883 to enable)
 
 // Initialize objects
-WiFiClient espClient;
+TransportClient espClient;
 PubSubClient mqtt_client(espClient);
+RelayScheduler relay_scheduler;
+portMUX_TYPE relay_mux = portMUX_INITIALIZER_UNLOCKED;
+esp_timer_handle_t relay_timer = nullptr;
+uint32_t relay_status_pending = 0;  // Channels whose status still has to go to the central broker
+uint32_t edge_status_pending = 0;   // ... and to the edge broker's subscribers
+EdgeBroker edge_broker;
+char relay_command_topic[RELAY_COMMAND_TOPIC_LEN] = {0};  // RFID_LOGIN/+, one retained topic per channel
+WiFiClient otaHttpClient;  // HTTP-pulled images are checked against the signed manifest
+OtaUpdater ota_updater;
+MemDiag mem_diag;
 
 // Variables
 unsigned long lastReconnectAttempt = 0;
-unsigned long mqttBackoffDelay = MQTT_BACKOFF_MIN_MS;
+RuntimeConfig config;
+uint8_t pending_config_apply = 0;
+ConfigTrial config_trial;
+unsigned long mqttBackoffDelay = DEFAULT_MQTT_BACKOFF_MIN_MS;
 unsigned long lastTelemetryReport = 0;
 bool wifi_connected = false;
 IPAddress gateway_ip;
@@ -66,6 +120,7 @@ IPAddress mqtt_broker;
 char gateway_host[16] = {0};
 bool gateway_ready = false;
 bool mqtt_broker_ready = false;
+ConnectionStats mqtt_connection_stats = {};
 
 // Function declarations
 void connectToWiFi();
@@ -73,18 +128,62 @@ void connectToMQTT();
 void mqttCallback(char* topic, byte* payload, unsigned int length);
 void updateNetworkTargets();
 void reportRuntimeStats(unsigned long now);
+void loadDefaultConfig(RuntimeConfig& cfg);
+void handleConfigUpdate(ConfigTopic topic, const uint8_t* payload, size_t length);
+void applyPendingConfig();
+void failConfigTrial();
+void writeRelayPin(uint8_t channel, bool on, void* ctx);
+void onRelayTick(void* arg);
+void collectRelayChanges();
+void publishRelayStatus();
+void handleRelayCommand(const char* topic, const uint8_t* payload, size_t length, const char* source);
+void onEdgeMessage(const char* topic, const uint8_t* payload, size_t length, void* ctx);
+void startEdgeBroker();
+void forwardEdgeBridge();
 
 void setup() {
   Serial.begin(115200);
   Serial.println("\n\n=== ESP32 Relay Controller Starting ===");
+
+  // Load configuration: compile-time defaults, then NVS overrides
+  if (configResetRequested(CONFIG_RESET_PIN, CONFIG_RESET_HOLD_MS)) {
+    Serial.println(clearRuntimeConfig() ? "Config: BOOT held, stored configuration cleared"
+                                        : "Config: BOOT held, but NVS could not be cleared");
+  }
+  loadDefaultConfig(config);
+  loadRuntimeConfig(config, CONFIG_RELAY_SCHEMA);
+  printRuntimeConfig(config, CONFIG_RELAY_SCHEMA);
+  config_trial.begin();
+  mqttBackoffDelay = config.mqtt_backoff_min_ms;
+  if (config.edge_port != 0 && config.edge_token[0] == '\0') {
+    Serial.println("Edge broker stays off: edge_token is not set");
+  }
   
-  // Initialize relay pin
-  pinMode(RELAY_PIN, OUTPUT);
-  // Start with relay OFF
-  // ACTIVE HIGH: LOW = OFF (default)
-  // ACTIVE LOW: HIGH = OFF
-  digitalWrite(RELAY_PIN, LOW); // Start OFF (Active HIGH mode - change to HIGH for Active LOW)
-  Serial.println("Relay pin initialized (GPIO 26) - Active HIGH mode");
+  // Initialize relay pins; the scheduler starts every channel OFF
+  for (uint8_t i = 0; i < num_relay_channels; i++) {
+    pinMode(relay_channels[i].pin, OUTPUT);
+  }
+  relay_scheduler.begin(num_relay_channels, writeRelayPin, nullptr);
+  snprintf(relay_command_topic, sizeof(relay_command_topic), "%s/+", RELAY_COMMAND_TOPIC_PREFIX);
+  Serial.print("Relay channels initialized: ");
+  Serial.println(relay_scheduler.channelCount());
+
+  // Pulse relocks run from the esp_timer task, independent of loop()
+  esp_timer_create_args_t timer_args = {};
+  timer_args.callback = onRelayTick;
+  timer_args.dispatch_method = ESP_TIMER_TASK;
+  timer_args.name = "relay_wheel";
+  if (esp_timer_create(&timer_args, &relay_timer) == ESP_OK &&
+      esp_timer_start_periodic(relay_timer, RELAY_TICK_MS * 1000) == ESP_OK) {
+    Serial.println("Relay scheduler running");
+  } else {
+    Serial.println("ERROR: relay timer could not be started; pulses will not relock");
+  }
+
+#if ENABLE_TLS
+  configureTlsClient(espClient, mqtt_tls);
+  Serial.println("TLS enabled for MQTT connection");
+#endif
   
   // Connect to WiFi
   connectToWiFi();
@@ -95,7 +194,26 @@ void setup() {
   Serial.println("WiFi power management: Balanced mode");
   
   // Setup MQTT
+  mqtt_client.setBufferSize(MQTT_BUFFER_SIZE);
   mqtt_client.setCallback(mqttCallback);
+
+  // Edge broker topic table: commands are handled locally and bridged upstream
+  edge_broker.addTopic(RELAY_ONLINE_TOPIC, 0);
+  for (uint8_t i = 0; i < num_relay_channels; i++) {
+    char topic[RELAY_COMMAND_TOPIC_LEN] = {0};
+    formatRelayCommandTopic(topic, sizeof(topic), i);
+    edge_broker.addTopic(topic, EDGE_TOPIC_LOCAL | EDGE_TOPIC_BRIDGE);
+    formatRelayStatusTopic(topic, sizeof(topic), i);
+    edge_broker.addTopic(topic, 0);
+  }
+  edge_broker.setLocalHandler(onEdgeMessage, nullptr);
+  edge_broker.setToken(config.edge_token);
+  ota_updater.begin(mqtt_client, mqtt_ota_topic_prefix, mqtt_client_id, ota_signing_key);
+
+  // Stack high-water marks for telemetry; esp_timer also runs the relay wheel
+  mem_diag.watchTask("loopTask", nullptr);
+  mem_diag.watchTask("esp_timer");
+  mem_diag.watchTask("tiT");
   
   Serial.println("=== Setup Complete ===");
   Serial.println("Listening for MQTT messages...\n");
@@ -115,21 +233,42 @@ void loop() {
     wifi_connected = true;
   }
   
+  // Serve LAN clients first; the local path must not wait on the central broker
+  if (wifi_connected && config.edge_port != 0 && config.edge_token[0] != '\0' && !edge_broker.running()) {
+    startEdgeBroker();
+  }
+  edge_broker.loop();
+
   // Maintain MQTT connection with exponential backoff
   if (mqtt_client.connected()) {
     mqtt_client.loop();
-    mqttBackoffDelay = MQTT_BACKOFF_MIN_MS;
+    mqttBackoffDelay = config.mqtt_backoff_min_ms;
   } else if (wifi_connected) {
     if (now - lastReconnectAttempt >= mqttBackoffDelay) {
       lastReconnectAttempt = now;
       connectToMQTT();
       unsigned long nextDelay = mqttBackoffDelay * 2;
-      mqttBackoffDelay = nextDelay > MQTT_BACKOFF_MAX_MS ? MQTT_BACKOFF_MAX_MS : nextDelay;
+      mqttBackoffDelay = nextDelay > config.mqtt_backoff_max_ms ? config.mqtt_backoff_max_ms : nextDelay;
     }
   }
 
+  // Re-apply network settings changed through the config topic
+  if (pending_config_apply) {
+    applyPendingConfig();
+  }
+
+  // Watch for stalled firmware transfers, pull HTTP releases, reboot when installed
+  ota_updater.loop(otaHttpClient, now);
+
+  // Report relocks performed by the timer and acknowledge applied commands
+  collectRelayChanges();
+  publishRelayStatus();
+
+  // Forward commands received on the edge broker to the central broker
+  forwardEdgeBridge();
+
   reportRuntimeStats(now);
-  delay(LOOP_IDLE_DELAY_MS);
+  delay(config.loop_idle_delay_ms);
 }
 
 void connectToWiFi() {
@@ -141,11 +280,15 @@ void connectToWiFi() {
   gateway_host[0] = '\0';
   
   // Try each configured network
-  for (int i = 0; i < num_networks; i++) {
+  for (size_t i = 0; i < CONFIG_MAX_WIFI_NETWORKS; i++) {
+    if (config.wifi[i].ssid[0] == '\0') {
+      continue;
+    }
+
     Serial.print("Attempting: ");
-    Serial.println(wifi_networks[i][0]);
+    Serial.println(config.wifi[i].ssid);
     
-    WiFi.begin(wifi_networks[i][0], wifi_networks[i][1]);
+    WiFi.begin(config.wifi[i].ssid, config.wifi[i].password);
     
     int attempts = 0;
     while (WiFi.status() != WL_CONNECTED && attempts < 20) {
@@ -173,6 +316,7 @@ void connectToWiFi() {
   
   Serial.println("Could not connect to any WiFi network!");
   wifi_connected = false;
+  failConfigTrial();
 }
 
 void connectToMQTT() {
@@ -182,30 +326,68 @@ void connectToMQTT() {
 
   if (!mqtt_broker_ready) {
     Serial.println("Skipping MQTT connect: MQTT broker IP not configured");
+    failConfigTrial();
     return;
   }
 
   Serial.print("Connecting to MQTT broker... ");
-  Serial.print(mqtt_broker_ip);
+  Serial.print(config.mqtt_broker_ip);
   Serial.print(":");
-  Serial.print(mqtt_port);
+  Serial.print(config.mqtt_port);
   Serial.print(" ... ");
   
-  if (mqtt_client.connect(mqtt_client_id)) {
-    Serial.println("Connected!");
-    mqttBackoffDelay = MQTT_BACKOFF_MIN_MS;
+  const unsigned long connectStart = millis();
+  // The broker flips the retained online flag to "0" if the relay drops off
+  const bool mqttConnected = mqtt_client.connect(mqtt_client_id, RELAY_ONLINE_TOPIC, 1, true, "0");
+  recordConnection(mqtt_connection_stats, true, millis() - connectStart, mqttConnected);
+
+  if (mqttConnected) {
+    Serial.print("Connected in ");
+    Serial.print(mqtt_connection_stats.cold_last_ms);
+    Serial.println(" ms");
+    mqttBackoffDelay = config.mqtt_backoff_min_ms;
+    if (config_trial.confirm()) {
+      Serial.print("Config: rev ");
+      Serial.print(config.revision);
+      Serial.println(" reached the broker, keeping it");
+    }
     
-    // Subscribe to RFID_LOGIN topic
-    bool subscribed = mqtt_client.subscribe(mqtt_topic);
+    // Subscribe to the command topic of every channel
+    bool subscribed = mqtt_client.subscribe(relay_command_topic);
     if (subscribed) {
       Serial.print("Subscribed to topic: ");
-      Serial.println(mqtt_topic);
+      Serial.println(relay_command_topic);
     } else {
       Serial.println("Subscription failed!");
     }
+
+    if (mqtt_client.subscribe(mqtt_config_topic)) {
+      Serial.print("Subscribed to topic: ");
+      Serial.println(mqtt_config_topic);
+    } else {
+      Serial.println("Config subscription failed!");
+    }
+
+    if (mqtt_client.subscribe(mqtt_secrets_topic)) {
+      Serial.print("Subscribed to topic: ");
+      Serial.println(mqtt_secrets_topic);
+    } else {
+      Serial.println("Secrets subscription failed!");
+    }
+
+    // Reaching the broker proves a freshly installed image works
+    ota_updater.markRunningAppValid();
+    ota_updater.subscribe();
+
+    // Relocks may have happened while offline; refresh every retained status.
+    // The retained command that arrives after subscribing carries a sequence
+    // number that was already applied, so the scheduler skips it.
+    mqtt_client.publish(RELAY_ONLINE_TOPIC, "1", true);
+    relay_status_pending = (1u << num_relay_channels) - 1;
   } else {
     Serial.print("Failed, rc=");
     Serial.println(mqtt_client.state());
+    failConfigTrial();
   }
 }
 
@@ -235,68 +417,211 @@ void updateNetworkTargets() {
   Serial.println(gateway_host);
 
   // Parse MQTT broker IP from string
-  if (mqtt_broker.fromString(mqtt_broker_ip)) {
+  if (mqtt_broker.fromString(config.mqtt_broker_ip)) {
     mqtt_broker_ready = true;
-    mqtt_client.setServer(mqtt_broker, mqtt_port);
+    mqtt_client.setServer(mqtt_broker, config.mqtt_port);
     Serial.print("Configured MQTT broker: ");
-    Serial.print(mqtt_broker_ip);
+    Serial.print(config.mqtt_broker_ip);
     Serial.print(":");
-    Serial.println(mqtt_port);
+    Serial.println(config.mqtt_port);
   } else {
     mqtt_broker_ready = false;
     Serial.print("ERROR: Failed to parse MQTT broker IP: ");
-    Serial.println(mqtt_broker_ip);
+    Serial.println(config.mqtt_broker_ip);
   }
 }
 
 void mqttCallback(char* topic, byte* payload, unsigned int length) {
+  if (strcmp(topic, mqtt_config_topic) == 0) {
+    handleConfigUpdate(ConfigTopic::Settings, payload, length);
+    return;
+  }
+  if (strcmp(topic, mqtt_secrets_topic) == 0) {
+    handleConfigUpdate(ConfigTopic::Secrets, payload, length);
+    return;
+  }
+  if (ota_updater.handleMessage(topic, payload, length)) {
+    return;
+  }
+
+  handleRelayCommand(topic, payload, length, "MQTT");
+}
+
+void onEdgeMessage(const char* topic, const uint8_t* payload, size_t length, void* ctx) {
+  (void)ctx;
+  handleRelayCommand(topic, payload, length, "edge broker");
+}
+
+void handleRelayCommand(const char* topic, const uint8_t* payload, size_t length, const char* source) {
+  uint8_t topic_channel = 0;
+  if (!parseRelayCommandTopic(topic, topic_channel)) {
+    return;
+  }
+
   Serial.println("\n---------------------------------");
-  Serial.print("MQTT Message Received on topic: ");
+  Serial.print("Relay command via ");
+  Serial.print(source);
+  Serial.print(" on ");
   Serial.println(topic);
-  
-  // Convert payload to string
-  String message = "";
-  for (unsigned int i = 0; i < length; i++) {
-    message += (char)payload[i];
+
+  RelayCommand cmd;
+  if (!parseRelayCommand(payload, length, cmd)) {
+    Serial.print("Unknown command (");
+    Serial.print(length);
+    Serial.println(" bytes); relay maintains current state");
+    Serial.println("---------------------------------\n");
+    return;
   }
-  
-  Serial.print("Message: ");
-  Serial.println(message);
-  
-  // Control relay based on message
-  // Behavior:
-  // - Default/Low: Relay pin = LOW (OFF)
-  // - Message "0": Relay pin = LOW (OFF) - stays LOW
-  // - Message "1": Relay pin = HIGH (ON) - stays HIGH until next "0"
-  
-  if (message == "1") {
-    digitalWrite(RELAY_PIN, HIGH);
-    Serial.println("Action: Relay ON - Set to HIGH");
-    Serial.println("Relay Pin State: HIGH");
-  } else if (message == "0") {
-    digitalWrite(RELAY_PIN, LOW);
-    Serial.println("Action: Relay OFF - Set to LOW");
-    Serial.println("Relay Pin State: LOW");
+
+  // Legacy payloads carry no channel; sequenced ones must match their topic
+  if (!cmd.sequenced) {
+    cmd.channel = topic_channel;
+  } else if (cmd.channel != topic_channel) {
+    Serial.print("Command for ch ");
+    Serial.print(cmd.channel);
+    Serial.println(" on another channel's topic; ignored");
+    Serial.println("---------------------------------\n");
+    return;
+  }
+
+  // Actuation must stay off the heap (checked in debug builds)
+  mem_diag.beginNoAlloc();
+  portENTER_CRITICAL(&relay_mux);
+  const RelaySubmitResult result = relay_scheduler.submit(cmd, esp_timer_get_time());
+  portEXIT_CRITICAL(&relay_mux);
+  mem_diag.endNoAlloc("relay actuation");
+
+  Serial.print("Command: ch ");
+  Serial.print(cmd.channel);
+  if (cmd.type == RelayCommandType::Pulse) {
+    Serial.print(" pulse ");
+    Serial.print(cmd.pulse_ms);
+    Serial.print(" ms");
   } else {
-    Serial.print("Unknown command: ");
-    Serial.println(message);
-    Serial.println("Relay maintains current state");
+    Serial.print(cmd.state ? " set ON" : " set OFF");
   }
-  
+  if (cmd.sequenced) {
+    Serial.print(", seq ");
+    Serial.print(cmd.seq);
+  }
+  Serial.print(" -> ");
+  Serial.print(relaySubmitResultName(result));
+  Serial.println(result == RelaySubmitResult::Stale ? " (already applied or out of order)" : "");
+
+  // Every command is acknowledged, including stale and unchanged ones
+  if (result != RelaySubmitResult::InvalidChannel) {
+    relay_status_pending |= 1u << cmd.channel;
+    edge_status_pending |= 1u << cmd.channel;
+  }
+  collectRelayChanges();
   Serial.println("---------------------------------\n");
 }
 
+void writeRelayPin(uint8_t channel, bool on, void* ctx) {
+  (void)ctx;
+  const RelayChannelPin& relay = relay_channels[channel];
+  digitalWrite(relay.pin, on == relay.active_high ? HIGH : LOW);
+}
+
+void onRelayTick(void* arg) {
+  (void)arg;
+  portENTER_CRITICAL(&relay_mux);
+  relay_scheduler.tick(esp_timer_get_time());
+  portEXIT_CRITICAL(&relay_mux);
+}
+
+void collectRelayChanges() {
+  portENTER_CRITICAL(&relay_mux);
+  const uint32_t changed = relay_scheduler.takeChanged();
+  portEXIT_CRITICAL(&relay_mux);
+  relay_status_pending |= changed;
+  edge_status_pending |= changed;
+
+  for (uint8_t i = 0; i < num_relay_channels; i++) {
+    if (changed & (1u << i)) {
+      Serial.print("Relay ch ");
+      Serial.print(i);
+      Serial.print(" (GPIO ");
+      Serial.print(relay_channels[i].pin);
+      Serial.print("): ");
+      Serial.println(relay_scheduler.state(i) ? "ON" : "OFF");
+    }
+  }
+}
+
+void publishRelayStatus() {
+  const bool to_central = relay_status_pending && mqtt_client.connected();
+  const bool to_edge = edge_status_pending && edge_broker.running();
+  if (!to_central && !to_edge) {
+    return;
+  }
+
+  for (uint8_t i = 0; i < num_relay_channels; i++) {
+    const uint32_t bit = 1u << i;
+    if (!((to_central ? relay_status_pending : 0) & bit) && !((to_edge ? edge_status_pending : 0) & bit)) {
+      continue;
+    }
+
+    RelayStatus status = {};
+    status.channel = i;
+    portENTER_CRITICAL(&relay_mux);
+    status.has_seq = relay_scheduler.hasSeq(i);
+    status.seq = relay_scheduler.lastSeq(i);
+    status.state = relay_scheduler.state(i);
+    status.pulsing = relay_scheduler.pulsing(i);
+    portEXIT_CRITICAL(&relay_mux);
+    // Read the pin back so the ack reflects the output, not just the intent
+    status.gpio = (digitalRead(relay_channels[i].pin) == HIGH) == relay_channels[i].active_high;
+
+    char topic[RELAY_STATUS_TOPIC_LEN] = {0};
+    char message[RELAY_STATUS_MESSAGE_LEN] = {0};
+    formatRelayStatusTopic(topic, sizeof(topic), i);
+    const int length = formatRelayStatus(message, sizeof(message), status);
+
+    // LAN subscribers first: the edge path is the latency-critical one
+    if (to_edge && (edge_status_pending & bit)) {
+      edge_broker.publish(topic, reinterpret_cast<const uint8_t*>(message), length, true);
+      edge_status_pending &= ~bit;
+    }
+    if (to_central && (relay_status_pending & bit)) {
+      if (!mqtt_client.publish(topic, message, true)) {
+        Serial.println("Relay status publish failed; retrying next loop");
+        return;
+      }
+      relay_status_pending &= ~bit;
+    }
+  }
+}
+
+void startEdgeBroker() {
+  edge_broker.begin(config.edge_port);
+  edge_broker.publish(RELAY_ONLINE_TOPIC, reinterpret_cast<const uint8_t*>("1"), 1, true);
+  edge_status_pending = (1u << num_relay_channels) - 1;
+  Serial.print("Edge broker listening on ");
+  Serial.print(WiFi.localIP());
+  Serial.print(":");
+  Serial.println(config.edge_port);
+}
+
+void forwardEdgeBridge() {
+  EdgeBridgeMessage message;
+  while (mqtt_client.connected() && edge_broker.peekBridge(message)) {
+    if (!mqtt_client.publish(message.topic, message.payload, message.length, message.retain)) {
+      break;
+    }
+    edge_broker.popBridge();
+  }
+}
+
 void reportRuntimeStats(unsigned long now) {
-  if (now - lastTelemetryReport < TELEMETRY_INTERVAL_MS) {
+  if (now - lastTelemetryReport < config.telemetry_interval_ms) {
     return;
   }
 
   lastTelemetryReport = now;
 
   Serial.println("\n--- Relay Runtime Telemetry ---");
-  Serial.print("Free Heap: ");
-  Serial.print(ESP.getFreeHeap());
-  Serial.println(" bytes");
+  mem_diag.print();
 
   Serial.print("WiFi RSSI: ");
   if (wifi_connected) {
@@ -308,5 +633,141 @@ void reportRuntimeStats(unsigned long now) {
 
   Serial.print("MQTT Connected: ");
   Serial.println(mqtt_client.connected() ? "Yes" : "No");
+  printConnectionStats("MQTT connect", mqtt_connection_stats);
+  printHandshakeStats("MQTT", espClient, mqtt_tls);
+
+  if (edge_broker.running()) {
+    const EdgeBrokerStats& edge = edge_broker.stats();
+    Serial.print("Edge broker: ");
+    Serial.print(edge_broker.clientCount());
+    Serial.print(" clients, ");
+    Serial.print(edge.publishes_in);
+    Serial.print(" publishes in, ");
+    Serial.print(edge.deliveries);
+    Serial.print(" delivered, bridge backlog ");
+    Serial.print(edge_broker.bridgeBacklog());
+    Serial.print(" (");
+    Serial.print(edge.bridge_dropped);
+    Serial.print(" dropped), rejected ");
+    Serial.print(edge.rejected);
+    Serial.print(" (");
+    Serial.print(edge.auth_failed);
+    Serial.print(" bad token), unknown topic ");
+    Serial.print(edge.unknown_topic);
+    Serial.print(", oversize ");
+    Serial.print(edge.oversize);
+    Serial.print(", retained cleared ");
+    Serial.println(edge.retained_cleared);
+  }
+
+  for (uint8_t i = 0; i < num_relay_channels; i++) {
+    portENTER_CRITICAL(&relay_mux);
+    const RelayChannelStats stats = relay_scheduler.stats(i);
+    const bool on = relay_scheduler.state(i);
+    const uint32_t last_seq = relay_scheduler.lastSeq(i);
+    portEXIT_CRITICAL(&relay_mux);
+
+    Serial.print("Relay ch ");
+    Serial.print(i);
+    Serial.print(on ? ": ON" : ": OFF");
+    Serial.print(", last seq ");
+    Serial.print(last_seq);
+    Serial.print(", applied ");
+    Serial.print(stats.applied);
+    Serial.print(", unchanged ");
+    Serial.print(stats.unchanged);
+    Serial.print(", stale ");
+    Serial.print(stats.stale);
+    Serial.print(", pulses ");
+    Serial.print(stats.pulses);
+    Serial.print(", max relock delay ");
+    Serial.print(stats.max_relock_late_us);
+    Serial.println(" us");
+  }
   Serial.println("--------------------------------");
 }
+
+void loadDefaultConfig(RuntimeConfig& cfg) {
+  memset(&cfg, 0, sizeof(cfg));
+  for (int i = 0; i < num_networks && i < static_cast<int>(CONFIG_MAX_WIFI_NETWORKS); i++) {
+    strncpy(cfg.wifi[i].ssid, wifi_networks[i][0], sizeof(cfg.wifi[i].ssid) - 1);
+    strncpy(cfg.wifi[i].password, wifi_networks[i][1], sizeof(cfg.wifi[i].password) - 1);
+  }
+  strncpy(cfg.mqtt_broker_ip, mqtt_broker_ip, sizeof(cfg.mqtt_broker_ip) - 1);
+  cfg.mqtt_port = mqtt_port;
+  cfg.loop_idle_delay_ms = DEFAULT_LOOP_IDLE_DELAY_MS;
+  cfg.telemetry_interval_ms = DEFAULT_TELEMETRY_INTERVAL_MS;
+  cfg.mqtt_backoff_min_ms = DEFAULT_MQTT_BACKOFF_MIN_MS;
+  cfg.mqtt_backoff_max_ms = DEFAULT_MQTT_BACKOFF_MAX_MS;
+  cfg.edge_port = DEFAULT_EDGE_PORT;
+}
+
+void handleConfigUpdate(ConfigTopic topic, const uint8_t* payload, size_t length) {
+  uint8_t apply_flags = 0;
+  const ConfigUpdateResult result =
+      applyConfigUpdate(config, CONFIG_RELAY_SCHEMA, topic, payload, length, apply_flags);
+
+  switch (result) {
+    case ConfigUpdateResult::Applied:
+    case ConfigUpdateResult::NotPersisted:
+      Serial.print(topic == ConfigTopic::Secrets ? "Secrets updated to rev " : "Config updated to rev ");
+      Serial.println(topic == ConfigTopic::Secrets ? config.secrets_revision : config.revision);
+      if (result == ConfigUpdateResult::NotPersisted) {
+        Serial.println("WARNING: config could not be written to NVS; it will not survive a reboot");
+      }
+      printRuntimeConfig(config, CONFIG_RELAY_SCHEMA);
+      if (apply_flags & CONFIG_APPLY_TRIAL) {
+        config_trial.start();
+      }
+      // Reconnects happen from loop(), not from inside the MQTT callback
+      pending_config_apply |= apply_flags;
+      break;
+    case ConfigUpdateResult::Stale:
+      break;
+    case ConfigUpdateResult::Invalid:
+      Serial.println("Config update rejected; keeping current configuration");
+      break;
+  }
+}
+
+void applyPendingConfig() {
+  const uint8_t apply = pending_config_apply;
+  pending_config_apply = 0;
+
+  if (apply & CONFIG_APPLY_EDGE) {
+    // loop() restarts the broker on the new port (or leaves it off for 0)
+    Serial.println("Config: edge broker settings changed");
+    edge_broker.end();
+    if (config.edge_port != 0 && config.edge_token[0] == '\0') {
+      Serial.println("Edge broker stays off: edge_token is not set");
+    }
+  }
+
+  if (apply & CONFIG_APPLY_WIFI) {
+    Serial.println("Config: WiFi settings changed, reconnecting");
+    mqtt_client.disconnect();
+    wifi_connected = false;
+    connectToWiFi();
+    return;
+  }
+
+  if (apply & CONFIG_APPLY_MQTT) {
+    Serial.println("Config: MQTT broker changed, reconnecting");
+    updateNetworkTargets();
+    mqtt_client.disconnect();
+    lastReconnectAttempt = 0;
+    mqttBackoffDelay = config.mqtt_backoff_min_ms;
+  }
+}
+
+// Called for every failed WiFi round or MQTT connect while new network
+// settings are on trial
+void failConfigTrial() {
+  if (!config_trial.fail(config, CONFIG_RELAY_SCHEMA)) {
+    return;
+  }
+
+  Serial.println("Config: new network settings never reached the broker, rolled back");
+  printRuntimeConfig(config, CONFIG_RELAY_SCHEMA);
+  pending_config_apply = CONFIG_APPLY_WIFI | CONFIG_APPLY_MQTT | CONFIG_APPLY_EDGE;
+}
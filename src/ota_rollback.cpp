@@ -0,0 +1,14 @@
+/*
+ * Rollback hook for both firmwares (see include/ota_update.h).
+ *
+ * The Arduino core calls verifyRollbackLater() at boot; returning true keeps
+ * a freshly installed image on probation until OtaUpdater::markRunningAppValid()
+ * runs after the first broker connect. Only effective with a rollback-enabled
+ * bootloader. It lives in its own translation unit so the core's weak default
+ * is overridden exactly once.
+ */
+
+extern "C" bool verifyRollbackLater()
+{
+  return true;
+}
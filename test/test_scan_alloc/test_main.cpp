@@ -0,0 +1,275 @@
+/*
+ * Host test that the scanner's scan path stays off the heap.
+ *
+ * Replaces malloc/calloc/realloc with counting versions (glibc forwards to
+ * __libc_malloc and friends), fills a RegistryCache through deltas outside
+ * the counted region, then replays random taps through the same steps the
+ * firmware runs for every card:
+ *   formatUid -> RegistryCache::lookup (registry_sync.h, hit and miss)
+ *   -> urlEncode for the check request
+ *   -> localDecision/planRelayCommands/formatRelayCommand (scan_logic.h,
+ *      relay_protocol.h)
+ * Each step is its own test and fails if it allocates. This is the host side
+ * of mem_diag.h's "scan path" scope, which needs a debug build on a device.
+ *
+ * parseCheckResponse is not covered: ArduinoJson v7 documents draw their
+ * pool from the heap, and the step only runs after the HTTP client, which
+ * allocates anyway.
+ *
+ * Run with:
+ *   pio test -e native
+ */
+
+#include <unity.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "registry_sync.h"
+#include "relay_protocol.h"
+#include "scan_logic.h"
+
+#if defined(__GLIBC__)
+extern "C"
+{
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+}
+#endif
+
+namespace
+{
+constexpr size_t CARDS = 1000;
+constexpr size_t TAPS = 10000;
+constexpr uint32_t SEED = 1;
+constexpr uint32_t UNLOCK_PULSE_MS = 3000;
+constexpr uint8_t LANE_CHANNEL = 0;
+
+// Only touched by the allocator replacements below and Counted
+bool counting = false;
+unsigned long allocations = 0;
+
+// Counts allocations made while in scope
+class Counted
+{
+public:
+  Counted()
+  {
+    allocations = 0;
+    counting = true;
+  }
+  ~Counted() { counting = false; }
+
+  unsigned long count() const { return allocations; }
+};
+} // namespace
+
+#if defined(__GLIBC__)
+extern "C"
+{
+void *malloc(size_t size)
+{
+  allocations += counting ? 1 : 0;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+  allocations += counting ? 1 : 0;
+  return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+  allocations += counting ? 1 : 0;
+  return __libc_realloc(ptr, size);
+}
+}
+#endif
+
+namespace
+{
+struct Card
+{
+  uint8_t uid[REGISTRY_MAX_UID_LEN];
+  uint8_t len;
+};
+
+std::vector<Card> cards;
+std::vector<Card> taps;
+RegistryCache cache;
+
+// Mix of 4-byte (MIFARE Classic) and 7-byte (Ultralight/DESFire) UIDs
+Card randomCard(std::mt19937 &rng)
+{
+  Card card = {};
+  card.len = (rng() % 5 == 0) ? 7 : 4;
+  for (uint8_t i = 0; i < card.len; i++)
+  {
+    card.uid[i] = static_cast<uint8_t>(rng());
+  }
+  return card;
+}
+
+void putU32(std::vector<uint8_t> &out, uint32_t value)
+{
+  for (int i = 0; i < 4; i++)
+  {
+    out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+  }
+}
+
+// Registers the cards through full deltas, the way the backend seeds a new scanner
+bool seedRegistry()
+{
+  uint32_t revision = 0;
+  for (size_t start = 0; start < cards.size(); start += REGISTRY_MAX_DELTA_ENTRIES)
+  {
+    const size_t count = std::min(REGISTRY_MAX_DELTA_ENTRIES, cards.size() - start);
+    std::vector<uint8_t> delta = {'R', 'D', REGISTRY_DELTA_VERSION, 0};
+    putU32(delta, revision);
+    putU32(delta, revision + 1);
+    delta.push_back(static_cast<uint8_t>(count));
+    delta.push_back(static_cast<uint8_t>(count >> 8));
+    for (size_t i = start; i < start + count; i++)
+    {
+      delta.push_back((i % 2) ? REGISTRY_ENTRY_FLAG_STATUS : 0);
+      delta.push_back(cards[i].len);
+      delta.insert(delta.end(), cards[i].uid, cards[i].uid + cards[i].len);
+    }
+    if (cache.applyDelta(delta.data(), delta.size()) != DeltaResult::Applied)
+    {
+      return false;
+    }
+    revision++;
+  }
+  return true;
+}
+} // namespace
+
+void setUp() {}
+void tearDown() {}
+
+// Guards against a platform where the replacements above are not linked in
+void test_counter_sees_allocations()
+{
+#if defined(__GLIBC__)
+  unsigned long seen = 0;
+  {
+    Counted counted;
+    void *volatile block = malloc(16);
+    free(block);
+    seen = counted.count();
+  }
+  TEST_ASSERT_EQUAL_UINT32(1, seen);
+#else
+  TEST_IGNORE_MESSAGE("allocation counting needs glibc");
+#endif
+}
+
+void test_format_uid_does_not_allocate()
+{
+  unsigned long seen = 0;
+  for (const Card &tap : taps)
+  {
+    char rfid_uid[REGISTRY_MAX_UID_LEN * 3] = {0};
+    Counted counted;
+    formatUid(tap.uid, tap.len, rfid_uid, sizeof(rfid_uid));
+    seen += counted.count();
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, seen);
+}
+
+void test_registry_lookup_does_not_allocate()
+{
+  unsigned long seen = 0;
+  size_t hits = 0;
+  for (const Card &tap : taps)
+  {
+    uint8_t status = 0;
+    bool cached = false;
+    {
+      Counted counted;
+      cached = cache.lookup(tap.uid, tap.len, status);
+      seen += counted.count();
+    }
+    hits += cached ? 1 : 0;
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, seen);
+  // Both hits and misses have to be exercised
+  TEST_ASSERT_TRUE(hits > 0 && hits < taps.size());
+}
+
+void test_url_encode_does_not_allocate()
+{
+  unsigned long seen = 0;
+  for (const Card &tap : taps)
+  {
+    char rfid_uid[REGISTRY_MAX_UID_LEN * 3] = {0};
+    char encoded_uid[sizeof(rfid_uid) * 3] = {0};
+    formatUid(tap.uid, tap.len, rfid_uid, sizeof(rfid_uid));
+    Counted counted;
+    urlEncode(rfid_uid, encoded_uid, sizeof(encoded_uid));
+    seen += counted.count();
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, seen);
+}
+
+void test_relay_commands_do_not_allocate()
+{
+  unsigned long seen = 0;
+  uint32_t seq = 0;
+  for (const Card &tap : taps)
+  {
+    uint8_t status = 0;
+    const bool cached = cache.lookup(tap.uid, tap.len, status);
+    char message[RELAY_COMMAND_MESSAGE_LEN];
+
+    // Alternate latch and pulse mode so both plans are covered
+    Counted counted;
+    const int decision = localDecision(true, cached, status);
+    RelayPlan plan = planRelayCommands(decision, LANE_CHANNEL, (seq % 2) ? UNLOCK_PULSE_MS : 0);
+    for (uint8_t i = 0; i < plan.count; i++)
+    {
+      plan.commands[i].seq = ++seq;
+      formatRelayCommand(message, sizeof(message), plan.commands[i]);
+    }
+    seen += counted.count();
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, seen);
+}
+
+int main(int, char **)
+{
+  // Setup may allocate: registered cards, unknown taps and the cache itself
+  std::mt19937 rng(SEED);
+  cards.resize(CARDS);
+  for (Card &card : cards)
+  {
+    card = randomCard(rng);
+  }
+  taps.resize(TAPS);
+  for (Card &tap : taps)
+  {
+    tap = (rng() % 4 == 0) ? randomCard(rng) : cards[rng() % cards.size()];
+  }
+  const bool seeded = cache.begin(CARDS) && seedRegistry();
+
+  UNITY_BEGIN();
+  if (!seeded)
+  {
+    UnityPrint("Could not seed the registry cache");
+    return UNITY_END() + 1;
+  }
+  RUN_TEST(test_counter_sees_allocations);
+  RUN_TEST(test_format_uid_does_not_allocate);
+  RUN_TEST(test_registry_lookup_does_not_allocate);
+  RUN_TEST(test_url_encode_does_not_allocate);
+  RUN_TEST(test_relay_commands_do_not_allocate);
+  return UNITY_END();
+}
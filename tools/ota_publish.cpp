@@ -0,0 +1,725 @@
+/*
+ * Host-side OTA publisher for the firmwares' OtaUpdater (include/ota_update.h).
+ *
+ * Builds a full or delta payload for a firmware image, checks that the delta
+ * reproduces the image with the same patcher the devices run, signs the
+ * manifest with openssl, then publishes the retained manifest and chunk
+ * passes over one MQTT 3.1.1 connection (QoS 1, no TLS or login), or writes
+ * the payload and manifest to a directory for HTTP pulls.
+ *
+ * Chunks go out every --interval-ms, slower when a chunk of a delta expands
+ * into more image bytes than the devices write in that time (--write-kbps).
+ * Devices write copies from their running image a slice per loop pass, and
+ * one that falls behind drops out of the pass.
+ *
+ * The signing key is an ECDSA P-256 private key; its public half goes into
+ * ota_signing_key in both firmwares:
+ *   openssl ecparam -name prime256v1 -genkey -noout -out ota_signing_key.pem
+ *   openssl ec -in ota_signing_key.pem -pubout
+ *
+ * Build from the repository root:
+ *   g++ -O2 -std=c++17 -Iinclude tools/ota_publish.cpp -o ota_publish
+ *
+ * Examples:
+ *   # 10% of scanners, delta against the firmware they are running
+ *   ./ota_publish --role scanner --id 7 --version 1.4.0 --key ota_signing_key.pem \
+ *       --image .pio/build/esp32_rfid/firmware.bin --base old/firmware.bin --rollout 10
+ *
+ *   # Same release for everyone, served by Apache instead of chunked over MQTT
+ *   ./ota_publish --role scanner --id 7 --version 1.4.0 --key ota_signing_key.pem \
+ *       --image new.bin --base old.bin --rollout 100 \
+ *       --out /xampp/htdocs/ota --url http://192.168.43.17:81/ota/payload.bin
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "ota_delta.h"
+#include "ota_transfer.h"
+
+namespace
+{
+constexpr size_t DELTA_BLOCK_LEN = 16;   // Granularity of base-image matches
+constexpr size_t DELTA_MIN_MATCH = 24;   // Shorter matches cost more than the literal
+constexpr size_t DEFAULT_CHUNK_LEN = 768; // Fits the firmwares' 1536-byte MQTT buffer
+constexpr size_t MANIFEST_LEN = 1024;     // OTA_MANIFEST_JSON_CAPACITY in ota_update.h
+constexpr uint16_t MQTT_KEEPALIVE_S = 600; // Covers the longest pause between two delta chunks
+constexpr time_t MQTT_ACK_TIMEOUT_S = 10;
+
+struct Options
+{
+  std::string role = "scanner";
+  std::string host = "127.0.0.1";
+  std::string port = "1883";
+  std::string image_path;
+  std::string base_path;
+  std::string key_path;
+  std::string version;
+  std::string url;
+  std::string out_dir;
+  uint32_t id = 0;
+  unsigned rollout = 100;
+  size_t chunk_len = DEFAULT_CHUNK_LEN;
+  unsigned passes = 3;
+  unsigned interval_ms = 20;
+  unsigned write_kbps = 64; // image bytes a device writes per second while patching
+};
+
+// ---- SHA-256 (FIPS 180-4) ----
+
+class Sha256
+{
+public:
+  Sha256()
+  {
+    static const uint32_t init[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                     0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+    memcpy(state_, init, sizeof(state_));
+  }
+
+  void update(const uint8_t *data, size_t len)
+  {
+    for (size_t i = 0; i < len; i++)
+    {
+      block_[block_len_++] = data[i];
+      if (block_len_ == 64)
+      {
+        transform();
+        block_len_ = 0;
+      }
+    }
+    total_bits_ += static_cast<uint64_t>(len) * 8;
+  }
+
+  void finish(uint8_t out[32])
+  {
+    const uint64_t bits = total_bits_;
+    const uint8_t pad = 0x80;
+    update(&pad, 1);
+    const uint8_t zero = 0;
+    while (block_len_ != 56)
+    {
+      update(&zero, 1);
+    }
+    uint8_t length[8];
+    for (int i = 0; i < 8; i++)
+    {
+      length[i] = static_cast<uint8_t>(bits >> (56 - 8 * i));
+    }
+    update(length, 8);
+    for (int i = 0; i < 8; i++)
+    {
+      for (int j = 0; j < 4; j++)
+      {
+        out[i * 4 + j] = static_cast<uint8_t>(state_[i] >> (24 - 8 * j));
+      }
+    }
+  }
+
+private:
+  static uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+  void transform()
+  {
+    static const uint32_t k[64] = {
+      0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+      0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+      0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+      0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+      0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+      0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+      0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+      0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++)
+    {
+      w[i] = (static_cast<uint32_t>(block_[i * 4]) << 24) | (static_cast<uint32_t>(block_[i * 4 + 1]) << 16) |
+             (static_cast<uint32_t>(block_[i * 4 + 2]) << 8) | block_[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++)
+    {
+      const uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      const uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+    uint32_t e = state_[4], f = state_[5], g = state_[6], h = state_[7];
+    for (int i = 0; i < 64; i++)
+    {
+      const uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+      const uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+    state_[0] += a;
+    state_[1] += b;
+    state_[2] += c;
+    state_[3] += d;
+    state_[4] += e;
+    state_[5] += f;
+    state_[6] += g;
+    state_[7] += h;
+  }
+
+  uint32_t state_[8];
+  uint8_t block_[64] = {};
+  size_t block_len_ = 0;
+  uint64_t total_bits_ = 0;
+};
+
+std::string toHex(const uint8_t *data, size_t len)
+{
+  std::string hex;
+  char pair[3];
+  for (size_t i = 0; i < len; i++)
+  {
+    snprintf(pair, sizeof(pair), "%02x", data[i]);
+    hex += pair;
+  }
+  return hex;
+}
+
+std::string sha256Hex(const std::vector<uint8_t> &data)
+{
+  Sha256 sha;
+  sha.update(data.data(), data.size());
+  uint8_t digest[32];
+  sha.finish(digest);
+  return toHex(digest, sizeof(digest));
+}
+
+// ---- Delta encoding (format in include/ota_delta.h) ----
+
+void putU32(std::vector<uint8_t> &out, uint32_t value)
+{
+  for (int i = 0; i < 4; i++)
+  {
+    out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+  }
+}
+
+uint64_t blockHash(const uint8_t *p)
+{
+  uint64_t hash = 1469598103934665603ull;
+  for (size_t i = 0; i < DELTA_BLOCK_LEN; i++)
+  {
+    hash = (hash ^ p[i]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+void emitInsert(std::vector<uint8_t> &out, const std::vector<uint8_t> &target, size_t from, size_t to)
+{
+  if (to > from)
+  {
+    out.push_back(OTA_DELTA_OP_INSERT);
+    putU32(out, static_cast<uint32_t>(to - from));
+    out.insert(out.end(), target.begin() + from, target.begin() + to);
+  }
+}
+
+// Greedy copy/insert against block-aligned base positions, with matches
+// extended in both directions. Firmware rebuilds shift code around but keep
+// most of it byte-identical, which this catches well enough.
+std::vector<uint8_t> buildDelta(const std::vector<uint8_t> &base, const std::vector<uint8_t> &target)
+{
+  std::unordered_map<uint64_t, uint32_t> blocks;
+  for (size_t offset = 0; offset + DELTA_BLOCK_LEN <= base.size(); offset += DELTA_BLOCK_LEN)
+  {
+    blocks.emplace(blockHash(&base[offset]), static_cast<uint32_t>(offset));
+  }
+
+  std::vector<uint8_t> out = {'R', 'D', 'L', 'T', OTA_DELTA_VERSION, 0, 0, 0};
+  putU32(out, static_cast<uint32_t>(base.size()));
+  putU32(out, static_cast<uint32_t>(target.size()));
+
+  size_t literal_start = 0;
+  size_t pos = 0;
+  while (pos + DELTA_BLOCK_LEN <= target.size())
+  {
+    const auto it = blocks.find(blockHash(&target[pos]));
+    if (it == blocks.end() || memcmp(&base[it->second], &target[pos], DELTA_BLOCK_LEN) != 0)
+    {
+      pos++;
+      continue;
+    }
+
+    size_t source = it->second;
+    size_t start = pos;
+    while (start > literal_start && source > 0 && base[source - 1] == target[start - 1])
+    {
+      source--;
+      start--;
+    }
+    size_t end = pos + DELTA_BLOCK_LEN;
+    while (end < target.size() && source + (end - start) < base.size() && base[source + (end - start)] == target[end])
+    {
+      end++;
+    }
+
+    if (end - start < DELTA_MIN_MATCH)
+    {
+      pos++;
+      continue;
+    }
+
+    emitInsert(out, target, literal_start, start);
+    out.push_back(OTA_DELTA_OP_COPY);
+    putU32(out, static_cast<uint32_t>(source));
+    putU32(out, static_cast<uint32_t>(end - start));
+    literal_start = end;
+    pos = end;
+  }
+  emitInsert(out, target, literal_start, target.size());
+  return out;
+}
+
+struct VerifyContext
+{
+  const std::vector<uint8_t> *base;
+  std::vector<uint8_t> output;
+};
+
+// Runs the payload through the device patcher in chunk-sized pieces and
+// records how many image bytes each chunk produces
+bool verifyPayload(const std::vector<uint8_t> &payload, bool delta, const std::vector<uint8_t> &base,
+                   const std::vector<uint8_t> &target, size_t chunk_len, std::vector<uint32_t> &produced)
+{
+  VerifyContext ctx = {&base, {}};
+  OtaPatchIo io = {
+    [](void *c, uint32_t offset, uint8_t *buffer, size_t length) {
+      const std::vector<uint8_t> &source = *static_cast<VerifyContext *>(c)->base;
+      if (offset + length > source.size())
+      {
+        return false;
+      }
+      memcpy(buffer, &source[offset], length);
+      return true;
+    },
+    [](void *c, const uint8_t *data, size_t length) {
+      std::vector<uint8_t> &output = static_cast<VerifyContext *>(c)->output;
+      output.insert(output.end(), data, data + length);
+      return true;
+    },
+    &ctx,
+  };
+
+  OtaDeltaPatcher patcher;
+  patcher.begin(io, delta, static_cast<uint32_t>(target.size()));
+  produced.clear();
+  for (size_t offset = 0; offset < payload.size(); offset += chunk_len)
+  {
+    const size_t take = payload.size() - offset < chunk_len ? payload.size() - offset : chunk_len;
+    const uint32_t before = patcher.written();
+    if (!patcher.feed(&payload[offset], take))
+    {
+      fprintf(stderr, "patcher rejected payload: %s\n", patcher.error());
+      return false;
+    }
+    produced.push_back(patcher.written() - before);
+  }
+  return patcher.complete() && ctx.output == target;
+}
+
+// ---- Publishing ----
+
+bool readFile(const std::string &path, std::vector<uint8_t> &data)
+{
+  FILE *file = fopen(path.c_str(), "rb");
+  if (!file)
+  {
+    return false;
+  }
+  uint8_t buffer[4096];
+  size_t got = 0;
+  while ((got = fread(buffer, 1, sizeof(buffer), file)) > 0)
+  {
+    data.insert(data.end(), buffer, buffer + got);
+  }
+  fclose(file);
+  return true;
+}
+
+bool writeFile(const std::string &path, const uint8_t *data, size_t len)
+{
+  FILE *file = fopen(path.c_str(), "wb");
+  if (!file)
+  {
+    return false;
+  }
+  const bool ok = fwrite(data, 1, len, file) == len;
+  return fclose(file) == 0 && ok;
+}
+
+// ECDSA P-256 / SHA-256 signature (DER) over the manifest text, made by openssl
+bool signManifest(const std::string &key_path, const std::string &text, std::vector<uint8_t> &signature)
+{
+  char path[] = "/tmp/ota_manifest_XXXXXX";
+  const int fd = mkstemp(path);
+  if (fd < 0)
+  {
+    return false;
+  }
+  const bool written = write(fd, text.data(), text.size()) == static_cast<ssize_t>(text.size());
+  close(fd);
+
+  bool ok = false;
+  if (written)
+  {
+    const std::string command = "openssl dgst -sha256 -sign '" + key_path + "' '" + path + "'";
+    FILE *pipe = popen(command.c_str(), "r");
+    if (pipe)
+    {
+      uint8_t buffer[256];
+      size_t got = 0;
+      while ((got = fread(buffer, 1, sizeof(buffer), pipe)) > 0)
+      {
+        signature.insert(signature.end(), buffer, buffer + got);
+      }
+      ok = pclose(pipe) == 0 && !signature.empty();
+    }
+  }
+  unlink(path);
+  return ok;
+}
+
+// Appends to the manifest text; false if it would not fit
+bool appendManifest(char *manifest, size_t size, size_t &written, const char *format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  const int added = vsnprintf(&manifest[written], size - written, format, args);
+  va_end(args);
+  if (added < 0 || static_cast<size_t>(added) >= size - written)
+  {
+    return false;
+  }
+  written += static_cast<size_t>(added);
+  return true;
+}
+
+// Publishes the manifest and every chunk over one connection, QoS 1 with a
+// PUBACK wait per message, so a dropped connection fails the run
+class MqttPublisher
+{
+public:
+  ~MqttPublisher() { disconnect(); }
+
+  bool connect(const std::string &host, const std::string &port, const std::string &client_id)
+  {
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *addresses = nullptr;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0)
+    {
+      return false;
+    }
+    for (addrinfo *ai = addresses; ai && fd_ < 0; ai = ai->ai_next)
+    {
+      fd_ = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+      if (fd_ >= 0 && ::connect(fd_, ai->ai_addr, ai->ai_addrlen) != 0)
+      {
+        close(fd_);
+        fd_ = -1;
+      }
+    }
+    freeaddrinfo(addresses);
+    if (fd_ < 0)
+    {
+      return false;
+    }
+    const timeval timeout = {MQTT_ACK_TIMEOUT_S, 0};
+    setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    const int one = 1;
+    setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    // Protocol "MQTT" level 4, clean session, no login
+    std::vector<uint8_t> body = {0x00, 0x04, 'M', 'Q', 'T', 'T', 0x04, 0x02,
+                                 static_cast<uint8_t>(MQTT_KEEPALIVE_S >> 8), static_cast<uint8_t>(MQTT_KEEPALIVE_S)};
+    putString(body, client_id);
+    uint8_t connack[4];
+    return sendPacket(0x10, body) && readExact(connack, sizeof(connack)) && connack[0] == 0x20 &&
+           connack[1] == 0x02 && connack[3] == 0x00;
+  }
+
+  bool publish(const std::string &topic, const uint8_t *data, size_t len, bool retain)
+  {
+    const uint16_t packet_id = next_id_;
+    next_id_ = next_id_ == 0xffff ? 1 : next_id_ + 1;
+
+    std::vector<uint8_t> body;
+    putString(body, topic);
+    body.push_back(static_cast<uint8_t>(packet_id >> 8));
+    body.push_back(static_cast<uint8_t>(packet_id));
+    body.insert(body.end(), data, data + len);
+    uint8_t puback[4];
+    return sendPacket(static_cast<uint8_t>(0x32 | (retain ? 0x01 : 0x00)), body) &&
+           readExact(puback, sizeof(puback)) && puback[0] == 0x40 && puback[1] == 0x02 &&
+           puback[2] == static_cast<uint8_t>(packet_id >> 8) && puback[3] == static_cast<uint8_t>(packet_id);
+  }
+
+  void disconnect()
+  {
+    if (fd_ >= 0)
+    {
+      sendPacket(0xe0, {});
+      close(fd_);
+      fd_ = -1;
+    }
+  }
+
+private:
+  static void putString(std::vector<uint8_t> &out, const std::string &text)
+  {
+    out.push_back(static_cast<uint8_t>(text.size() >> 8));
+    out.push_back(static_cast<uint8_t>(text.size()));
+    out.insert(out.end(), text.begin(), text.end());
+  }
+
+  bool sendPacket(uint8_t type, const std::vector<uint8_t> &body)
+  {
+    std::vector<uint8_t> packet = {type};
+    size_t value = body.size();
+    do
+    {
+      const uint8_t digit = value % 128;
+      value /= 128;
+      packet.push_back(static_cast<uint8_t>(digit | (value ? 0x80 : 0x00)));
+    } while (value > 0);
+    packet.insert(packet.end(), body.begin(), body.end());
+
+    size_t sent = 0;
+    while (sent < packet.size())
+    {
+      const ssize_t n = send(fd_, &packet[sent], packet.size() - sent, MSG_NOSIGNAL);
+      if (n <= 0)
+      {
+        return false;
+      }
+      sent += static_cast<size_t>(n);
+    }
+    return true;
+  }
+
+  bool readExact(uint8_t *out, size_t len)
+  {
+    size_t got = 0;
+    while (got < len)
+    {
+      const ssize_t n = recv(fd_, &out[got], len - got, 0);
+      if (n <= 0)
+      {
+        return false;
+      }
+      got += static_cast<size_t>(n);
+    }
+    return true;
+  }
+
+  int fd_ = -1;
+  uint16_t next_id_ = 1;
+};
+
+void usage()
+{
+  fprintf(stderr,
+          "usage: ota_publish --image FILE --id N --version V --key PEM [--base FILE] [--role scanner|relay]\n"
+          "                   [--rollout 0-100] [--host H] [--port P] [--chunk BYTES] [--passes N]\n"
+          "                   [--interval-ms MS] [--write-kbps N] [--url URL --out DIR]\n");
+}
+
+bool parseArgs(int argc, char **argv, Options &opt)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    const std::string arg = argv[i];
+    if (i + 1 >= argc)
+    {
+      return false;
+    }
+    const char *value = argv[++i];
+    if (arg == "--image") opt.image_path = value;
+    else if (arg == "--base") opt.base_path = value;
+    else if (arg == "--key") opt.key_path = value;
+    else if (arg == "--id") opt.id = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+    else if (arg == "--version") opt.version = value;
+    else if (arg == "--role") opt.role = value;
+    else if (arg == "--rollout") opt.rollout = static_cast<unsigned>(strtoul(value, nullptr, 10));
+    else if (arg == "--host") opt.host = value;
+    else if (arg == "--port") opt.port = value;
+    else if (arg == "--chunk") opt.chunk_len = strtoul(value, nullptr, 10);
+    else if (arg == "--passes") opt.passes = static_cast<unsigned>(strtoul(value, nullptr, 10));
+    else if (arg == "--interval-ms") opt.interval_ms = static_cast<unsigned>(strtoul(value, nullptr, 10));
+    else if (arg == "--write-kbps") opt.write_kbps = static_cast<unsigned>(strtoul(value, nullptr, 10));
+    else if (arg == "--url") opt.url = value;
+    else if (arg == "--out") opt.out_dir = value;
+    else return false;
+  }
+  return !opt.image_path.empty() && opt.id != 0 && !opt.version.empty() && !opt.key_path.empty() &&
+         opt.rollout <= 100 && opt.chunk_len > 0 && opt.write_kbps > 0 && opt.url.empty() == opt.out_dir.empty();
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+  Options opt;
+  if (!parseArgs(argc, argv, opt))
+  {
+    usage();
+    return 2;
+  }
+
+  std::vector<uint8_t> image;
+  std::vector<uint8_t> base;
+  if (!readFile(opt.image_path, image) || image.empty() ||
+      (!opt.base_path.empty() && !readFile(opt.base_path, base)))
+  {
+    fprintf(stderr, "cannot read image or base file\n");
+    return 1;
+  }
+
+  // Prefer the delta only when it is actually smaller
+  bool delta = false;
+  std::vector<uint8_t> payload = image;
+  std::vector<uint32_t> produced;
+  if (!base.empty())
+  {
+    std::vector<uint8_t> candidate = buildDelta(base, image);
+    if (!verifyPayload(candidate, true, base, image, opt.chunk_len, produced))
+    {
+      fprintf(stderr, "delta self-check failed; refusing to publish\n");
+      return 1;
+    }
+    if (candidate.size() < image.size())
+    {
+      delta = true;
+      payload.swap(candidate);
+    }
+  }
+  if (!delta && !verifyPayload(payload, false, base, image, opt.chunk_len, produced))
+  {
+    fprintf(stderr, "full image self-check failed\n");
+    return 1;
+  }
+
+  char manifest[MANIFEST_LEN];
+  size_t written = 0;
+  bool fits = appendManifest(manifest, sizeof(manifest), written,
+                             "{\"id\":%u,\"version\":\"%s\",\"size\":%zu,\"sha256\":\"%s\",\"payload_size\":%zu,"
+                             "\"rollout\":%u",
+                             opt.id, opt.version.c_str(), image.size(), sha256Hex(image).c_str(), payload.size(),
+                             opt.rollout);
+  if (fits && delta)
+  {
+    fits = appendManifest(manifest, sizeof(manifest), written,
+                          ",\"delta\":true,\"base_size\":%zu,\"base_sha256\":\"%s\"", base.size(),
+                          sha256Hex(base).c_str());
+  }
+  if (fits && !opt.url.empty())
+  {
+    fits = appendManifest(manifest, sizeof(manifest), written, ",\"url\":\"%s\"", opt.url.c_str());
+  }
+
+  // The devices verify the signature over everything before ,"sig":
+  std::vector<uint8_t> signature;
+  if (fits && !signManifest(opt.key_path, std::string(manifest, written), signature))
+  {
+    fprintf(stderr, "signing the manifest failed (is openssl installed and %s a P-256 key?)\n",
+            opt.key_path.c_str());
+    return 1;
+  }
+  if (!fits || !appendManifest(manifest, sizeof(manifest), written, ",\"sig\":\"%s\"}",
+                               toHex(signature.data(), signature.size()).c_str()))
+  {
+    fprintf(stderr, "manifest does not fit in %zu bytes; shorten --version or --url\n", sizeof(manifest));
+    return 1;
+  }
+
+  printf("Image %zu bytes, payload %zu bytes (%s, %.1f%% of image)\n", image.size(), payload.size(),
+         delta ? "delta" : "full", 100.0 * payload.size() / image.size());
+  printf("Manifest: %s\n", manifest);
+
+  const std::string prefix = "RFID_OTA/" + opt.role;
+  if (!opt.out_dir.empty())
+  {
+    const std::string payload_path = opt.out_dir + "/payload.bin";
+    const std::string manifest_path = opt.out_dir + "/manifest.json";
+    if (!writeFile(payload_path, payload.data(), payload.size()) ||
+        !writeFile(manifest_path, reinterpret_cast<const uint8_t *>(manifest), strlen(manifest)))
+    {
+      fprintf(stderr, "cannot write %s\n", opt.out_dir.c_str());
+      return 1;
+    }
+    printf("Wrote %s and %s\n", payload_path.c_str(), manifest_path.c_str());
+  }
+
+  MqttPublisher mqtt;
+  if (!mqtt.connect(opt.host, opt.port, "ota_publish_" + std::to_string(getpid())))
+  {
+    fprintf(stderr, "cannot connect to the MQTT broker at %s:%s\n", opt.host.c_str(), opt.port.c_str());
+    return 1;
+  }
+  if (!mqtt.publish(prefix + "/manifest", reinterpret_cast<const uint8_t *>(manifest), written, true))
+  {
+    fprintf(stderr, "publishing manifest failed\n");
+    return 1;
+  }
+  if (!opt.url.empty())
+  {
+    return 0;
+  }
+
+  // Devices that miss a chunk rejoin at seq 0 on the next pass
+  const uint32_t chunks = static_cast<uint32_t>((payload.size() + opt.chunk_len - 1) / opt.chunk_len);
+  std::vector<uint8_t> message;
+  for (unsigned pass = 0; pass < opt.passes; pass++)
+  {
+    const auto pass_start = std::chrono::steady_clock::now();
+    for (uint32_t seq = 0; seq < chunks; seq++)
+    {
+      const size_t offset = static_cast<size_t>(seq) * opt.chunk_len;
+      const size_t take = payload.size() - offset < opt.chunk_len ? payload.size() - offset : opt.chunk_len;
+      message.assign(OTA_CHUNK_HEADER_LEN, 0);
+      otaWriteChunkHeader(message.data(), opt.id, seq);
+      message.insert(message.end(), payload.begin() + offset, payload.begin() + offset + take);
+      if (!mqtt.publish(prefix + "/chunk", message.data(), message.size(), false))
+      {
+        fprintf(stderr, "publishing chunk %u failed\n", seq);
+        return 1;
+      }
+      // Give the devices time to write what this chunk expands to
+      const uint64_t write_ms = static_cast<uint64_t>(produced[seq]) * 1000 / (opt.write_kbps * 1024ull);
+      std::this_thread::sleep_for(std::chrono::milliseconds(std::max<uint64_t>(opt.interval_ms, write_ms)));
+    }
+    const double seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - pass_start).count();
+    printf("Pass %u/%u: %u chunks in %.1f s\n", pass + 1, opt.passes, chunks, seconds);
+  }
+  printf("Watch progress with: mosquitto_sub -h %s -p %s -v -t '%s/status/#'\n", opt.host.c_str(),
+         opt.port.c_str(), prefix.c_str());
+  return 0;
+}
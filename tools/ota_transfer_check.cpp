@@ -0,0 +1,550 @@
+/*
+ * Host check for OTA chunk sequencing (include/ota_transfer.h).
+ *
+ * Publishes chunk passes the way tools/ota_publish.cpp does through an
+ * in-process broker, and receives them with a device stand-in that makes the
+ * same decisions as OtaUpdater::handleChunk() and its loop(), writing
+ * through OtaDeltaPatcher into memory instead of an OTA partition. COPY ops
+ * of a delta run in slices from poll(), with the chunk bytes behind them held
+ * in a backlog, as on the device. The link
+ * between the two can drop, duplicate or reorder chunks, and each scenario
+ * checks the outcome: image installed byte for byte, how many sessions were
+ * opened and why attempts were aborted.
+ *
+ * Build from the repository root:
+ *   g++ -O2 -std=c++17 -Iinclude tools/ota_transfer_check.cpp -o ota_transfer_check
+ *
+ * Examples:
+ *   ./ota_transfer_check                      # 200 KB image, 768-byte chunks
+ *   ./ota_transfer_check --size 1000000 --chunk 512
+ *
+ * Exits with 1 if any scenario fails.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ota_delta.h"
+#include "ota_transfer.h"
+
+namespace
+{
+constexpr unsigned long CHUNK_INTERVAL_MS = 20;      // ota_publish --interval-ms default
+constexpr unsigned long CHUNK_TIMEOUT_MS = 30000;    // OTA_CHUNK_TIMEOUT_MS in ota_update.h
+constexpr size_t PATCH_SLICE_LEN = 4096;             // OTA_PATCH_SLICE_LEN in ota_update.h
+constexpr size_t BACKLOG_LEN = 4096;                 // OTA_BACKLOG_LEN in ota_update.h
+constexpr uint32_t RELEASE_ID = 7;
+
+struct Options
+{
+  size_t image_len = 200 * 1024;
+  size_t chunk_len = 768;
+  uint32_t seed = 1;
+};
+
+// ---- Broker stand-in: in-order delivery over a link that can misbehave ----
+
+class LocalBroker
+{
+public:
+  using Handler = std::function<void(const uint8_t *payload, size_t length)>;
+  // Returns how many copies of the n-th published message are delivered
+  using Link = std::function<unsigned(uint64_t index)>;
+
+  void subscribe(Handler handler) { handler_ = std::move(handler); }
+  void setLink(Link link) { link_ = std::move(link); }
+
+  void publish(const uint8_t *payload, size_t length)
+  {
+    const unsigned copies = link_ ? link_(published_) : 1;
+    for (unsigned i = 0; i < copies; i++)
+    {
+      queue_.emplace_back(payload, payload + length);
+    }
+    published_++;
+  }
+
+  void pump()
+  {
+    while (!queue_.empty())
+    {
+      const std::vector<uint8_t> message = std::move(queue_.front());
+      queue_.pop_front();
+      if (handler_)
+      {
+        handler_(message.data(), message.size());
+      }
+    }
+  }
+
+private:
+  Handler handler_;
+  Link link_;
+  std::deque<std::vector<uint8_t>> queue_;
+  uint64_t published_ = 0;
+};
+
+// ---- Device stand-in: OtaUpdater's chunk handling without the flash ----
+
+enum class DeviceState
+{
+  Waiting,
+  Receiving,
+  Installed,
+  Failed,
+};
+
+class DeviceStandIn
+{
+public:
+  // base = nullptr for a full image, otherwise the payload is a delta against it
+  void expect(uint32_t id, uint32_t payload_size, uint32_t image_size, const std::vector<uint8_t> *base)
+  {
+    transfer_.expect(id, payload_size);
+    image_size_ = image_size;
+    base_ = base;
+    state_ = DeviceState::Waiting;
+  }
+
+  void onChunk(const uint8_t *payload, size_t length, unsigned long now)
+  {
+    now_ = now;
+    if (state_ != DeviceState::Waiting && state_ != DeviceState::Receiving)
+    {
+      return;
+    }
+
+    const OtaChunk chunk = transfer_.classify(payload, length);
+    switch (chunk.action)
+    {
+    case OtaChunkAction::Ignore:
+      ignored_++;
+      return;
+    case OtaChunkAction::Missed:
+      abort("missed", true);
+      return;
+    case OtaChunkAction::Overflow:
+      abort("overflow", false);
+      return;
+    case OtaChunkAction::Start:
+      startSession();
+      break;
+    case OtaChunkAction::Feed:
+      break;
+    }
+
+    transfer_.advance(chunk.length, now_, true);
+    size_t used = 0;
+    if (!patchPending())
+    {
+      used = patcher_.consume(chunk.data, chunk.length);
+      if (patcher_.failed())
+      {
+        abort(patcher_.error(), false);
+        return;
+      }
+    }
+    if (used < chunk.length)
+    {
+      if (chunk.length - used > BACKLOG_LEN - backlog_.size())
+      {
+        abort("behind", true);
+        return;
+      }
+      backlog_.insert(backlog_.end(), chunk.data + used, chunk.data + chunk.length);
+    }
+    finishIfComplete();
+  }
+
+  void poll(unsigned long now)
+  {
+    now_ = now;
+    if (state_ != DeviceState::Receiving)
+    {
+      return;
+    }
+    if (patchPending())
+    {
+      drainPatch();
+      finishIfComplete();
+    }
+    else if (transfer_.stalled(now, CHUNK_TIMEOUT_MS))
+    {
+      abort("timeout", true);
+    }
+  }
+
+  bool patchPending() const { return patcher_.copying() || !backlog_.empty(); }
+  DeviceState state() const { return state_; }
+  const std::vector<uint8_t> &output() const { return output_; }
+  unsigned sessions() const { return sessions_; }
+  unsigned ignored() const { return ignored_; }
+  unsigned patchPolls() const { return patch_polls_; }
+  const std::vector<std::string> &aborts() const { return aborts_; }
+
+private:
+  void startSession()
+  {
+    output_.clear();
+    backlog_.clear();
+    const OtaPatchIo io = {
+      [](void *ctx, uint32_t offset, uint8_t *buffer, size_t length) {
+        const std::vector<uint8_t> *base = static_cast<DeviceStandIn *>(ctx)->base_;
+        if (!base || offset + length > base->size())
+        {
+          return false;
+        }
+        memcpy(buffer, &(*base)[offset], length);
+        return true;
+      },
+      [](void *ctx, const uint8_t *data, size_t length) {
+        std::vector<uint8_t> &output = static_cast<DeviceStandIn *>(ctx)->output_;
+        output.insert(output.end(), data, data + length);
+        return true;
+      },
+      this,
+    };
+    patcher_.begin(io, base_ != nullptr, image_size_);
+    transfer_.open(now_);
+    sessions_++;
+    state_ = DeviceState::Receiving;
+  }
+
+  // At most PATCH_SLICE_LEN image bytes per poll, as OtaUpdater::drainPatch()
+  void drainPatch()
+  {
+    patch_polls_++;
+    const uint32_t stop = patcher_.written() + PATCH_SLICE_LEN;
+    while (patchPending() && patcher_.written() < stop)
+    {
+      if (patcher_.copying())
+      {
+        patcher_.pump(stop - patcher_.written());
+      }
+      else
+      {
+        const size_t take = std::min<size_t>(backlog_.size(), stop - patcher_.written());
+        backlog_.erase(backlog_.begin(), backlog_.begin() + patcher_.consume(backlog_.data(), take));
+      }
+      if (patcher_.failed())
+      {
+        abort(patcher_.error(), false);
+        return;
+      }
+    }
+    transfer_.advance(0, now_, false);
+  }
+
+  void finishIfComplete()
+  {
+    if (state_ == DeviceState::Receiving && !patchPending() && transfer_.complete())
+    {
+      transfer_.clear();
+      state_ = patcher_.complete() ? DeviceState::Installed : DeviceState::Failed;
+    }
+  }
+
+  // retry = true keeps the release and rejoins on the next pass
+  void abort(const char *reason, bool retry)
+  {
+    aborts_.push_back(reason);
+    backlog_.clear();
+    if (retry)
+    {
+      transfer_.close();
+      state_ = DeviceState::Waiting;
+    }
+    else
+    {
+      transfer_.clear();
+      state_ = DeviceState::Failed;
+    }
+  }
+
+  OtaTransfer transfer_;
+  OtaDeltaPatcher patcher_;
+  std::vector<uint8_t> output_;
+  std::vector<uint8_t> backlog_;
+  const std::vector<uint8_t> *base_ = nullptr;
+  DeviceState state_ = DeviceState::Waiting;
+  uint32_t image_size_ = 0;
+  unsigned patch_polls_ = 0;
+  unsigned long now_ = 0;
+  unsigned sessions_ = 0;
+  unsigned ignored_ = 0;
+  std::vector<std::string> aborts_;
+};
+
+// ---- Publisher: chunk passes as in tools/ota_publish.cpp ----
+
+std::vector<uint8_t> chunkMessage(uint32_t id, uint32_t seq, const std::vector<uint8_t> &payload, size_t chunk_len)
+{
+  const size_t offset = static_cast<size_t>(seq) * chunk_len;
+  const size_t take = payload.size() - offset < chunk_len ? payload.size() - offset : chunk_len;
+  std::vector<uint8_t> message(OTA_CHUNK_HEADER_LEN + take);
+  otaWriteChunkHeader(message.data(), id, seq);
+  memcpy(&message[OTA_CHUNK_HEADER_LEN], &payload[offset], take);
+  return message;
+}
+
+struct Scenario
+{
+  const char *name;
+  unsigned passes = 1;
+  std::function<unsigned(uint64_t index)> link;  // copies per published chunk, default 1
+  std::vector<std::pair<uint32_t, uint32_t>> swaps; // seq pairs published in swapped order (first pass)
+  uint32_t stall_after = 0;        // stop the first pass after this many chunks, 0 = never
+  uint32_t foreign_every = 0;      // interleave a chunk of another release every n chunks
+  uint32_t manifest_payload = 0;   // payload_size in the manifest, 0 = actual size
+  bool delta = false;              // send the delta payload; its copies must span several polls
+
+  // expected outcome
+  DeviceState state = DeviceState::Installed;
+  unsigned sessions = 1;
+  std::vector<std::string> aborts;
+};
+
+struct Outcome
+{
+  DeviceState state;
+  unsigned sessions;
+  std::vector<std::string> aborts;
+  bool image_ok;
+  unsigned patch_polls;
+};
+
+// Same image with a changed stretch in the middle, and the delta from it:
+// COPY | INSERT | COPY
+void buildDeltaCase(const std::vector<uint8_t> &image, std::vector<uint8_t> &base, std::vector<uint8_t> &delta)
+{
+  const size_t changed_at = image.size() / 2;
+  const size_t changed_len = 1000;
+  base = image;
+  for (size_t i = changed_at; i < changed_at + changed_len; i++)
+  {
+    base[i] ^= 0x5a;
+  }
+
+  auto putU32 = [&](uint32_t value) {
+    for (int i = 0; i < 4; i++)
+    {
+      delta.push_back(static_cast<uint8_t>(value >> (8 * i)));
+    }
+  };
+  delta = {'R', 'D', 'L', 'T', OTA_DELTA_VERSION, 0, 0, 0};
+  putU32(static_cast<uint32_t>(base.size()));
+  putU32(static_cast<uint32_t>(image.size()));
+  delta.push_back(OTA_DELTA_OP_COPY);
+  putU32(0);
+  putU32(static_cast<uint32_t>(changed_at));
+  delta.push_back(OTA_DELTA_OP_INSERT);
+  putU32(static_cast<uint32_t>(changed_len));
+  delta.insert(delta.end(), image.begin() + changed_at, image.begin() + changed_at + changed_len);
+  delta.push_back(OTA_DELTA_OP_COPY);
+  putU32(static_cast<uint32_t>(changed_at + changed_len));
+  putU32(static_cast<uint32_t>(image.size() - changed_at - changed_len));
+}
+
+Outcome run(const Scenario &scenario, const std::vector<uint8_t> &image, const std::vector<uint8_t> &base,
+            const std::vector<uint8_t> &delta, size_t chunk_len)
+{
+  LocalBroker broker;
+  DeviceStandIn device;
+  unsigned long now = 0;
+  broker.subscribe([&](const uint8_t *payload, size_t length) { device.onChunk(payload, length, now); });
+  broker.setLink(scenario.link);
+
+  const std::vector<uint8_t> &payload = scenario.delta ? delta : image;
+  const uint32_t payload_size =
+    scenario.manifest_payload ? scenario.manifest_payload : static_cast<uint32_t>(payload.size());
+  device.expect(RELEASE_ID, payload_size, scenario.delta ? static_cast<uint32_t>(image.size()) : payload_size,
+                scenario.delta ? &base : nullptr);
+
+  const uint32_t chunks = static_cast<uint32_t>((payload.size() + chunk_len - 1) / chunk_len);
+  for (unsigned pass = 0; pass < scenario.passes && device.state() != DeviceState::Installed; pass++)
+  {
+    std::vector<uint32_t> order(chunks);
+    for (uint32_t seq = 0; seq < chunks; seq++)
+    {
+      order[seq] = seq;
+    }
+    if (pass == 0)
+    {
+      for (const auto &swap : scenario.swaps)
+      {
+        std::swap(order[swap.first], order[swap.second]);
+      }
+    }
+
+    for (uint32_t i = 0; i < chunks; i++)
+    {
+      if (pass == 0 && scenario.stall_after && i == scenario.stall_after)
+      {
+        now += CHUNK_TIMEOUT_MS + 1; // publisher went quiet
+        device.poll(now);
+        break;
+      }
+      if (scenario.foreign_every && i % scenario.foreign_every == 0)
+      {
+        const std::vector<uint8_t> foreign = chunkMessage(RELEASE_ID + 1, i, payload, chunk_len);
+        broker.publish(foreign.data(), foreign.size());
+      }
+      const std::vector<uint8_t> message = chunkMessage(RELEASE_ID, order[i], payload, chunk_len);
+      broker.publish(message.data(), message.size());
+      broker.pump();
+      now += CHUNK_INTERVAL_MS;
+      device.poll(now);
+    }
+
+    // The device keeps patching from loop() after the last chunk
+    while (device.state() == DeviceState::Receiving && device.patchPending())
+    {
+      now += CHUNK_INTERVAL_MS;
+      device.poll(now);
+    }
+  }
+
+  return {device.state(), device.sessions(), device.aborts(),
+          device.state() == DeviceState::Installed && device.output() == image, device.patchPolls()};
+}
+
+const char *stateName(DeviceState state)
+{
+  switch (state)
+  {
+  case DeviceState::Waiting:
+    return "waiting";
+  case DeviceState::Receiving:
+    return "receiving";
+  case DeviceState::Installed:
+    return "installed";
+  case DeviceState::Failed:
+    return "failed";
+  }
+  return "?";
+}
+
+std::string join(const std::vector<std::string> &items)
+{
+  std::string text;
+  for (const std::string &item : items)
+  {
+    text += (text.empty() ? "" : ",") + item;
+  }
+  return text.empty() ? "-" : text;
+}
+
+void usage()
+{
+  fprintf(stderr, "usage: ota_transfer_check [--size BYTES] [--chunk BYTES] [--seed N]\n");
+}
+
+bool parseArgs(int argc, char **argv, Options &opt)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    const std::string arg = argv[i];
+    if (i + 1 >= argc)
+    {
+      return false;
+    }
+    const char *value = argv[++i];
+    if (arg == "--size") opt.image_len = strtoul(value, nullptr, 10);
+    else if (arg == "--chunk") opt.chunk_len = strtoul(value, nullptr, 10);
+    else if (arg == "--seed") opt.seed = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+    else return false;
+  }
+  // The scenarios reorder and drop chunks up to seq 6
+  return opt.chunk_len > 0 && opt.image_len >= opt.chunk_len * 8;
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+  Options opt;
+  if (!parseArgs(argc, argv, opt))
+  {
+    usage();
+    return 2;
+  }
+
+  std::mt19937 rng(opt.seed);
+  std::vector<uint8_t> image(opt.image_len);
+  for (uint8_t &byte_value : image)
+  {
+    byte_value = static_cast<uint8_t>(rng());
+  }
+
+  std::vector<uint8_t> base;
+  std::vector<uint8_t> delta;
+  buildDeltaCase(image, base, delta);
+
+  std::vector<Scenario> scenarios(9);
+  scenarios[0].name = "clean pass";
+
+  scenarios[1].name = "duplicated chunks";
+  scenarios[1].link = [](uint64_t index) { return index % 3 == 0 ? 2u : 1u; };
+
+  scenarios[2].name = "dropped chunk, rejoin next pass";
+  scenarios[2].passes = 2;
+  scenarios[2].link = [](uint64_t index) { return index == 5 ? 0u : 1u; };
+  scenarios[2].sessions = 2;
+  scenarios[2].aborts = {"missed"};
+
+  scenarios[3].name = "joined mid-pass";
+  scenarios[3].passes = 2;
+  scenarios[3].link = [](uint64_t index) { return index < 4 ? 0u : 1u; };
+
+  scenarios[4].name = "reordered chunks";
+  scenarios[4].passes = 2;
+  scenarios[4].swaps = {{3, 4}};
+  scenarios[4].sessions = 2;
+  scenarios[4].aborts = {"missed"};
+
+  scenarios[5].name = "publisher stalled";
+  scenarios[5].passes = 2;
+  scenarios[5].stall_after = 6;
+  scenarios[5].sessions = 2;
+  scenarios[5].aborts = {"timeout"};
+
+  scenarios[6].name = "other release interleaved";
+  scenarios[6].foreign_every = 2;
+
+  scenarios[7].name = "payload larger than manifest";
+  scenarios[7].manifest_payload = static_cast<uint32_t>(opt.image_len - 1);
+  scenarios[7].state = DeviceState::Failed;
+  scenarios[7].aborts = {"overflow"};
+
+  scenarios[8].name = "delta, copies sliced";
+  scenarios[8].delta = true;
+
+  printf("Image %zu bytes in %zu-byte chunks\n", opt.image_len, opt.chunk_len);
+  unsigned failures = 0;
+  for (const Scenario &scenario : scenarios)
+  {
+    const Outcome outcome = run(scenario, image, base, delta, opt.chunk_len);
+    const bool ok = outcome.state == scenario.state && outcome.sessions == scenario.sessions &&
+                    outcome.aborts == scenario.aborts &&
+                    (scenario.state != DeviceState::Installed || outcome.image_ok) &&
+                    (!scenario.delta || outcome.patch_polls >= opt.image_len / PATCH_SLICE_LEN);
+    printf("%s  %-32s %s, %u session(s), aborts: %s%s\n", ok ? "PASS" : "FAIL", scenario.name,
+           stateName(outcome.state), outcome.sessions, join(outcome.aborts).c_str(),
+           outcome.state == DeviceState::Installed && !outcome.image_ok ? " (image differs)" : "");
+    failures += ok ? 0 : 1;
+  }
+
+  if (failures)
+  {
+    printf("%u scenario(s) failed\n", failures);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,596 @@
+/*
+ * Host replay harness: re-drives recorded taps through the scanner and relay
+ * decision logic, compiled natively from the firmware headers.
+ *
+ * Each tap of a trace written by php-backend/tools/export_log_trace.php
+ * goes through the same steps as on the devices:
+ *   formatUid/urlEncode -> registry cache lookup (registry_sync.h)
+ *   -> local decision from the cache (localDecision, planRelayCommands)
+ *   -> backend stand-in (check_rfid.php's toggle, registry deltas)
+ *   -> parseCheckResponse, correcting command if it disagrees (scan_logic.h)
+ *   -> in-process broker stand-in -> parseRelayCommand/RelayScheduler
+ *   -> relay status -> RelayAckTracker on the scanner side
+ *
+ * It reports throughput, per-tap host processing time percentiles and
+ * decisions that differ from the recorded rfid_status. Processing time is
+ * host wall time of the in-process calls from tap to relay ack. It has no
+ * network hops (HTTP, broker) in it, so it is not the latency a card holder
+ * sees; use the firmware's tap->ack telemetry for that.
+ *
+ * The backend stand-in rebuilds each card's state from its first recorded
+ * status and then toggles it on every tap, as check_rfid.php does. A
+ * decision mismatch therefore mostly measures the stand-in: a card
+ * registered or removed inside the trace window (the export only knows
+ * today's rfid_reg), or a status changed from the dashboard between two
+ * taps, shows up as a difference even when the firmware logic is right.
+ * "already at the backend stand-in" counts those.
+ *
+ * Build from the repository root. ArduinoJson comes from PlatformIO's
+ * library folder after one firmware build:
+ *   g++ -O2 -std=c++17 -Iinclude -I.pio/libdeps/esp32_rfid/ArduinoJson/src \
+ *       tools/replay_trace.cpp -o replay_trace
+ *
+ * Examples:
+ *   ./replay_trace --trace taps.trace                  # as fast as possible
+ *   ./replay_trace --trace taps.trace --speed 60       # one hour per minute
+ *   ./replay_trace --trace taps.trace --pulse 3000     # pulse mode on the relay
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "registry_sync.h"
+#include "relay_protocol.h"
+#include "relay_scheduler.h"
+#include "scan_logic.h"
+
+namespace
+{
+constexpr size_t TRACE_HEADER_LEN = 16;
+constexpr size_t TRACE_RECORD_LEN = 16;
+constexpr uint8_t TRACE_VERSION = 1;
+constexpr uint8_t TRACE_FLAG_STATUS = 0x01;
+constexpr uint8_t TRACE_FLAG_REGISTERED = 0x02;
+constexpr uint8_t REPLAY_CHANNEL = 0;
+constexpr size_t MAX_REPORTED_MISMATCHES = 10;
+constexpr const char *REGISTRY_TOPIC = "RFID_REG_DELTA";
+
+using Clock = std::chrono::steady_clock;
+
+struct Options
+{
+  std::string trace_path;
+  double speed = 0;               // 0 = as fast as possible, 1 = real time
+  unsigned long max_gap_ms = 2000; // longest wall-clock wait between two taps
+  uint32_t pulse_ms = 0;           // scanner unlock_pulse setting
+};
+
+struct Tap
+{
+  uint32_t delta_ms;
+  bool status;     // recorded rfid_status
+  bool registered; // card is in rfid_reg
+  uint8_t uid_len;
+  uint8_t uid[REGISTRY_MAX_UID_LEN];
+};
+
+uint32_t readU32(const uint8_t *p)
+{
+  return static_cast<uint32_t>(p[0]) | (static_cast<uint32_t>(p[1]) << 8) | (static_cast<uint32_t>(p[2]) << 16) |
+         (static_cast<uint32_t>(p[3]) << 24);
+}
+
+void writeU32(std::vector<uint8_t> &out, uint32_t value)
+{
+  for (int i = 0; i < 4; i++)
+  {
+    out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+  }
+}
+
+bool readTrace(const std::string &path, std::vector<Tap> &taps, uint32_t &start_unix)
+{
+  FILE *file = fopen(path.c_str(), "rb");
+  if (!file)
+  {
+    return false;
+  }
+
+  uint8_t header[TRACE_HEADER_LEN];
+  bool ok = fread(header, 1, sizeof(header), file) == sizeof(header) && memcmp(header, "RTRC", 4) == 0 &&
+            header[4] == TRACE_VERSION;
+  const uint32_t count = ok ? readU32(&header[8]) : 0;
+  start_unix = ok ? readU32(&header[12]) : 0;
+
+  taps.clear();
+  taps.reserve(count);
+  uint8_t record[TRACE_RECORD_LEN];
+  for (uint32_t i = 0; ok && i < count; i++)
+  {
+    ok = fread(record, 1, sizeof(record), file) == sizeof(record) && record[5] > 0 &&
+         record[5] <= REGISTRY_MAX_UID_LEN;
+    if (ok)
+    {
+      Tap tap = {};
+      tap.delta_ms = readU32(record);
+      tap.status = (record[4] & TRACE_FLAG_STATUS) != 0;
+      tap.registered = (record[4] & TRACE_FLAG_REGISTERED) != 0;
+      tap.uid_len = record[5];
+      memcpy(tap.uid, &record[6], tap.uid_len);
+      taps.push_back(tap);
+    }
+  }
+  fclose(file);
+  return ok;
+}
+
+// ---- Broker stand-in: retained messages, in-order delivery ----
+
+class LocalBroker
+{
+public:
+  using Handler = std::function<void(const std::string &topic, const uint8_t *payload, size_t length)>;
+
+  // A filter ending in '#' matches every topic with that prefix
+  void subscribe(const std::string &filter, Handler handler)
+  {
+    subscribers_.push_back({filter, std::move(handler)});
+    for (const auto &item : retained_)
+    {
+      if (matches(filter, item.first))
+      {
+        subscribers_.back().handler(item.first, item.second.data(), item.second.size());
+      }
+    }
+  }
+
+  void publish(const std::string &topic, const uint8_t *payload, size_t length, bool retain)
+  {
+    std::vector<uint8_t> bytes(payload, payload + length);
+    if (retain)
+    {
+      retained_[topic] = bytes;
+    }
+    queue_.push_back({topic, std::move(bytes)});
+    published_++;
+  }
+
+  // Delivers until the queue is empty, including messages published by handlers
+  void pump()
+  {
+    while (!queue_.empty())
+    {
+      const Message message = std::move(queue_.front());
+      queue_.pop_front();
+      for (const Subscriber &subscriber : subscribers_)
+      {
+        if (matches(subscriber.filter, message.topic))
+        {
+          subscriber.handler(message.topic, message.payload.data(), message.payload.size());
+        }
+      }
+    }
+  }
+
+  uint64_t published() const { return published_; }
+
+private:
+  struct Subscriber
+  {
+    std::string filter;
+    Handler handler;
+  };
+
+  struct Message
+  {
+    std::string topic;
+    std::vector<uint8_t> payload;
+  };
+
+  static bool matches(const std::string &filter, const std::string &topic)
+  {
+    if (!filter.empty() && filter.back() == '#')
+    {
+      return topic.compare(0, filter.size() - 1, filter, 0, filter.size() - 1) == 0;
+    }
+    return filter == topic;
+  }
+
+  std::vector<Subscriber> subscribers_;
+  std::map<std::string, std::vector<uint8_t>> retained_;
+  std::deque<Message> queue_;
+  uint64_t published_ = 0;
+};
+
+// ---- Backend stand-in: check_rfid.php plus registry deltas ----
+
+class BackendStandIn
+{
+public:
+  explicit BackendStandIn(LocalBroker &broker) : broker_(broker) {}
+
+  void seed(const std::map<std::string, bool> &cards) { cards_ = cards; }
+
+  // Full registry as deltas from rev 0, for the scanner's boot-time sync
+  std::vector<std::vector<uint8_t>> snapshot()
+  {
+    std::vector<std::vector<uint8_t>> deltas;
+    auto it = cards_.begin();
+    while (it != cards_.end())
+    {
+      std::vector<std::pair<std::string, bool>> batch;
+      for (; it != cards_.end() && batch.size() < REGISTRY_MAX_DELTA_ENTRIES; ++it)
+      {
+        batch.push_back(*it);
+      }
+      deltas.push_back(encodeDelta(revision_, revision_ + 1, batch));
+      revision_++;
+    }
+    return deltas;
+  }
+
+  // GET check_rfid.php?rfid_data=<encoded>; writes the JSON body
+  void check(const char *encoded_uid, std::string &body)
+  {
+    const std::string uid = urlDecode(encoded_uid);
+    int status = 0;
+    bool found = false;
+    auto it = cards_.find(uid);
+    if (it != cards_.end())
+    {
+      // Registered cards toggle on every tap, like the real endpoint
+      found = true;
+      it->second = !it->second;
+      status = it->second ? 1 : 0;
+      const std::vector<uint8_t> delta = encodeDelta(revision_, revision_ + 1, {{uid, it->second}});
+      revision_++;
+      broker_.publish(REGISTRY_TOPIC, delta.data(), delta.size(), true);
+    }
+
+    char json[160];
+    snprintf(json, sizeof(json), "{\"status\":%d,\"found\":%s,\"message\":\"%s\",\"rfid_data\":\"%s\"}", status,
+             found ? "true" : "false", found ? (status ? "1" : "0") : "RFID NOT FOUND", uid.c_str());
+    body = json;
+  }
+
+private:
+  static std::string urlDecode(const char *input)
+  {
+    std::string out;
+    for (size_t i = 0; input[i] != '\0'; i++)
+    {
+      if (input[i] == '%' && input[i + 1] && input[i + 2])
+      {
+        const char hex[3] = {input[i + 1], input[i + 2], '\0'};
+        out.push_back(static_cast<char>(strtoul(hex, nullptr, 16)));
+        i += 2;
+      }
+      else
+      {
+        out.push_back(input[i]);
+      }
+    }
+    return out;
+  }
+
+  // Same layout as php-backend/config/registry_sync.php
+  static std::vector<uint8_t> encodeDelta(uint32_t from_rev, uint32_t to_rev,
+                                          const std::vector<std::pair<std::string, bool>> &cards)
+  {
+    std::vector<uint8_t> out = {'R', 'D', REGISTRY_DELTA_VERSION, 0};
+    writeU32(out, from_rev);
+    writeU32(out, to_rev);
+    out.push_back(static_cast<uint8_t>(cards.size()));
+    out.push_back(static_cast<uint8_t>(cards.size() >> 8));
+    for (const auto &card : cards)
+    {
+      uint8_t uid[REGISTRY_MAX_UID_LEN];
+      uint8_t len = 0;
+      for (size_t i = 0; i + 2 <= card.first.size() && len < sizeof(uid); i += 3)
+      {
+        uid[len++] = static_cast<uint8_t>(strtoul(card.first.substr(i, 2).c_str(), nullptr, 16));
+      }
+      out.push_back(card.second ? REGISTRY_ENTRY_FLAG_STATUS : 0);
+      out.push_back(len);
+      out.insert(out.end(), uid, uid + len);
+    }
+    return out;
+  }
+
+  LocalBroker &broker_;
+  std::map<std::string, bool> cards_;
+  uint32_t revision_ = 0;
+};
+
+// ---- Relay side ----
+
+class RelayStandIn
+{
+public:
+  explicit RelayStandIn(LocalBroker &broker) : broker_(broker)
+  {
+    scheduler_.begin(1, [](uint8_t, bool, void *) {}, nullptr);
+  }
+
+  void onCommand(const uint8_t *payload, size_t length, int64_t now_us)
+  {
+    RelayCommand cmd;
+    if (!parseRelayCommand(payload, length, cmd))
+    {
+      rejected_++;
+      return;
+    }
+    if (scheduler_.submit(cmd, now_us) != RelaySubmitResult::InvalidChannel)
+    {
+      publishStatus(cmd.channel);
+    }
+  }
+
+  // Runs the timer wheel up to now_us; skips idle time when nothing pulses
+  void advance(int64_t now_us)
+  {
+    while (scheduler_.pulsing(REPLAY_CHANNEL) && tick_us_ + RELAY_TICK_MS * 1000 <= now_us)
+    {
+      tick_us_ += RELAY_TICK_MS * 1000;
+      scheduler_.tick(tick_us_);
+      if (scheduler_.takeChanged())
+      {
+        publishStatus(REPLAY_CHANNEL);
+      }
+    }
+    if (tick_us_ < now_us)
+    {
+      tick_us_ = now_us;
+    }
+  }
+
+  bool output(uint8_t channel) const { return scheduler_.state(channel); }
+  uint32_t rejected() const { return rejected_; }
+
+private:
+  void publishStatus(uint8_t channel)
+  {
+    RelayStatus status = {};
+    status.channel = channel;
+    status.has_seq = scheduler_.hasSeq(channel);
+    status.seq = scheduler_.lastSeq(channel);
+    status.state = scheduler_.state(channel);
+    status.gpio = status.state;
+    status.pulsing = scheduler_.pulsing(channel);
+
+    char topic[RELAY_STATUS_TOPIC_LEN];
+    char message[RELAY_STATUS_MESSAGE_LEN];
+    formatRelayStatusTopic(topic, sizeof(topic), channel);
+    const int length = formatRelayStatus(message, sizeof(message), status);
+    broker_.publish(topic, reinterpret_cast<const uint8_t *>(message), length, true);
+  }
+
+  LocalBroker &broker_;
+  RelayScheduler scheduler_;
+  int64_t tick_us_ = 0;
+  uint32_t rejected_ = 0;
+};
+
+double percentile(const std::vector<uint64_t> &sorted, double p)
+{
+  if (sorted.empty())
+  {
+    return 0;
+  }
+  const size_t index = static_cast<size_t>(p / 100.0 * (sorted.size() - 1) + 0.5);
+  return static_cast<double>(sorted[index]);
+}
+
+void usage()
+{
+  fprintf(stderr, "usage: replay_trace --trace FILE [--speed X] [--max-gap-ms MS] [--pulse MS]\n"
+                  "  --speed 0 replays as fast as possible (default), 1 in real time, N at N x\n");
+}
+
+bool parseArgs(int argc, char **argv, Options &opt)
+{
+  for (int i = 1; i < argc; i++)
+  {
+    const std::string arg = argv[i];
+    if (i + 1 >= argc)
+    {
+      return false;
+    }
+    const char *value = argv[++i];
+    if (arg == "--trace") opt.trace_path = value;
+    else if (arg == "--speed") opt.speed = strtod(value, nullptr);
+    else if (arg == "--max-gap-ms") opt.max_gap_ms = strtoul(value, nullptr, 10);
+    else if (arg == "--pulse") opt.pulse_ms = static_cast<uint32_t>(strtoul(value, nullptr, 10));
+    else return false;
+  }
+  return !opt.trace_path.empty() && opt.speed >= 0;
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+  Options opt;
+  if (!parseArgs(argc, argv, opt))
+  {
+    usage();
+    return 2;
+  }
+
+  std::vector<Tap> taps;
+  uint32_t start_unix = 0;
+  if (!readTrace(opt.trace_path, taps, start_unix) || taps.empty())
+  {
+    fprintf(stderr, "cannot read trace %s\n", opt.trace_path.c_str());
+    return 1;
+  }
+
+  // A registered card's state before the window is the opposite of its first
+  // recorded status, since every tap toggles it
+  std::map<std::string, bool> initial;
+  for (const Tap &tap : taps)
+  {
+    char uid[32];
+    formatUid(tap.uid, tap.uid_len, uid, sizeof(uid));
+    if (tap.registered && initial.find(uid) == initial.end())
+    {
+      initial[uid] = !tap.status;
+    }
+  }
+
+  LocalBroker broker;
+  BackendStandIn backend(broker);
+  RelayStandIn relay(broker);
+  backend.seed(initial);
+
+  // Scanner state, as in src/main.cpp
+  RegistryCache registry_cache;
+  registry_cache.begin(initial.size());
+  RelayAckTracker relay_ack;
+  uint32_t seq_counter = 1u << 16; // RelaySequencer's epoch 1
+  uint64_t registry_errors = 0;
+  int64_t now_us = 0;
+
+  for (const std::vector<uint8_t> &delta : backend.snapshot())
+  {
+    registry_cache.applyDelta(delta.data(), delta.size());
+  }
+  broker.subscribe(REGISTRY_TOPIC, [&](const std::string &, const uint8_t *payload, size_t length) {
+    const DeltaResult result = registry_cache.applyDelta(payload, length);
+    registry_errors += result == DeltaResult::Applied || result == DeltaResult::Stale ? 0 : 1;
+  });
+  broker.subscribe(std::string(RELAY_COMMAND_TOPIC_PREFIX) + "/#", [&](const std::string &, const uint8_t *payload, size_t length) {
+    relay.onCommand(payload, length, now_us);
+  });
+  broker.subscribe(std::string(RELAY_STATUS_TOPIC_PREFIX) + "/#",
+                   [&](const std::string &, const uint8_t *payload, size_t length) {
+                     RelayStatus status;
+                     if (parseRelayStatus(payload, length, status))
+                     {
+                       relay_ack.onStatus(status, static_cast<unsigned long>(now_us / 1000));
+                     }
+                   });
+
+  std::vector<uint64_t> processing_ns;
+  processing_ns.reserve(taps.size());
+  uint64_t mismatches = 0;
+  uint64_t backend_mismatches = 0;
+  uint64_t cache_disagreements = 0;
+  uint64_t unacked = 0;
+  Clock::duration busy = Clock::duration::zero();
+
+  printf("Replaying %zu taps from %s (%zu registered cards, speed %s)\n", taps.size(), opt.trace_path.c_str(),
+         initial.size(), opt.speed > 0 ? std::to_string(opt.speed).c_str() : "max");
+
+  for (size_t i = 0; i < taps.size(); i++)
+  {
+    const Tap &tap = taps[i];
+    now_us += static_cast<int64_t>(tap.delta_ms) * 1000;
+    if (opt.speed > 0 && tap.delta_ms > 0)
+    {
+      const unsigned long wait_ms = std::min(static_cast<unsigned long>(tap.delta_ms / opt.speed), opt.max_gap_ms);
+      std::this_thread::sleep_for(std::chrono::milliseconds(wait_ms));
+    }
+    relay.advance(now_us);
+
+    const Clock::time_point start = Clock::now();
+
+    char rfid_uid[32] = {0};
+    char encoded[96] = {0};
+    formatUid(tap.uid, tap.uid_len, rfid_uid, sizeof(rfid_uid));
+    uint8_t cached_status = 0;
+    const bool cached = registry_cache.lookup(tap.uid, tap.uid_len, cached_status);
+    urlEncode(rfid_uid, encoded, sizeof(encoded));
+
+    // Same order as the scanner: act on the cache, then let the backend correct it
+    char command_topic[RELAY_COMMAND_TOPIC_LEN];
+    formatRelayCommandTopic(command_topic, sizeof(command_topic), REPLAY_CHANNEL);
+    auto publishDecision = [&](uint8_t status) {
+      RelayPlan plan = planRelayCommands(status, REPLAY_CHANNEL, opt.pulse_ms);
+      for (uint8_t c = 0; c < plan.count; c++)
+      {
+        plan.commands[c].seq = ++seq_counter;
+        char message[RELAY_COMMAND_MESSAGE_LEN];
+        const int length = formatRelayCommand(message, sizeof(message), plan.commands[c]);
+        broker.publish(command_topic, reinterpret_cast<const uint8_t *>(message), length, plan.retained[c]);
+      }
+      const RelayCommand &last = plan.commands[plan.count - 1];
+      const unsigned long now_ms = static_cast<unsigned long>(now_us / 1000);
+      relay_ack.expect(last.seq, last.state, now_ms, now_ms, last.type == RelayCommandType::Pulse);
+    };
+    const int local_status = localDecision(true, cached, cached_status);
+    publishDecision(static_cast<uint8_t>(local_status));
+
+    std::string body;
+    backend.check(encoded, body);
+    CheckResponse response;
+    if (!parseCheckResponse(body.c_str(), body.size(), response))
+    {
+      fprintf(stderr, "tap %zu: backend response did not parse: %s\n", i, body.c_str());
+      return 1;
+    }
+    // Each disagreement costs a correcting command after the backend round trip
+    if (response.status != local_status)
+    {
+      publishDecision(response.status);
+    }
+    if (cached != response.found || response.status != local_status)
+    {
+      cache_disagreements++;
+    }
+    broker.pump();
+
+    const Clock::time_point end = Clock::now();
+    busy += end - start;
+    processing_ns.push_back(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()));
+
+    if (relay_ack.pending())
+    {
+      unacked++;
+    }
+    if ((response.status == 1) != tap.status)
+    {
+      backend_mismatches++;
+    }
+    const bool output = relay.output(REPLAY_CHANNEL);
+    if (output != tap.status)
+    {
+      if (mismatches < MAX_REPORTED_MISMATCHES)
+      {
+        printf("  mismatch at tap %zu (%s): recorded %d, relay %s\n", i, rfid_uid, tap.status ? 1 : 0,
+               output ? "ON" : "OFF");
+      }
+      mismatches++;
+    }
+  }
+
+  std::sort(processing_ns.begin(), processing_ns.end());
+  const double busy_s = std::chrono::duration<double>(busy).count();
+  const RelayAckStats &ack = relay_ack.stats();
+
+  printf("\nTrace span: %.1f h of recorded traffic starting at unix %u\n", now_us / 3.6e9, start_unix);
+  printf("Throughput: %.0f taps/s (%.3f s of processing)\n", busy_s > 0 ? taps.size() / busy_s : 0.0, busy_s);
+  printf("Host processing time tap->ack (no network): p50 %.1f us, p90 %.1f us, p99 %.1f us, p99.9 %.1f us, "
+         "max %.1f us\n",
+         percentile(processing_ns, 50) / 1000, percentile(processing_ns, 90) / 1000,
+         percentile(processing_ns, 99) / 1000, percentile(processing_ns, 99.9) / 1000, processing_ns.back() / 1000.0);
+  printf("Relay: %lu acked, %lu unacked, %lu pin mismatches, %u rejected commands, %llu broker messages\n",
+         static_cast<unsigned long>(ack.acked), static_cast<unsigned long>(unacked),
+         static_cast<unsigned long>(ack.mismatched), relay.rejected(),
+         static_cast<unsigned long long>(broker.published()));
+  printf("Registry cache: %llu disagreements with the backend, %llu delta errors\n",
+         static_cast<unsigned long long>(cache_disagreements), static_cast<unsigned long long>(registry_errors));
+  printf("Decisions: %llu of %zu differ from the recorded status (%llu already at the backend stand-in)\n",
+         static_cast<unsigned long long>(mismatches), taps.size(), static_cast<unsigned long long>(backend_mismatches));
+
+  return mismatches == 0 ? 0 : 3;
+}
@@ -0,0 +1,154 @@
+/*
+ * Host benchmark for the scanner's registered-card set (include/uid_set.h).
+ *
+ * Reports lookup latency (registered and unknown cards), Bloom filter
+ * rejection rate and bytes per card at 1k/10k/100k cards, and checks every
+ * answer against std::map.
+ *
+ * Build and run from the repository root:
+ *   g++ -O2 -std=c++17 -Iinclude tools/uid_set_bench.cpp -o uid_set_bench
+ *   ./uid_set_bench
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "uid_set.h"
+
+namespace
+{
+constexpr size_t LOOKUPS = 1000000;
+constexpr size_t NAIVE_ENTRY_BYTES = 12; // uid_len + uid[10] + status, the plain sorted table
+
+// Mix of 4-byte (MIFARE Classic) and 7-byte (Ultralight/DESFire) UIDs
+UidKey randomKey(std::mt19937_64 &rng)
+{
+  uint8_t uid[UID_SET_MAX_UID_LEN];
+  const uint8_t len = (rng() % 5 == 0) ? 7 : 4;
+  for (uint8_t i = 0; i < len; i++)
+  {
+    uid[i] = static_cast<uint8_t>(rng());
+  }
+  UidKey key;
+  key.assign(uid, len);
+  return key;
+}
+
+std::string keyString(const UidKey &key)
+{
+  return std::string(reinterpret_cast<const char *>(key.bytes), UID_SET_KEY_LEN);
+}
+
+double nsPerLookup(const CompactUidSet &set, const std::vector<UidKey> &keys, size_t &hits)
+{
+  hits = 0;
+  uint8_t status = 0;
+  const auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < LOOKUPS; i++)
+  {
+    hits += set.lookup(keys[i % keys.size()], status) ? 1 : 0;
+  }
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  return std::chrono::duration<double, std::nano>(elapsed).count() / LOOKUPS;
+}
+
+bool runSize(size_t cards)
+{
+  std::mt19937_64 rng(cards);
+  std::map<std::string, UidSetOp> reference;
+  while (reference.size() < cards)
+  {
+    UidSetOp op = {randomKey(rng), static_cast<uint8_t>(rng() & 1), false};
+    reference[keyString(op.key)] = op;
+  }
+
+  std::vector<UidSetOp> ops;
+  std::vector<UidKey> registered;
+  for (const auto &item : reference)
+  {
+    ops.push_back(item.second);
+    registered.push_back(item.second.key);
+  }
+  std::shuffle(registered.begin(), registered.end(), rng);
+
+  std::vector<UidKey> unknown;
+  while (unknown.size() < registered.size())
+  {
+    const UidKey key = randomKey(rng);
+    if (!reference.count(keyString(key)))
+    {
+      unknown.push_back(key);
+    }
+  }
+
+  CompactUidSet set;
+  set.begin(cards);
+  const auto build_start = std::chrono::steady_clock::now();
+  if (!set.rebuild(ops.data(), ops.size()))
+  {
+    printf("%zu cards: allocation failed\n", cards);
+    return false;
+  }
+  const double build_ms =
+    std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - build_start).count();
+
+  // Correctness against the reference map
+  for (const UidKey &key : registered)
+  {
+    uint8_t status = 0;
+    if (!set.lookup(key, status) || status != reference[keyString(key)].status)
+    {
+      printf("%zu cards: lookup mismatch for a registered card\n", cards);
+      return false;
+    }
+  }
+  size_t bloom_rejects = 0;
+  for (const UidKey &key : unknown)
+  {
+    bloom_rejects += set.mayContain(key) ? 0 : 1;
+    if (set.contains(key))
+    {
+      printf("%zu cards: unknown card reported as registered\n", cards);
+      return false;
+    }
+  }
+
+  size_t hits = 0;
+  const double hit_ns = nsPerLookup(set, registered, hits);
+  const double miss_ns = nsPerLookup(set, unknown, hits);
+
+  // Unknown cards that got past the Bloom filter into the table search
+  CompactUidSet no_bloom;
+  no_bloom.rebuild(ops.data(), ops.size());
+  const double miss_no_bloom_ns = nsPerLookup(no_bloom, unknown, hits);
+
+  const UidSetUsage usage = set.usage();
+  const size_t table_bytes = usage.data_bytes + usage.index_bytes + usage.status_bytes;
+  printf("%7zu cards | build %7.2f ms | hit %6.1f ns | miss %6.1f ns (%6.1f ns without Bloom, %5.1f%% rejected, %4.1f%% expected to pass) | "
+         "table %5.2f B/card + Bloom %5.2f B/card (naive %zu B/card)\n",
+         cards, build_ms, hit_ns, miss_ns, miss_no_bloom_ns,
+         100.0 * bloom_rejects / unknown.size(), 100.0 * usage.bloom_pass_rate,
+         static_cast<double>(table_bytes) / cards,
+         static_cast<double>(usage.bloom_bytes) / cards,
+         NAIVE_ENTRY_BYTES);
+  return true;
+}
+} // namespace
+
+int main()
+{
+  const size_t sizes[] = {1000, 10000, 100000};
+  for (size_t cards : sizes)
+  {
+    if (!runSize(cards))
+    {
+      return 1;
+    }
+  }
+  return 0;
+}